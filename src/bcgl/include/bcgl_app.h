@@ -21,6 +21,7 @@ enum BCEventType
     BC_EVENT_TOUCH_MOVE,
     BC_EVENT_TEXT_INPUT,
     BC_EVENT_TEXT_CANCEL,
+    BC_EVENT_TEXTURE_LOADED,
 };
 
 // Key Codes
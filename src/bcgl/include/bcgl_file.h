@@ -20,6 +20,7 @@ typedef struct
     bool isAsset;
     size_t length;
     void *aux;
+    void *map; // set by bcMapFile
 } BCFile;
 
 typedef enum
@@ -51,6 +52,7 @@ size_t bcWriteFile(BCFile *file, void* buf, size_t count);
 off_t bcSeekFile(BCFile *file, off_t offset, int origin);
 size_t bcGetFilePosition(BCFile *file);
 const char * bcReadFileLine(BCFile *file);
+const void * bcMapFile(BCFile *file);
 
 #define bcPrintFile(file, format, ...) { fprintf((FILE*)(file->handle), format, ##__VA_ARGS__); }
 
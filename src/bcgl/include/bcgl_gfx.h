@@ -14,6 +14,7 @@ typedef enum
     BC_TEXTURE_REPEAT   = 0x8,
     BC_TEXTURE_CLAMP    = 0x10,
     BC_TEXTURE_DETACHED = 0x20,
+    BC_TEXTURE_MIPMAP_CPU = 0x40,
 } BCTextureFlags;
 
 typedef enum
@@ -27,7 +28,14 @@ typedef enum
     BC_MESH_COL1        = 0x40,
     BC_MESH_COL3        = 0x80,
     BC_MESH_COL4        = 0x100,
+    // compact storage in the vertex buffer, vertices stay float on the CPU
+    BC_MESH_HALF_POS    = 0x200,
+    BC_MESH_HALF_TEX    = 0x400,
+    BC_MESH_BYTE_COL    = 0x800,
+    BC_MESH_BYTE_NORM   = 0x1000,
+    BC_MESH_PACKED_NORM = 0x2000,
     BC_MESH_DEFAULT     = (BC_MESH_POS3 | BC_MESH_NORM | BC_MESH_TEX2 | BC_MESH_COL4),
+    BC_MESH_COMPACT     = (BC_MESH_DEFAULT | BC_MESH_HALF_TEX | BC_MESH_BYTE_COL | BC_MESH_PACKED_NORM),
 } BCMeshFlags;
 
 typedef enum
@@ -36,8 +44,19 @@ typedef enum
     BC_MESH_DYNAMIC,
     BC_MESH_OPTIMIZED,
     BC_MESH_NO_VBO,
+    BC_MESH_STREAM,
+    BC_MESH_SHARED,
 } BCMeshType;
 
+typedef enum
+{
+    BC_OPTIMIZE_WELD            = 0x1,
+    BC_OPTIMIZE_VERTEX_CACHE    = 0x2,
+    BC_OPTIMIZE_OVERDRAW        = 0x4,
+    BC_OPTIMIZE_VERTEX_FETCH    = 0x8,
+    BC_OPTIMIZE_ALL             = 0xf,
+} BCOptimizeFlags;
+
 typedef enum
 {
     BC_LINES,
@@ -72,6 +91,8 @@ typedef enum
     BC_SHADER_UNIFORM_LIGHT_ENABLED,
     BC_SHADER_UNIFORM_LIGHT_POSITION,
     BC_SHADER_UNIFORM_LIGHT_COLOR,
+    BC_SHADER_UNIFORM_MVPMATRIX,
+    BC_SHADER_UNIFORM_NORMALMATRIX,
     BC_SHADER_UNIFORM_MAX
 } BCShaderUniforms;
 
@@ -111,24 +132,54 @@ typedef struct
 
 typedef struct
 {
-    uint8_t RM_type;
+    uint32_t RM_handle;
+    bool RM_pending;
+    int RM_frame;
     unsigned int id;
     int width;
     int height;
     int format;
     int flags;
     BCImage *image;
+    BCImage **mipmaps;
+    int num_mipmaps;
 } BCTexture;
 
 typedef struct
 {
-    uint8_t RM_type;
+    BCTexture *texture;
+    float sx, sy, sw, sh;
+    int x;
+    int y;
+    int width;
+    int height;
+    int page;
+    BCImage *image;
+} BCAtlasRegion;
+
+typedef struct
+{
+    int width;
+    int height;
+    int padding;
+    int flags;
+    void *pages;
+    int num_pages;
+    BCAtlasRegion **regions;
+    int num_regions;
+    int max_regions;
+} BCAtlas;
+
+typedef struct
+{
+    uint32_t RM_handle;
     unsigned int programId;
     unsigned int vs_id;
     unsigned int fs_id;
     int loc_uniforms[BC_SHADER_UNIFORM_MAX];
     char *vs_code;
     char *fs_code;
+    int features;
 } BCShader;
 
 typedef struct
@@ -138,21 +189,62 @@ typedef struct
     int size;
 } BCShaderVar;
 
+#define BC_MESH_DIRTY_RANGES 8
+#define BC_MESH_MAX_LODS 8
+
+typedef struct
+{
+    int first;
+    int count;
+} BCMeshRange;
+
 typedef struct
 {
-    uint8_t RM_type;
+    uint32_t RM_handle;
+    bool RM_pending;
+    int RM_frame;
     int num_vertices;
     int num_indices;
     int format;
     int comps[BC_VERTEX_ATTR_MAX];
     int total_comps;
+    int stride; // bytes per vertex in the vertex buffer
+    int attr_types[BC_VERTEX_ATTR_MAX];
+    int attr_offsets[BC_VERTEX_ATTR_MAX];
+    bool packed;
     float *vertices;
-    uint16_t *indices;
+    void *indices; // uint16_t or uint32_t by index_size, see bcGetMeshIndex
+    int index_size;
     int draw_mode;
     int draw_count;
     unsigned int vbo_vertices;
     unsigned int vbo_indices;
+    int vbo_offset;
+    int ibo_offset;
+    int stream_vertices; // BC_MESH_STREAM, what to re-stream after the ring wraps
+    int stream_indices;
+    int stream_generation;
+    unsigned int vao;
+    int arena; // BC_MESH_SHARED storage, -1 until uploaded
+    int base_vertex;
+    int arena_vertices;
+    int arena_indices;
+    BCMeshRange dirty_vertices[BC_MESH_DIRTY_RANGES];
+    BCMeshRange dirty_indices[BC_MESH_DIRTY_RANGES];
+    int num_dirty_vertices;
+    int num_dirty_indices;
+    BCMeshRange lods[BC_MESH_MAX_LODS]; // index ranges, lods[0] is the full mesh
+    int num_lods;
+    int lod_level; // bcDrawMesh hysteresis, kept while drawn once per frame
+    int lod_frame;
+    BCMeshRange *parts; // submeshes added by bcAttachMesh
+    int num_parts;
     BCMeshType type;
+    bool has_bounds;
+    float bounds_min[3];
+    float bounds_max[3];
+    float bounds_center[3];
+    float bounds_radius;
 } BCMesh;
 
 typedef struct
@@ -187,6 +279,36 @@ typedef struct
     };
 } BCFontParams;
 
+typedef struct
+{
+    void *commands;
+    int num_commands;
+    int max_commands;
+    float *data;
+    int num_data;
+    int max_data;
+} BCCommandBuffer;
+
+typedef struct
+{
+    int draw_calls;
+    int uniform_uploads;
+    int skipped_uploads;
+    int state_changes;
+    int skipped_state_changes;
+    int visible_meshes;
+    int culled_meshes;
+} BCGfxStats;
+
+typedef struct
+{
+    float time_to_first_frame_ms;
+    float total_restore_ms;
+    int restored_textures;
+    int restored_meshes;
+    int pending;
+} BCRestoreStats;
+
 //
 // macros
 //
@@ -230,6 +352,7 @@ bool bcUpdateShader(BCShader *shader);
 void bcReleaseShader(BCShader *shader);
 void bcDestroyShader(BCShader *shader);
 void bcBindShader(BCShader *shader);
+BCShader * bcGetShaderFromHandle(uint32_t handle);
 unsigned int bcLoadShader(const char *code, unsigned int shaderType);
 bool bcLinkShaderProgram(unsigned int programId);
 
@@ -242,10 +365,21 @@ void bcDestroyImage(BCImage *image);
 // Texture
 BCTexture * bcCreateTextureFromFile(const char *filename, /*BCTextureFlags*/ int flags);
 BCTexture * bcCreateTextureFromImage(BCImage *image, /*BCTextureFlags*/ int flags);
+BCTexture * bcLoadTextureAsync(const char *filename, /*BCTextureFlags*/ int flags, int priority);
+void bcSetTextureUploadBudget(int bytes_per_frame);
 void bcUpdateTexture(BCTexture *texture);
 void bcReleaseTexture(BCTexture *texture);
 void bcDestroyTexture(BCTexture *texture);
 void bcBindTexture(BCTexture *texture);
+BCTexture * bcGetTextureFromHandle(uint32_t handle);
+
+// Atlas
+BCAtlas * bcCreateAtlas(int width, int height, int padding, /*BCTextureFlags*/ int flags);
+void bcDestroyAtlas(BCAtlas *atlas);
+BCAtlasRegion * bcAddAtlasImage(BCAtlas *atlas, BCImage *image);
+BCAtlasRegion * bcAddAtlasFile(BCAtlas *atlas, const char *filename);
+void bcRemoveAtlasRegion(BCAtlas *atlas, BCAtlasRegion *region);
+void bcRepackAtlas(BCAtlas *atlas);
 
 // View State
 void bcClear(BCColor color);
@@ -266,21 +400,39 @@ float * bcGetTextureMatrix();
 void bcSetScissor(bool enabled);
 void bcScissorRect(int x, int y, int w, int h);
 void bcSetColor(BCColor color, BCColorType type);
+void bcSetFrustumCulling(bool enabled);
+void bcSetLODTriangleSize(float pixels);
+const BCGfxStats * bcGetGfxStats();
+void bcSetRestoreBudget(float ms_per_frame);
+const BCRestoreStats * bcGetRestoreStats();
 
 // Mesh
 BCMesh * bcCreateMesh(/*BCMeshFlags*/ int format, const float *vert_data, int vert_num, const uint16_t *indx_data, int indx_num, BCMeshType type);
 BCMesh * bcCopyMesh(BCMesh *mesh);
+BCMesh * bcCreateMesh32(/*BCMeshFlags*/ int format, const float *vert_data, int vert_num, const uint32_t *indx_data, int indx_num, BCMeshType type);
 void bcUpdateMesh(BCMesh *mesh);
+void bcMarkMeshDirty(BCMesh *mesh, int first, int count);
+void bcMarkMeshIndicesDirty(BCMesh *mesh, int first, int count);
 void bcReleaseMesh(BCMesh *mesh);
 void bcDestroyMesh(BCMesh *mesh);
+BCMesh * bcGetMeshFromHandle(uint32_t handle);
+unsigned int bcGetMeshIndex(const BCMesh *mesh, int i);
+void bcSetMeshIndex(BCMesh *mesh, int i, unsigned int value);
 void bcDrawMesh(BCMesh *mesh);
+// state keeps the level of one call site between frames, start it at -1
+void bcDrawMeshLOD(BCMesh *mesh, int *state);
 void bcBindMesh(BCMesh *mesh);
 void bcDrawMeshPart(BCMeshPart part);
 void bcDrawMeshRange(BCMesh *mesh, int start, int count);
+bool bcIsMeshVisible(BCMesh *mesh);
+void bcDrawMeshInstanced(BCMesh *mesh, const float *matrices, const BCColor *colors, int count);
 BCMeshPart bcPartFromMesh(BCMesh *mesh);
 BCMeshPart bcAttachMesh(BCMesh *mesh, BCMesh *src, bool destroy_src);
+BCMeshPart bcGetMeshPart(BCMesh *mesh, int index);
 BCMesh * bcCreateMeshFromFile(const char *filename);
 bool bcSaveMeshToFile(BCMesh *mesh, const char *filename);
+// bits quantizes every vertex component (1-16), 0 keeps exact floats
+bool bcSaveMeshToFileCompressed(BCMesh *mesh, const char *filename, int bits);
 
 // IM
 bool bcBegin(BCDrawMode mode);
@@ -314,10 +466,45 @@ void bcPrepareScene3D(float fovy);
 void bcPrepareScene2D(float height, bool center);
 void bcPrepareSceneGUI();
 
+// Sprite Batch
+void bcBeginSpriteBatch(bool sort);
+void bcDrawSprite(BCTexture *texture, float x, float y, float w, float h, float sx, float sy, float sw, float sh);
+void bcEndSpriteBatch();
+
+// Render Queue
+void bcBeginRenderQueue();
+void bcSetRenderLayer(int layer, bool translucent);
+void bcEndRenderQueue();
+
+// Command Buffer
+BCCommandBuffer * bcCreateCommandBuffer();
+void bcDestroyCommandBuffer(BCCommandBuffer *buffer);
+void bcResetCommandBuffer(BCCommandBuffer *buffer);
+void bcCmdBindShader(BCCommandBuffer *buffer, BCShader *shader);
+void bcCmdBindTexture(BCCommandBuffer *buffer, BCTexture *texture);
+void bcCmdSetBlend(BCCommandBuffer *buffer, bool enabled);
+void bcCmdSetDepthTest(BCCommandBuffer *buffer, bool enabled);
+void bcCmdSetAlphaTest(BCCommandBuffer *buffer, bool enabled);
+void bcCmdSetCulling(BCCommandBuffer *buffer, bool enabled);
+void bcCmdSetLighting(BCCommandBuffer *buffer, bool enabled);
+void bcCmdSetColor(BCCommandBuffer *buffer, BCColor color, BCColorType type);
+void bcCmdSetProjectionMatrix(BCCommandBuffer *buffer, const float *m);
+void bcCmdSetModelViewMatrix(BCCommandBuffer *buffer, const float *m);
+void bcCmdDrawMesh(BCCommandBuffer *buffer, BCMesh *mesh);
+void bcCmdDrawMeshRange(BCCommandBuffer *buffer, BCMesh *mesh, int start, int count);
+void bcCmdBegin(BCCommandBuffer *buffer, BCDrawMode mode);
+void bcCmdEnd(BCCommandBuffer *buffer);
+void bcCmdVertex3f(BCCommandBuffer *buffer, float x, float y, float z);
+void bcCmdTexCoord2f(BCCommandBuffer *buffer, float u, float v);
+void bcCmdNormal3f(BCCommandBuffer *buffer, float x, float y, float z);
+void bcCmdColor4f(BCCommandBuffer *buffer, float r, float g, float b, float a);
+void bcExecuteCommandBuffers(BCCommandBuffer **buffers, int count);
+
 // Draw 2D
 void bcDrawTexture2D(BCTexture *texture, float x, float y, float w, float h, float sx, float sy, float sw, float sh);
 void bcDrawRect2D(float x, float y, float w, float h, bool fill);
 void bcDrawCircle2D(float x, float y, float r, int segments, bool fill);
+void bcDrawAtlasRegion2D(BCAtlasRegion *region, float x, float y, float w, float h);
 
 // Draw 3D
 void bcDrawCube(float x, float y, float z, float size_x, float size_y, float size_z, bool solid);
@@ -345,6 +532,11 @@ BCMesh * bcCreateMeshWireBox(float x1, float y1, float z1, float x2, float y2, f
 BCMesh * bcTransformMesh(BCMesh *mesh, float *m);
 void bcDumpMesh(BCMesh *mesh, FILE *stream);
 bool bcGetMeshAABB(BCMesh *mesh, float *minv, float *maxv);
+bool bcOptimizeMesh(BCMesh *mesh, /*BCOptimizeFlags*/ int flags);
+float bcGetMeshACMR(BCMesh *mesh);
+int bcGenerateMeshLODs(BCMesh *mesh, int num_lods, float ratio);
+BCMeshPart bcGetMeshLOD(BCMesh *mesh, int lod);
+int bcSelectMeshLOD(BCMesh *mesh, int previous);
 
 // Utils
 #define bcDrawTextf(font, x, y, format, ...) { char s[256] = ""; sprintf(s, format, ##__VA_ARGS__); bcDrawText(font, x, y, s); }
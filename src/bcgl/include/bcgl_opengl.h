@@ -2,6 +2,7 @@
 
 #if defined(SUPPORT_GLES)
     #include <GLES2/gl2.h>
+    #include <GLES2/gl2ext.h>
 #elif defined(SUPPORT_GLAD)
     #include <glad/glad.h>
 #else
@@ -74,7 +74,9 @@ void bcAppUpdate()
     BC_onUpdate(dt);
 
     // draw
+    bcBeginGfxFrame();
     BC_onDraw();
+    bcEndGfxFrame();
 
     bcUpdateWindow(s_Window);
 }
@@ -1,4 +1,5 @@
 #include <dirent.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -200,10 +201,14 @@ void bcCloseFile(BCFile *file)
 #ifdef __ANDROID__
     if (file->isAsset)
     {
+        // also releases the asset buffer
         AAsset_close(file->handle);
         file->handle = NULL;
+        file->map = NULL;
     }
 #endif
+    if (file->map)
+        munmap(file->map, file->length);
     if (file->handle)
         fclose(file->handle);
     free(file->name);
@@ -256,6 +261,33 @@ size_t bcGetFilePosition(BCFile *file)
     return ftell(file->handle);
 }
 
+const void * bcMapFile(BCFile *file)
+{
+    // read-only view of the whole file, valid until the file is closed
+    if (file == NULL || file->isDir || file->length == 0)
+        return NULL;
+    if (file->map)
+        return file->map;
+#ifdef __ANDROID__
+    if (file->isAsset)
+    {
+        file->map = (void *) AAsset_getBuffer(file->handle);
+        return file->map;
+    }
+#endif
+#ifdef MAP_POPULATE
+    // callers read the whole file, fault it in at once
+    int flags = MAP_PRIVATE | MAP_POPULATE;
+#else
+    int flags = MAP_PRIVATE;
+#endif
+    void *map = mmap(NULL, file->length, PROT_READ, flags, fileno(file->handle), 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    file->map = map;
+    return map;
+}
+
 const char * bcReadFileLine(BCFile *file)
 {
     if (file->aux == NULL)
@@ -1,3 +1,6 @@
+#include <pthread.h>
+#include <limits.h>
+
 #include "bcgl_internal.h"
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -18,17 +21,397 @@
 #include "par/par_shapes.h"
 #endif
 
+#ifdef SUPPORT_GLES
+#include <EGL/egl.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define DEBUG_SHADER 0
 
 // RM
 #define RM_TYPE_SHADER      0
 #define RM_TYPE_TEXTURE     1
 #define RM_TYPE_MESH        2
+#define RM_TYPE_MAX         3
+#define RM_SLOT_BITS        20 // rest of the handle is the slot generation
+#define RM_SLOT_MASK        ((1u << RM_SLOT_BITS) - 1)
+#define RM_MAX_GENERATION   ((1u << (32 - RM_SLOT_BITS)) - 1)
+
+// Sprite batch
+#define SPRITE_BATCH_SIZE   16384 // max quads per upload (uint16_t indices)
+
+// Stream buffer
+#define STREAM_BUFFER_SIZE  (1 << 20)
+#define STREAM_ALIGN        16
+#define STREAM_MAX_VERTICES 65536 // uint16_t indices
+
+// Indices
+#define INDEX16_MAX_VERTICES 65536 // bigger meshes use uint32_t indices
+
+// Mesh arenas
+#define ARENA_MIN_VERTICES  4096
+#define ARENA_MAX_VERTICES  65536 // uint16_t indices are rebased into the arena
+#define ARENA_MIN_INDICES   (ARENA_MIN_VERTICES * 3)
+#define MESH_DIRTY_GAP      16 // closer dirty spans are uploaded as one
+
+// Mesh optimizer
+#define OPTIMIZE_FIFO_SIZE  16 // cache measured by ACMR
+#define OPTIMIZE_LRU_SIZE   32 // cache modelled by the triangle ordering
+#define OPTIMIZE_MAX_VALENCE 32
+#define OPTIMIZE_OVERDRAW_THRESHOLD 1.05f // ACMR loss allowed for smaller clusters
+
+// Mesh LOD
+#define LOD_TRIANGLE_SIZE   16.0f // screen pixels per triangle
+#define LOD_HYSTERESIS      0.25f // triangle budget change needed to switch back
+#define LOD_MIN_REDUCTION   0.9f // stop the chain when a level saves less
+
+// Mesh codec
+#define CODEC_GROUP_SIZE        16 // deltas sharing one bit width
+#define CODEC_CHUNK_VERTICES    8192 // chunks decode independently
+#define CODEC_CHUNK_INDICES     (3 * 16384)
+#define CODEC_INDEX_FIFO        16 // recent vertices an index can refer to
+#define CODEC_DECODE_THREADS    4 // per section
+#define CODEC_THREAD_CHUNKS     8 // smaller meshes decode inline
+
+// Dirty state
+#define DIRTY_PROJECTION_MATRIX 0x001
+#define DIRTY_MODELVIEW_MATRIX  0x002
+#define DIRTY_TEXTURE_MATRIX    0x004
+#define DIRTY_COLORS            0x008
+#define DIRTY_LIGHTING          0x010
+#define DIRTY_LIGHT_POSITION    0x020
+#define DIRTY_ALPHA_TEST        0x040
+#define DIRTY_TEXTURE           0x080
+#define DIRTY_VERTEX_COLOR      0x100
+#define DIRTY_ALL               0x1ff
+#define DIRTY_SHADER_FEATURES   (DIRTY_LIGHTING | DIRTY_ALPHA_TEST | DIRTY_TEXTURE | DIRTY_VERTEX_COLOR)
+
+// Default shader variants
+#define SHADER_FEATURE_TEXTURE              0x01
+#define SHADER_FEATURE_ALPHA_TEST           0x02
+#define SHADER_FEATURE_ALPHA_ONLY_TEXTURE   0x04
+#define SHADER_FEATURE_LIGHTING             0x08
+#define SHADER_FEATURE_VERTEX_COLOR         0x10
+#define SHADER_VARIANT_MAX                  0x20
+#define SHADER_VARIANT                      0x100 // built from the default code
+
+// Instancing
+#define INSTANCE_COMPS          16 // 3 affine matrix rows + color
+
+// Texture loading
+#define TEXTURE_LOAD_WORKERS    2
+#define TEXTURE_UPLOAD_BUDGET   (4 << 20) // bytes per frame
+#define MIPMAP_THREAD_PIXELS    (128 * 128) // smaller levels are resized inline
+#define MIPMAP_THREADS          4 // row bands per level
+
+// Atlas
+#define ATLAS_REPACK_THRESHOLD  0.25f // wasted share of packed area
+
+// Program cache
+#define PROGRAM_CACHE_DIR       "local://shader_cache"
+
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH        0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS   0x87FE
+#endif
+#ifndef GL_HALF_FLOAT
+#define GL_HALF_FLOAT                   0x140B
+#endif
+#ifndef GL_HALF_FLOAT_OES
+#define GL_HALF_FLOAT_OES               0x8D61
+#endif
+#ifndef GL_INT_2_10_10_10_REV
+#define GL_INT_2_10_10_10_REV           0x8D9F
+#endif
+
+#ifdef SUPPORT_GLAD
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC) (GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC) (GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+#endif
+
+// GL state cache
+#define STATE_TEXTURE_UNITS     8
+#define STATE_UNKNOWN           -1
+
+// render queue key layout, high bits sort first
+#define RENDER_LAYER_BITS       4
+#define RENDER_SHADER_BITS      10
+#define RENDER_TEXTURE_BITS     12
+#define RENDER_MESH_BITS        13
+#define RENDER_DEPTH_BITS       24
 
 //
 // Context
 //
 
+// Generational slot map, objects are kept dense for iteration
+typedef struct
+{
+    void **objects;
+    uint32_t *dense_slots;
+    uint32_t *slots; // dense index, or next free slot
+    uint16_t *generations;
+    int count;
+    int num_slots;
+    int capacity;
+    int free_slot;
+} BCRegistry;
+
+typedef struct
+{
+    unsigned int id;
+    int size;
+    int offset;
+} BCStreamBuffer;
+
+typedef struct
+{
+    int start;
+    int count;
+} BCArenaRange;
+
+// Free ranges sorted by start, sizes are in vertices or indices
+typedef struct
+{
+    BCArenaRange *ranges;
+    int count;
+    int capacity;
+    int size;
+    int used;
+} BCFreeList;
+
+typedef struct
+{
+    int format;
+    int stride;
+    unsigned int vbo;
+    unsigned int ibo;
+    unsigned int vao;
+    BCFreeList vertices;
+    BCFreeList indices;
+    int num_meshes;
+} BCMeshArena;
+
+// Triangle range sorted by the overdraw pass
+typedef struct
+{
+    int first;
+    int count;
+    float sort_key;
+} BCMeshCluster;
+
+typedef struct
+{
+    uint32_t from;
+    uint32_t to;
+    float error;
+} BCMeshCollapse;
+
+typedef enum
+{
+    STATE_BLEND,
+    STATE_DEPTH_TEST,
+    STATE_CULL_FACE,
+    STATE_SCISSOR_TEST,
+    STATE_CAP_MAX
+} BCStateCap;
+
+// Shadow copy of the GL state, STATE_UNKNOWN forces the next call through
+typedef struct
+{
+    int caps[STATE_CAP_MAX];
+    int attribs[BC_VERTEX_ATTR_MAX];
+    int program;
+    int active_texture;
+    int textures[STATE_TEXTURE_UNITS];
+    int vertex_array;
+    int array_buffer;
+    int element_buffer;
+    int blend_src;
+    int blend_dst;
+    int depth_func;
+    int viewport[4];
+    int scissor[4];
+} BCStateCache;
+
+typedef struct
+{
+    bool VertexArrayObject;
+#ifdef SUPPORT_GLES
+    PFNGLGENVERTEXARRAYSOESPROC GenVertexArrays;
+    PFNGLBINDVERTEXARRAYOESPROC BindVertexArray;
+    PFNGLDELETEVERTEXARRAYSOESPROC DeleteVertexArrays;
+#else
+    PFNGLGENVERTEXARRAYSPROC GenVertexArrays;
+    PFNGLBINDVERTEXARRAYPROC BindVertexArray;
+    PFNGLDELETEVERTEXARRAYSPROC DeleteVertexArrays;
+#endif
+    bool InstancedArrays;
+#ifdef SUPPORT_GLES
+    PFNGLVERTEXATTRIBDIVISORANGLEPROC VertexAttribDivisor;
+    PFNGLDRAWARRAYSINSTANCEDANGLEPROC DrawArraysInstanced;
+    PFNGLDRAWELEMENTSINSTANCEDANGLEPROC DrawElementsInstanced;
+#else
+    PFNGLVERTEXATTRIBDIVISORPROC VertexAttribDivisor;
+    PFNGLDRAWARRAYSINSTANCEDPROC DrawArraysInstanced;
+    PFNGLDRAWELEMENTSINSTANCEDPROC DrawElementsInstanced;
+#endif
+    bool GenerateMipmap;
+    bool NonPowerOfTwoMipmaps;
+    bool ProgramBinaries;
+    bool ElementIndexUint;
+    unsigned int HalfFloatType; // 0 without half float attributes
+    bool PackedNormals;
+#ifdef SUPPORT_GLES
+    PFNGLGETPROGRAMBINARYOESPROC GetProgramBinary;
+    PFNGLPROGRAMBINARYOESPROC ProgramBinary;
+#else
+    PFNGLGETPROGRAMBINARYPROC GetProgramBinary;
+    PFNGLPROGRAMBINARYPROC ProgramBinary;
+#endif
+} BCExtensions;
+
+typedef enum
+{
+    TEXTURE_REQUEST_PENDING,
+    TEXTURE_REQUEST_DECODING,
+    TEXTURE_REQUEST_DECODED,
+    TEXTURE_REQUEST_CANCELLED,
+} BCTextureRequestState;
+
+typedef struct
+{
+    BCTextureRequestState state;
+    char *filename;
+    BCTexture *texture;
+    int flags;
+    int priority;
+    BCImage *image;
+} BCTextureRequest;
+
+typedef struct
+{
+    int type;
+    uint32_t handle;
+    int frame;
+} BCRestoreItem;
+
+typedef struct
+{
+    int x;
+    int y;
+    int width;
+} BCSkylineNode;
+
+typedef struct
+{
+    BCTexture *texture;
+    BCSkylineNode *nodes;
+    int num_nodes;
+    int packed_area;
+    int live_area;
+} BCAtlasPage;
+
+typedef struct
+{
+    const BCImage *src;
+    BCImage *dst;
+    int first_row;
+    int num_rows;
+} BCMipmapJob;
+
+typedef struct
+{
+    const uint8_t *section;
+    const uint32_t *offsets;
+    const float *ranges; // min and step per component when quantized
+    int bits;
+    int comps;
+    int index_size; // 0 for the vertex section
+    int chunk_size;
+    int count;
+    void *output;
+    int first_chunk;
+    int end_chunk;
+    bool ok;
+} BCMeshDecodeJob;
+
+typedef struct
+{
+    BCTexture *texture;
+    float pos[4][3];
+    float uv[4];
+    BCColor color;
+    int order;
+} BCSprite;
+
+typedef struct
+{
+    BCMesh *mesh;
+    int start;
+    int count;
+#ifdef SUPPORT_GLSL
+    BCShader *shader;
+#endif
+    BCTexture *texture;
+    mat4_t projection;
+    mat4_t modelview;
+    mat3_t texture_matrix;
+    BCColor colors[BC_COLOR_TYPE_MAX];
+    vec3_t light_position;
+    bool lighting;
+    bool alpha_test;
+    int caps[STATE_CAP_MAX];
+} BCRenderItem;
+
+typedef struct
+{
+    uint64_t key;
+    int index;
+} BCRenderKey;
+
+typedef enum
+{
+    BC_CMD_BIND_SHADER,
+    BC_CMD_BIND_TEXTURE,
+    BC_CMD_SET_BLEND,
+    BC_CMD_SET_DEPTH_TEST,
+    BC_CMD_SET_ALPHA_TEST,
+    BC_CMD_SET_CULLING,
+    BC_CMD_SET_LIGHTING,
+    BC_CMD_SET_COLOR,
+    BC_CMD_SET_PROJECTION_MATRIX,
+    BC_CMD_SET_MODELVIEW_MATRIX,
+    BC_CMD_DRAW_MESH,
+    BC_CMD_DRAW_MESH_RANGE,
+    BC_CMD_BEGIN,
+    BC_CMD_END,
+    BC_CMD_VERTEX,
+    BC_CMD_TEXCOORD,
+    BC_CMD_NORMAL,
+    BC_CMD_COLOR,
+} BCCommandType;
+
+typedef struct
+{
+    BCCommandType type;
+    union
+    {
+        void *object;
+        bool enabled;
+        int offset; // into the buffer data
+        struct { BCColor value; BCColorType type; } color;
+        struct { BCMesh *mesh; int start; int count; } draw;
+        BCDrawMode mode;
+        float v[4];
+    };
+} BCCommand;
+
 typedef struct
 {
     bool Started;
@@ -36,13 +419,30 @@ typedef struct
     mat4_t ModelViewMatrix;
     mat3_t TextureMatrix;
     BCColor ColorArray[BC_COLOR_TYPE_MAX];
-    bool ColorNeedUpdate;
     BCMesh *CurrentMesh;
 #ifdef SUPPORT_GLSL
     BCShader *DefaultShader;
     BCShader *CurrentShader;
+    BCShader *InstancedShader;
+    BCShader *ProgramShader;
+    BCShader *DefaultVariants[SHADER_VARIANT_MAX];
+    BCShader *InstancedVariants[SHADER_VARIANT_MAX];
+    BCShader *InstancedProgram; // variant used by the last instanced draw
+    int InstancedDirty; // state changed since that draw
 #endif
     bool LightingEnabled;
+    vec3_t LightPosition;
+    bool AlphaTestEnabled;
+    int VertexColorEnabled;
+    int DirtyFlags;
+    // culling
+    bool FrustumCulling;
+    bool FrustumNeedUpdate;
+    float LODTriangleSize;
+    float FrustumPlanes[6][4];
+    // stats
+    BCGfxStats Stats;
+    BCGfxStats FrameStats;
     // draw
     BCMesh *TempMesh;
     vec4_t TempVertexData[BC_VERTEX_ATTR_MAX];
@@ -55,7 +455,59 @@ typedef struct
     BCMesh *ReusableCubeMesh;
     BCMesh *ReusableWireCubeMesh;
     BCMesh *ReusablePlaneMesh;
-    clist_t *RM_list;
+    BCTexture *CurrentTexture;
+    // sprite batch
+    bool SpriteBatchActive;
+    bool SpriteBatchSort;
+    BCSprite *SpriteBatch;
+    int SpriteBatchCount;
+    int SpriteBatchCapacity;
+    BCMesh *SpriteBatchMesh;
+    // render queue
+    bool RenderQueueActive;
+    int RenderLayer;
+    bool RenderTranslucent;
+    BCRenderItem *RenderQueue;
+    BCRenderKey *RenderKeys;
+    int RenderQueueCount;
+    int RenderQueueCapacity;
+    // instancing
+    float *InstanceData;
+    int InstanceCapacity;
+    BCMesh *InstanceMesh;
+    // texture loading
+    clist_t *TextureRequests;
+    pthread_mutex_t TextureRequestMutex;
+    pthread_cond_t TextureRequestCond;
+    pthread_t TextureLoadWorkers[TEXTURE_LOAD_WORKERS];
+    bool TextureLoadQuit;
+    int TextureUploadBudget;
+    // restore
+    int FrameCounter;
+    float RestoreBudget;
+    float RestoreTimeLeft;
+    float RestoreStartTime;
+    bool RestoreFirstFrame;
+    bool Restoring;
+    BCRestoreItem *RestoreQueue;
+    int RestoreQueueCount;
+    int RestoreQueueCapacity;
+    unsigned int PlaceholderTexture;
+    BCRestoreStats RestoreStats;
+    BCStateCache State;
+    BCExtensions Ext;
+    // stream
+    BCStreamBuffer StreamVertices;
+    BCStreamBuffer StreamIndices;
+    int StreamGeneration; // bumped whenever streamed data is discarded
+    unsigned int SpriteIndexBuffer;
+    uint8_t *PackBuffer;
+    int PackBufferSize;
+    // shared meshes
+    BCMeshArena *Arenas;
+    int ArenaCount;
+    int ArenaCapacity;
+    BCRegistry RM[RM_TYPE_MAX];
 } BCContext;
 
 static BCContext *g_Context = NULL;
@@ -105,6 +557,16 @@ static BCShaderVar s_DefaultShaderAttributes[] =
     { NULL, NULL }
 };
 
+// Bound right after @BCVertexAttributes
+static BCShaderVar s_InstanceShaderAttributes[] =
+{
+    { "vec4", "a_InstanceRow0", 1 },
+    { "vec4", "a_InstanceRow1", 1 },
+    { "vec4", "a_InstanceRow2", 1 },
+    { "vec4", "a_InstanceColor", 1 },
+    { NULL, NULL, 0 }
+};
+
 // This must be alligned with @BCShaderUniforms
 static BCShaderVar s_DefaultShaderUniforms[] =
 {
@@ -120,9 +582,22 @@ static BCShaderVar s_DefaultShaderUniforms[] =
     { "bool", "u_LightEnabled", 1 },
     { "vec3", "u_LightPosition", 1 },
     { "vec4", "u_LightColor", 1 },
+    { "mat4", "u_MVPMatrix", 1 },
+    { "mat3", "u_NormalMatrix", 1 },
     { NULL, NULL }
 };
 
+// This must be alligned with the SHADER_FEATURE bits
+static const char *s_ShaderFeatureDefines[] =
+{
+    "USE_TEXTURE",
+    "USE_ALPHA_TEST",
+    "USE_ALPHA_ONLY_TEXTURE",
+    "USE_LIGHTING",
+    "USE_VERTEX_COLOR",
+    NULL
+};
+
 static BCShaderVar s_DefaultShaderVars[] =
 {
     { "vec3", "v_position", 1 },
@@ -132,44 +607,75 @@ static BCShaderVar s_DefaultShaderVars[] =
     { NULL, NULL }
 };
 
-#define STRINGIFY(s) #s
-
 // vertex code string
-static const char s_DefaultShaderVertexCode[] = STRINGIFY(
-void main()
-{
-    v_position = (u_ModelViewMatrix * vec4(a_Position, 1)).xyz;
-    v_normal = (u_ModelViewMatrix * vec4(a_Normal, 0)).xyz;
-    v_texCoord = (u_TextureMatrix * vec3(a_TexCoord, 1)).xy;
-    v_color = a_Color;
-    gl_Position = u_ProjectionMatrix * u_ModelViewMatrix * vec4(a_Position, 1);
-}
-);
+static const char s_DefaultShaderVertexCode[] =
+    "void main()\n"
+    "{\n"
+    "#ifdef USE_LIGHTING\n"
+    "    v_position = (u_ModelViewMatrix * vec4(a_Position, 1)).xyz;\n"
+    "    v_normal = u_NormalMatrix * a_Normal;\n"
+    "#endif\n"
+    "#ifdef USE_TEXTURE\n"
+    "    v_texCoord = (u_TextureMatrix * vec3(a_TexCoord, 1)).xy;\n"
+    "#endif\n"
+    "#ifdef USE_VERTEX_COLOR\n"
+    "    v_color = a_Color;\n"
+    "#else\n"
+    "    v_color = u_ColorArray[COLOR_PRIMARY];\n"
+    "#endif\n"
+    "    gl_Position = u_MVPMatrix * vec4(a_Position, 1);\n"
+    "}\n";
+
+// instanced vertex code string
+static const char s_InstancedShaderVertexCode[] =
+    "attribute vec4 a_InstanceRow0;\n"
+    "attribute vec4 a_InstanceRow1;\n"
+    "attribute vec4 a_InstanceRow2;\n"
+    "attribute vec4 a_InstanceColor;\n"
+    "void main()\n"
+    "{\n"
+    "    vec4 local = vec4(a_Position, 1);\n"
+    "    vec4 position = vec4(dot(a_InstanceRow0, local), dot(a_InstanceRow1, local), dot(a_InstanceRow2, local), 1.0);\n"
+    "#ifdef USE_LIGHTING\n"
+    "    v_position = (u_ModelViewMatrix * position).xyz;\n"
+    "    vec3 normal = vec3(dot(a_InstanceRow0.xyz, a_Normal), dot(a_InstanceRow1.xyz, a_Normal), dot(a_InstanceRow2.xyz, a_Normal));\n"
+    "    v_normal = u_NormalMatrix * normal;\n"
+    "#endif\n"
+    "#ifdef USE_TEXTURE\n"
+    "    v_texCoord = (u_TextureMatrix * vec3(a_TexCoord, 1)).xy;\n"
+    "#endif\n"
+    "#ifdef USE_VERTEX_COLOR\n"
+    "    v_color = a_Color * a_InstanceColor;\n"
+    "#else\n"
+    "    v_color = u_ColorArray[COLOR_PRIMARY] * a_InstanceColor;\n"
+    "#endif\n"
+    "    gl_Position = u_MVPMatrix * position;\n"
+    "}\n";
 
 // fragment code string
-static const char s_DefaultShaderFragmentCode[] = STRINGIFY(
-void main()
-{
-    gl_FragColor = u_VertexColorEnabled ? v_color : u_ColorArray[COLOR_PRIMARY];
-    if (u_UseTexture)
-    {
-        vec4 tex = texture2D(u_Texture, v_texCoord);
-        if (u_AlphaTest && tex.a < 0.1)
-            discard;
-        if (u_AlphaOnlyTexture)
-            tex = vec4(1, 1, 1, tex.a);
-        gl_FragColor *= tex;
-    }
-    if (u_LightEnabled)
-    {
-        vec3 norm = normalize(v_normal);
-        vec3 lightDir = normalize(u_LightPosition - v_position);
-        float diff = max(dot(norm, lightDir), 0.0);
-        vec4 diffuse = diff * u_ColorArray[COLOR_DIFFUSE];
-        gl_FragColor *= (u_ColorArray[COLOR_AMBIENT] + diffuse);
-    }
-}
-);
+static const char s_DefaultShaderFragmentCode[] =
+    "void main()\n"
+    "{\n"
+    "    gl_FragColor = v_color;\n"
+    "#ifdef USE_TEXTURE\n"
+    "    vec4 tex = texture2D(u_Texture, v_texCoord);\n"
+    "#ifdef USE_ALPHA_TEST\n"
+    "    if (tex.a < 0.1)\n"
+    "        discard;\n"
+    "#endif\n"
+    "#ifdef USE_ALPHA_ONLY_TEXTURE\n"
+    "    tex = vec4(1, 1, 1, tex.a);\n"
+    "#endif\n"
+    "    gl_FragColor *= tex;\n"
+    "#endif\n"
+    "#ifdef USE_LIGHTING\n"
+    "    vec3 norm = normalize(v_normal);\n"
+    "    vec3 lightDir = normalize(u_LightPosition - v_position);\n"
+    "    float diff = max(dot(norm, lightDir), 0.0);\n"
+    "    vec4 diffuse = diff * u_ColorArray[COLOR_DIFFUSE];\n"
+    "    gl_FragColor *= (u_ColorArray[COLOR_AMBIENT] + diffuse);\n"
+    "#endif\n"
+    "}\n";
 
 #else // SUPPORT_GLSL
 
@@ -189,1226 +695,5858 @@ static struct
 
 #endif // SUPPORT_GLSL
 
+// Version 1, sections follow the header unaligned
 typedef struct
 {
     uint8_t signature[4];
     uint32_t version;
     uint32_t size;
-    uint32_t reserved;
+    uint32_t index_size; // 0 in older files, same as 2
+    uint32_t format;
+    uint32_t type;
+    uint32_t total_comps;
+    uint32_t num_vertices;
+    uint32_t num_indices;
+    // optional, older files end here
+    float bounds_min[3];
+    float bounds_max[3];
+    float bounds_center[3];
+    float bounds_radius;
+    // optional, files without LODs end here
+    uint32_t num_lods;
+    uint32_t lods[BC_MESH_MAX_LODS][2];
+} BCMeshFileHeaderV1;
+
+#define MESH_FILE_HEADER_BASE_SIZE offsetof(BCMeshFileHeaderV1, bounds_min)
+#define MESH_FILE_HEADER_BOUNDS_SIZE offsetof(BCMeshFileHeaderV1, num_lods)
+
+// Version 2, 16 byte aligned sections at the given offsets
+typedef struct
+{
+    uint8_t signature[4];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t checksum; // hashData of everything after the header
+    uint32_t file_size;
+    uint32_t flags;
     uint32_t format;
     uint32_t type;
     uint32_t total_comps;
     uint32_t num_vertices;
     uint32_t num_indices;
+    uint32_t index_size;
+    uint32_t vertex_stride;
+    uint32_t num_streams;
+    uint32_t num_lods;
+    uint32_t num_parts;
+    uint32_t streams_offset;
+    uint32_t ranges_offset; // LODs, then parts
+    uint32_t vertices_offset;
+    uint32_t indices_offset;
+    float bounds_min[3];
+    float bounds_max[3];
+    float bounds_center[3];
+    float bounds_radius;
 } BCMeshFileHeader;
 
-static const char s_MeshFileSignature[4] = { 'B', 'C', 'M', 'D' };
-static const uint32_t s_MeshFileVersion = 1;
+// Where an attribute is in the vertex section, and how it's stored on the GPU
+typedef struct
+{
+    uint32_t attribute;
+    uint32_t comps;
+    uint32_t type;
+    uint32_t compact_flags; // format flags of this attribute, the GPU type depends on the driver
+    uint32_t offset;
+    uint32_t reserved;
+} BCMeshFileStream;
 
-//
-// Init
-//
+static const int s_CompactAttribFlags[BC_VERTEX_ATTR_MAX] =
+{
+    [BC_VERTEX_ATTR_POSITIONS] = BC_MESH_HALF_POS,
+    [BC_VERTEX_ATTR_NORMALS] = BC_MESH_BYTE_NORM | BC_MESH_PACKED_NORM,
+    [BC_VERTEX_ATTR_TEXCOORDS] = BC_MESH_HALF_TEX,
+    [BC_VERTEX_ATTR_COLORS] = BC_MESH_BYTE_COL,
+};
 
-void bcCreateGfx()
+#define MESH_FILE_ALIGN         16
+#define MESH_FILE_ALIGNED(x)    (((x) + MESH_FILE_ALIGN - 1) & ~(MESH_FILE_ALIGN - 1))
+#define MESH_FILE_HAS_BOUNDS    0x1
+#define MESH_FILE_COMPRESSED    0x2
+#define MESH_FILE_KNOWN_FLAGS   (MESH_FILE_HAS_BOUNDS | MESH_FILE_COMPRESSED)
+
+// Compressed section, followed by quantization ranges (vertices only) and chunk offsets
+typedef struct
 {
-    g_Context = NEW_OBJECT(BCContext);
-    g_Context->RM_list = NEW_OBJECT(clist_t);
-}
+    uint32_t size;
+    uint32_t bits; // quantization bits, 0 keeps exact floats
+    uint32_t num_lanes;
+    uint32_t num_chunks;
+    uint32_t chunk_size;
+} BCMeshFileCoded;
 
-void bcDestroyGfx()
+static const char s_MeshFileSignature[4] = { 'B', 'C', 'M', 'D' };
+static const uint32_t s_MeshFileVersion = 2;
+
+typedef struct
 {
-    if (g_Context->ReusableSolidMesh)
-    {
-        bcDestroyMesh(g_Context->ReusableSolidMesh);
-        g_Context->ReusableSolidMesh = NULL;
-    }
-    if (g_Context->ReusableCubeMesh)
-    {
-        bcDestroyMesh(g_Context->ReusableCubeMesh);
-        g_Context->ReusableCubeMesh = NULL;
-    }
-    if (g_Context->ReusableWireCubeMesh)
-    {
-        bcDestroyMesh(g_Context->ReusableWireCubeMesh);
-        g_Context->ReusableWireCubeMesh = NULL;
-    }
-    if (g_Context->ReusablePlaneMesh)
-    {
-        bcDestroyMesh(g_Context->ReusablePlaneMesh);
-        g_Context->ReusablePlaneMesh = NULL;
-    }
-#ifdef SUPPORT_GLSL
-    bcDestroyShader(g_Context->DefaultShader);
-    g_Context->DefaultShader = NULL;
-#endif
-    free(g_Context->RM_list);
-    free(g_Context);
-    g_Context = NULL;
-}
+    uint8_t signature[4];
+    uint32_t version;
+    uint64_t hash;
+    uint32_t format;
+    uint32_t length;
+} BCProgramFileHeader;
 
-void bcStartGfx()
+static const char s_ProgramFileSignature[4] = { 'B', 'C', 'P', 'B' };
+static const uint32_t s_ProgramFileVersion = 1;
+
+//
+// Registry
+//
+
+static uint32_t addRegistryObject(BCRegistry *reg, void *object)
 {
-    bcLog("OpenGL: %s", glGetString(GL_VERSION));
-    bcLog("Device: %s", glGetString(GL_RENDERER));
-    bcLog("GLSL: %s", glGetString(GL_SHADING_LANGUAGE_VERSION));
-    // init context
-    g_Context->ColorArray[BC_COLOR_TYPE_PRIMARY] = SET_COLOR(1, 1, 1, 1);
-    g_Context->ColorArray[BC_COLOR_TYPE_SECONDARY] = SET_COLOR(1, 1, 1, 1);
-    g_Context->ColorArray[BC_COLOR_TYPE_DIFFUSE] = SET_COLOR(0.8f, 0.8f, 0.8f, 1);
-    g_Context->ColorArray[BC_COLOR_TYPE_AMBIENT] = SET_COLOR(0.2f, 0.2f, 0.2f, 1);
-    g_Context->ColorArray[BC_COLOR_TYPE_SPECULAR] = SET_COLOR(0, 0, 0, 1);
-    g_Context->ColorArray[BC_COLOR_TYPE_EMISSION] = SET_COLOR(0, 0, 0, 1);
-    g_Context->ColorNeedUpdate = true;
-    g_Context->VertexCounter = -1;
-    g_Context->IndexCounter = -1;
-#ifdef SUPPORT_GLSL
-    if (!g_Context->DefaultShader)
+    uint32_t slot;
+    if (reg->free_slot >= 0)
     {
-        g_Context->DefaultShader = bcCreateShader(s_DefaultShaderVertexCode, s_DefaultShaderFragmentCode);
+        slot = reg->free_slot;
+        reg->free_slot = (int) reg->slots[slot];
     }
-#else
-    glAlphaFunc(GL_GREATER, 0.1f);
-    glDisable(GL_LIGHTING);
-    glEnable(GL_NORMALIZE);
-    glEnable(GL_COLOR_MATERIAL);
-    glShadeModel(GL_SMOOTH);
-#endif
-    // glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_FASTEST);
-    // gl default
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glDepthFunc(GL_LEQUAL);
-    glFrontFace(GL_CCW);
-    // RM
-    for (clist_node_t *node = g_Context->RM_list->head; node; node = node->next)
+    else
     {
-        uint8_t *p_type = (uint8_t*) node->data;
-        switch (*p_type)
+        if (reg->num_slots == reg->capacity)
         {
-        case RM_TYPE_SHADER:
-            bcUpdateShader((BCShader*) node->data);
-            break;
-        case RM_TYPE_TEXTURE:
-            bcUpdateTexture((BCTexture*) node->data);
-            break;
-        case RM_TYPE_MESH:
-            bcUpdateMesh((BCMesh*) node->data);
-            break;
+            if (reg->capacity > (int) RM_SLOT_MASK)
+            {
+                bcLogError("Too many resources!");
+                return 0;
+            }
+            reg->capacity = reg->capacity ? reg->capacity * 2 : 256;
+            reg->objects = EXTEND_ARRAY(reg->objects, reg->capacity, void *);
+            reg->dense_slots = EXTEND_ARRAY(reg->dense_slots, reg->capacity, uint32_t);
+            reg->slots = EXTEND_ARRAY(reg->slots, reg->capacity, uint32_t);
+            reg->generations = EXTEND_ARRAY(reg->generations, reg->capacity, uint16_t);
         }
-    }
-    g_Context->Started = true;
-    bcBindShader(NULL);
+        slot = reg->num_slots++;
+        // generation 0 is never used, so handle 0 is always invalid
+        reg->generations[slot] = 1;
+    }
+    reg->objects[reg->count] = object;
+    reg->dense_slots[reg->count] = slot;
+    reg->slots[slot] = reg->count++;
+    return ((uint32_t) reg->generations[slot] << RM_SLOT_BITS) | slot;
 }
 
-void bcStopGfx()
+static void * getRegistryObject(BCRegistry *reg, uint32_t handle)
+{
+    uint32_t slot = handle & RM_SLOT_MASK;
+    if (slot >= (uint32_t) reg->num_slots || reg->generations[slot] != (handle >> RM_SLOT_BITS))
+        return NULL;
+    return reg->objects[reg->slots[slot]];
+}
+
+static void removeRegistryObject(BCRegistry *reg, uint32_t handle)
 {
-    for (clist_node_t *node = g_Context->RM_list->head; node; node = node->next)
+    if (getRegistryObject(reg, handle) == NULL)
     {
-        uint8_t *p_type = (uint8_t*) node->data;
-        switch (*p_type)
-        {
-        case RM_TYPE_SHADER:
-            bcReleaseShader((BCShader*) node->data);
-            break;
-        case RM_TYPE_TEXTURE:
-            bcReleaseTexture((BCTexture*) node->data);
-            break;
-        case RM_TYPE_MESH:
-            bcReleaseMesh((BCMesh*) node->data);
-            break;
-        }
+        bcLogWarning("Stale resource handle 0x%x!", handle);
+        return;
     }
-    g_Context->Started = false;
+    // move the last object into the hole
+    uint32_t slot = handle & RM_SLOT_MASK;
+    uint32_t index = reg->slots[slot];
+    uint32_t last = --reg->count;
+    reg->objects[index] = reg->objects[last];
+    reg->dense_slots[index] = reg->dense_slots[last];
+    reg->slots[reg->dense_slots[index]] = index;
+    // invalidate outstanding handles
+    reg->generations[slot] = (reg->generations[slot] == RM_MAX_GENERATION) ? 1 : reg->generations[slot] + 1;
+    reg->slots[slot] = (uint32_t) reg->free_slot;
+    reg->free_slot = slot;
+}
+
+static void releaseRegistry(BCRegistry *reg)
+{
+    free(reg->objects);
+    free(reg->dense_slots);
+    free(reg->slots);
+    free(reg->generations);
+    memset(reg, 0, sizeof(BCRegistry));
+    reg->free_slot = -1;
 }
 
 //
-// Shader
+// State Cache
 //
 
-#ifdef SUPPORT_GLSL
+// This must be alligned with @BCStateCap
+static const GLenum s_StateCaps[STATE_CAP_MAX] =
+{
+    GL_BLEND,
+    GL_DEPTH_TEST,
+    GL_CULL_FACE,
+    GL_SCISSOR_TEST,
+};
 
-BCShader * bcCreateShaderFromSingleFile(const char *filename)
+static void invalidateState()
 {
-    char *code = bcLoadTextFile(filename, NULL);
-    if (code == NULL)
-        return NULL;
-    BCShader *shader = bcCreateShader(code, code);
-    free(code);
-    return shader;
+    BCStateCache *state = &(g_Context->State);
+    for (int i = 0; i < STATE_CAP_MAX; i++)
+        state->caps[i] = STATE_UNKNOWN;
+    for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
+        state->attribs[i] = STATE_UNKNOWN;
+    state->program = STATE_UNKNOWN;
+    state->vertex_array = STATE_UNKNOWN;
+    state->active_texture = STATE_UNKNOWN;
+    for (int i = 0; i < STATE_TEXTURE_UNITS; i++)
+        state->textures[i] = STATE_UNKNOWN;
+    state->array_buffer = STATE_UNKNOWN;
+    state->element_buffer = STATE_UNKNOWN;
+    state->blend_src = STATE_UNKNOWN;
+    state->blend_dst = STATE_UNKNOWN;
+    state->depth_func = STATE_UNKNOWN;
+    for (int i = 0; i < 4; i++)
+    {
+        state->viewport[i] = STATE_UNKNOWN;
+        state->scissor[i] = STATE_UNKNOWN;
+    }
 }
 
-BCShader * bcCreateShaderFromFile(const char *vsFilename, const char *fsFilename)
+static bool changeState(int *state, int value)
 {
-    char *vsCode = bcLoadTextFile(vsFilename, NULL);
-    if (vsCode == NULL)
-    {
-        return NULL;
-    }
-    char *fsCode = bcLoadTextFile(fsFilename, NULL);
-    if (fsCode == NULL)
+    if (*state == value)
     {
-        free(vsCode);
-        return NULL;
+        g_Context->Stats.skipped_state_changes++;
+        return false;
     }
-    BCShader *shader = bcCreateShader(vsCode, fsCode);
-    free(vsCode);
-    free(fsCode);
-    return shader;
+    *state = value;
+    g_Context->Stats.state_changes++;
+    return true;
 }
 
-BCShader * bcCreateShader(const char *vs_code, const char *fs_code)
+static void setCapability(BCStateCap cap, bool enabled)
 {
-    BCShader *shader = NEW_OBJECT(BCShader);
-    shader->RM_type = RM_TYPE_SHADER;
-    shader->vs_code = cstr_strdup(vs_code);
-    shader->fs_code = cstr_strdup(fs_code);
-    if (g_Context->Started && !bcUpdateShader(shader))
-    {
-        bcDestroyShader(shader);
-        free(shader);
-        shader = NULL;
-    }
-    clist_add_node(g_Context->RM_list, shader);
-    return shader;
+    if (!changeState(&(g_Context->State.caps[cap]), enabled))
+        return;
+    if (enabled)
+        glEnable(s_StateCaps[cap]);
+    else
+        glDisable(s_StateCaps[cap]);
 }
 
-bool bcUpdateShader(BCShader *shader)
+#ifdef SUPPORT_GLSL
+static void setVertexAttribArray(int index, bool enabled)
 {
+    if (!changeState(&(g_Context->State.attribs[index]), enabled))
+        return;
+    if (enabled)
+        glEnableVertexAttribArray(index);
+    else
+        glDisableVertexAttribArray(index);
+}
+#endif
+
+static void useProgram(unsigned int program)
+{
+    if (changeState(&(g_Context->State.program), program))
+        glUseProgram(program);
+}
+
+static void bindTexture(int unit, unsigned int id)
+{
+    if (changeState(&(g_Context->State.textures[unit]), id))
+    {
+        if (changeState(&(g_Context->State.active_texture), unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, id);
+    }
+}
+
+static void bindVertexArray(unsigned int id)
+{
+    if (!changeState(&(g_Context->State.vertex_array), id))
+        return;
+    g_Context->Ext.BindVertexArray(id);
+    // element buffer and attribute arrays are vertex array state
+    g_Context->State.element_buffer = STATE_UNKNOWN;
+    for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
+        g_Context->State.attribs[i] = STATE_UNKNOWN;
+}
+
+static void bindBuffer(GLenum target, unsigned int id)
+{
+    // keep mesh vertex arrays untouched by uploads
+    if (target == GL_ELEMENT_ARRAY_BUFFER && g_Context->Ext.VertexArrayObject && g_Context->State.vertex_array != 0)
+    {
+        bindVertexArray(0);
+        g_Context->CurrentMesh = NULL;
+    }
+    int *state = (target == GL_ARRAY_BUFFER) ? &(g_Context->State.array_buffer) : &(g_Context->State.element_buffer);
+    if (changeState(state, id))
+        glBindBuffer(target, id);
+}
+
+static void setBlendFunc(GLenum src, GLenum dst)
+{
+    bool changed = changeState(&(g_Context->State.blend_src), src);
+    changed |= changeState(&(g_Context->State.blend_dst), dst);
+    if (changed)
+        glBlendFunc(src, dst);
+}
+
+static void setDepthFunc(GLenum func)
+{
+    if (changeState(&(g_Context->State.depth_func), func))
+        glDepthFunc(func);
+}
+
+static bool changeRect(int *state, int x, int y, int w, int h)
+{
+    if (state[0] == x && state[1] == y && state[2] == w && state[3] == h)
+    {
+        g_Context->Stats.skipped_state_changes++;
+        return false;
+    }
+    state[0] = x;
+    state[1] = y;
+    state[2] = w;
+    state[3] = h;
+    g_Context->Stats.state_changes++;
+    return true;
+}
+
+static void setViewport(int x, int y, int w, int h)
+{
+    if (changeRect(g_Context->State.viewport, x, y, w, h))
+        glViewport(x, y, w, h);
+}
+
+static void setScissor(int x, int y, int w, int h)
+{
+    if (changeRect(g_Context->State.scissor, x, y, w, h))
+        glScissor(x, y, w, h);
+}
+
+// deleted objects are unbound by GL, keep the cache in sync
+static void deleteBuffer(unsigned int *id)
+{
+    if (g_Context->State.array_buffer == (int) *id)
+        g_Context->State.array_buffer = 0;
+    if (g_Context->State.element_buffer == (int) *id)
+        g_Context->State.element_buffer = 0;
+    glDeleteBuffers(1, id);
+    *id = 0;
+}
+
+static void deleteTexture(unsigned int *id)
+{
+    for (int i = 0; i < STATE_TEXTURE_UNITS; i++)
+    {
+        if (g_Context->State.textures[i] == (int) *id)
+            g_Context->State.textures[i] = 0;
+    }
+    glDeleteTextures(1, id);
+    *id = 0;
+}
+
+static void deleteVertexArray(unsigned int *id)
+{
+    if (g_Context->State.vertex_array == (int) *id)
+        g_Context->State.vertex_array = STATE_UNKNOWN;
+    g_Context->Ext.DeleteVertexArrays(1, id);
+    *id = 0;
+}
+
+static void deleteProgram(unsigned int id)
+{
+    // a program in use stays bound until replaced
+    if (g_Context->State.program == (int) id)
+        g_Context->State.program = STATE_UNKNOWN;
+    glDeleteProgram(id);
+}
+
+//
+// Extensions
+//
+
+#if defined(SUPPORT_GLES) || defined(SUPPORT_GLAD)
+static bool hasExtension(const char *name)
+{
+    const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+    if (extensions == NULL)
+        return false;
+    int len = strlen(name);
+    for (const char *p = strstr(extensions, name); p; p = strstr(p + len, name))
+    {
+        if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0'))
+            return true;
+    }
+    return false;
+}
+#endif
+
+static void loadExtensions()
+{
+    BCExtensions *ext = &(g_Context->Ext);
+    memset(ext, 0, sizeof(BCExtensions));
+#if defined(SUPPORT_GLES)
+    const char *version = (const char *) glGetString(GL_VERSION);
+    bool es3 = version && strncmp(version, "OpenGL ES 3", 11) == 0;
+    if (es3)
+    {
+        ext->GenVertexArrays = (PFNGLGENVERTEXARRAYSOESPROC) eglGetProcAddress("glGenVertexArrays");
+        ext->BindVertexArray = (PFNGLBINDVERTEXARRAYOESPROC) eglGetProcAddress("glBindVertexArray");
+        ext->DeleteVertexArrays = (PFNGLDELETEVERTEXARRAYSOESPROC) eglGetProcAddress("glDeleteVertexArrays");
+    }
+    else if (hasExtension("GL_OES_vertex_array_object"))
+    {
+        ext->GenVertexArrays = (PFNGLGENVERTEXARRAYSOESPROC) eglGetProcAddress("glGenVertexArraysOES");
+        ext->BindVertexArray = (PFNGLBINDVERTEXARRAYOESPROC) eglGetProcAddress("glBindVertexArrayOES");
+        ext->DeleteVertexArrays = (PFNGLDELETEVERTEXARRAYSOESPROC) eglGetProcAddress("glDeleteVertexArraysOES");
+    }
+    if (es3)
+    {
+        ext->VertexAttribDivisor = (PFNGLVERTEXATTRIBDIVISORANGLEPROC) eglGetProcAddress("glVertexAttribDivisor");
+        ext->DrawArraysInstanced = (PFNGLDRAWARRAYSINSTANCEDANGLEPROC) eglGetProcAddress("glDrawArraysInstanced");
+        ext->DrawElementsInstanced = (PFNGLDRAWELEMENTSINSTANCEDANGLEPROC) eglGetProcAddress("glDrawElementsInstanced");
+    }
+    else if (hasExtension("GL_ANGLE_instanced_arrays"))
+    {
+        ext->VertexAttribDivisor = (PFNGLVERTEXATTRIBDIVISORANGLEPROC) eglGetProcAddress("glVertexAttribDivisorANGLE");
+        ext->DrawArraysInstanced = (PFNGLDRAWARRAYSINSTANCEDANGLEPROC) eglGetProcAddress("glDrawArraysInstancedANGLE");
+        ext->DrawElementsInstanced = (PFNGLDRAWELEMENTSINSTANCEDANGLEPROC) eglGetProcAddress("glDrawElementsInstancedANGLE");
+    }
+    else if (hasExtension("GL_EXT_instanced_arrays"))
+    {
+        ext->VertexAttribDivisor = (PFNGLVERTEXATTRIBDIVISORANGLEPROC) eglGetProcAddress("glVertexAttribDivisorEXT");
+        ext->DrawArraysInstanced = (PFNGLDRAWARRAYSINSTANCEDANGLEPROC) eglGetProcAddress("glDrawArraysInstancedEXT");
+        ext->DrawElementsInstanced = (PFNGLDRAWELEMENTSINSTANCEDANGLEPROC) eglGetProcAddress("glDrawElementsInstancedEXT");
+    }
+    if (es3)
+    {
+        ext->GetProgramBinary = (PFNGLGETPROGRAMBINARYOESPROC) eglGetProcAddress("glGetProgramBinary");
+        ext->ProgramBinary = (PFNGLPROGRAMBINARYOESPROC) eglGetProcAddress("glProgramBinary");
+    }
+    else if (hasExtension("GL_OES_get_program_binary"))
+    {
+        ext->GetProgramBinary = (PFNGLGETPROGRAMBINARYOESPROC) eglGetProcAddress("glGetProgramBinaryOES");
+        ext->ProgramBinary = (PFNGLPROGRAMBINARYOESPROC) eglGetProcAddress("glProgramBinaryOES");
+    }
+    ext->ElementIndexUint = es3 || hasExtension("GL_OES_element_index_uint");
+    ext->HalfFloatType = es3 ? GL_HALF_FLOAT : hasExtension("GL_OES_vertex_half_float") ? GL_HALF_FLOAT_OES : 0;
+    ext->PackedNormals = es3;
+    ext->GenerateMipmap = true;
+    ext->NonPowerOfTwoMipmaps = es3 || hasExtension("GL_OES_texture_npot");
+#elif defined(SUPPORT_GLAD)
+    if (GLAD_GL_VERSION_3_0)
+    {
+        ext->GenVertexArrays = glGenVertexArrays;
+        ext->BindVertexArray = glBindVertexArray;
+        ext->DeleteVertexArrays = glDeleteVertexArrays;
+    }
+    if (GLAD_GL_VERSION_3_3)
+    {
+        ext->VertexAttribDivisor = glVertexAttribDivisor;
+        ext->DrawArraysInstanced = glDrawArraysInstanced;
+        ext->DrawElementsInstanced = glDrawElementsInstanced;
+    }
+    if (hasExtension("GL_ARB_get_program_binary"))
+    {
+        // not in the generated loader
+        ext->GetProgramBinary = (PFNGLGETPROGRAMBINARYPROC) bcGetProcAddress("glGetProgramBinary");
+        ext->ProgramBinary = (PFNGLPROGRAMBINARYPROC) bcGetProcAddress("glProgramBinary");
+    }
+    ext->ElementIndexUint = true;
+    ext->HalfFloatType = GLAD_GL_VERSION_3_0 ? GL_HALF_FLOAT : 0;
+    ext->PackedNormals = GLAD_GL_VERSION_3_3;
+    ext->GenerateMipmap = GLAD_GL_VERSION_3_0;
+    ext->NonPowerOfTwoMipmaps = GLAD_GL_VERSION_2_0;
+#endif
+#ifdef SUPPORT_GLSL
+    ext->VertexArrayObject = ext->GenVertexArrays && ext->BindVertexArray && ext->DeleteVertexArrays;
+    ext->InstancedArrays = ext->VertexAttribDivisor && ext->DrawArraysInstanced && ext->DrawElementsInstanced;
+    if (ext->GetProgramBinary && ext->ProgramBinary)
+    {
+        // drivers may expose the entry points without any format
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        ext->ProgramBinaries = formats > 0;
+    }
+#endif
+    bcLog("VAO: %s", ext->VertexArrayObject ? "yes" : "no");
+    bcLog("Instancing: %s", ext->InstancedArrays ? "yes" : "no");
+    bcLog("Program binaries: %s", ext->ProgramBinaries ? "yes" : "no");
+    bcLog("32-bit indices: %s", ext->ElementIndexUint ? "yes" : "no");
+    bcLog("Compact vertices: half %s, packed normals %s", ext->HalfFloatType ? "yes" : "no", ext->PackedNormals ? "yes" : "no");
+}
+
+//
+// Stream
+//
+
+static int streamData(BCStreamBuffer *stream, unsigned int target, const void *data, int size)
+{
+    int aligned_size = (size + STREAM_ALIGN - 1) & ~(STREAM_ALIGN - 1);
+    if (stream->id == 0)
+    {
+        glGenBuffers(1, &(stream->id));
+        stream->size = 0;
+    }
+    bindBuffer(target, stream->id);
+    if (stream->size == 0 || stream->offset + aligned_size > stream->size)
+    {
+        // grow on demand, orphan the old storage instead of waiting for it
+        if (aligned_size > stream->size)
+        {
+            int new_size = stream->size ? stream->size : STREAM_BUFFER_SIZE;
+            while (new_size < aligned_size)
+                new_size *= 2;
+            stream->size = new_size;
+        }
+        glBufferData(target, stream->size, NULL, GL_STREAM_DRAW);
+        stream->offset = 0;
+        g_Context->StreamGeneration++;
+    }
+    int offset = stream->offset;
+    glBufferSubData(target, offset, size, data);
+    stream->offset += aligned_size;
+    return offset;
+}
+
+static void releaseStreamBuffer(BCStreamBuffer *stream)
+{
+    if (stream->id)
+    {
+        deleteBuffer(&(stream->id));
+    }
+    stream->size = 0;
+    stream->offset = 0;
+    g_Context->StreamGeneration++;
+}
+
+//
+// Vertex Packing
+//
+
+static uint16_t floatToHalf(float value)
+{
+    uint32_t x;
+    memcpy(&x, &value, sizeof(x));
+    uint16_t sign = (x >> 16) & 0x8000;
+    int exponent = (int) ((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = x & 0x7fffff;
+    if (((x >> 23) & 0xff) == 0xff)
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    if (exponent >= 31)
+        return sign | 0x7c00;
+    if (exponent <= 0)
+    {
+        // denormal or zero
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint16_t half = sign | (mantissa >> shift);
+        if ((mantissa >> (shift - 1)) & 1)
+            half++;
+        return half;
+    }
+    // rounding may carry into the exponent, which is still correct
+    uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000)
+        half++;
+    return half;
+}
+
+#ifdef __SSE2__
+static int getPackSimdCount(int src_stride, int comps, int count)
+{
+    // vertices that still have four readable floats, the rest go through the scalar loop
+    int tail = (4 - comps + src_stride - 1) / src_stride;
+    return (count > tail) ? count - tail : 0;
+}
+
+static __m128i floatToHalf4(__m128 value)
+{
+    // same rounding as floatToHalf, lanes pick the normal, denormal or overflow result
+    __m128i x = _mm_castps_si128(value);
+    __m128i sign = _mm_and_si128(_mm_srli_epi32(x, 16), _mm_set1_epi32(0x8000));
+    __m128i abs = _mm_and_si128(x, _mm_set1_epi32(0x7fffffff));
+    __m128i normal = _mm_add_epi32(_mm_sub_epi32(_mm_srli_epi32(abs, 13), _mm_set1_epi32(112 << 10)),
+        _mm_and_si128(_mm_srli_epi32(abs, 12), _mm_set1_epi32(1)));
+    // units of 2^-25, so the last bit is the rounding bit
+    __m128i scaled = _mm_cvttps_epi32(_mm_mul_ps(_mm_castsi128_ps(abs), _mm_set1_ps(33554432.0f)));
+    __m128i denormal = _mm_add_epi32(_mm_srli_epi32(scaled, 1), _mm_and_si128(scaled, _mm_set1_epi32(1)));
+    __m128i is_denormal = _mm_cmplt_epi32(abs, _mm_set1_epi32(0x38800000));
+    __m128i is_inf = _mm_cmpgt_epi32(abs, _mm_set1_epi32(0x477fffff));
+    __m128i is_nan = _mm_cmpgt_epi32(abs, _mm_set1_epi32(0x7f800000));
+    __m128i half = _mm_or_si128(_mm_and_si128(is_denormal, denormal), _mm_andnot_si128(is_denormal, normal));
+    half = _mm_or_si128(_mm_andnot_si128(is_inf, half), _mm_and_si128(is_inf, _mm_set1_epi32(0x7c00)));
+    half = _mm_or_si128(half, _mm_and_si128(is_nan, _mm_set1_epi32(0x200)));
+    half = _mm_or_si128(half, sign);
+    // sign extend so the saturating pack keeps the low 16 bits
+    half = _mm_srai_epi32(_mm_slli_epi32(half, 16), 16);
+    return _mm_packs_epi32(half, half);
+}
+#endif
+
+static void packHalf(const float *src, int src_stride, uint8_t *dst, int dst_stride, int comps, int count)
+{
+    int i = 0;
+#ifdef __SSE2__
+    for (int simd_count = getPackSimdCount(src_stride, comps, count); i < simd_count; i++)
+    {
+        uint64_t halves;
+        _mm_storel_epi64((__m128i *) &halves, floatToHalf4(_mm_loadu_ps(src + i * src_stride)));
+        memcpy(dst + i * dst_stride, &halves, comps * sizeof(uint16_t));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        uint16_t *out = (uint16_t *) (dst + i * dst_stride);
+        for (int j = 0; j < comps; j++)
+            out[j] = floatToHalf(src[i * src_stride + j]);
+    }
+}
+
+static void packUnorm8(const float *src, int src_stride, uint8_t *dst, int dst_stride, int comps, int count)
+{
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (int simd_count = getPackSimdCount(src_stride, comps, count); i < simd_count; i++)
+    {
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i * src_stride), _mm_setzero_ps()), one);
+        __m128i n = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+        n = _mm_packs_epi32(n, n);
+        uint32_t bytes = (uint32_t) _mm_cvtsi128_si32(_mm_packus_epi16(n, n));
+        memcpy(dst + i * dst_stride, &bytes, comps);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        for (int j = 0; j < comps; j++)
+            dst[i * dst_stride + j] = (uint8_t) (clampf(src[i * src_stride + j], 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+}
+
+static void packSnorm8(const float *src, int src_stride, uint8_t *dst, int dst_stride, int comps, int count)
+{
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    for (int simd_count = getPackSimdCount(src_stride, comps, count); i < simd_count; i++)
+    {
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i * src_stride), _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+        v = _mm_mul_ps(v, _mm_set1_ps(127.0f));
+        // round half away from zero like roundf, on the magnitude
+        __m128 a = _mm_andnot_ps(sign_mask, v);
+        __m128i n = _mm_cvttps_epi32(a);
+        __m128 frac = _mm_sub_ps(a, _mm_cvtepi32_ps(n));
+        n = _mm_sub_epi32(n, _mm_castps_si128(_mm_cmpge_ps(frac, _mm_set1_ps(0.5f))));
+        __m128i negative = _mm_srai_epi32(_mm_castps_si128(v), 31);
+        n = _mm_sub_epi32(_mm_xor_si128(n, negative), negative);
+        n = _mm_packs_epi32(n, n);
+        uint32_t bytes = (uint32_t) _mm_cvtsi128_si32(_mm_packs_epi16(n, n));
+        memcpy(dst + i * dst_stride, &bytes, comps);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        for (int j = 0; j < comps; j++)
+            dst[i * dst_stride + j] = (uint8_t) (int8_t) roundf(clampf(src[i * src_stride + j], -1.0f, 1.0f) * 127.0f);
+    }
+}
+
+static void packSnorm10(const float *src, int src_stride, uint8_t *dst, int dst_stride, int comps, int count)
+{
+    // x in the low bits, w is left zero
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t packed = 0;
+        for (int j = 0; j < comps && j < 3; j++)
+            packed |= ((uint32_t) (int32_t) roundf(clampf(src[i * src_stride + j], -1.0f, 1.0f) * 511.0f) & 0x3ff) << (j * 10);
+        memcpy(dst + i * dst_stride, &packed, sizeof(packed));
+    }
+}
+
+static bool isNormalizedType(int type)
+{
+    return type == GL_UNSIGNED_BYTE || type == GL_BYTE || type == GL_INT_2_10_10_10_REV;
+}
+
+static int getAttribSize(int type, int comps)
+{
+    // every attribute starts 4 byte aligned
+    int size =
+        (type == GL_UNSIGNED_BYTE || type == GL_BYTE) ? comps :
+        (type == GL_INT_2_10_10_10_REV) ? 4 :
+        (type == GL_FLOAT) ? comps * 4 :
+        comps * 2;
+    return (size + 3) & ~3;
+}
+
+static void updateVertexLayout(BCMesh *mesh)
+{
+    const BCExtensions *ext = &(g_Context->Ext);
+    // streamed and client side data is always float
+    bool compact = (mesh->type != BC_MESH_STREAM && mesh->type != BC_MESH_NO_VBO);
+    int format = compact ? mesh->format : 0;
+    mesh->attr_types[BC_VERTEX_ATTR_POSITIONS] = (format & BC_MESH_HALF_POS) && ext->HalfFloatType ? ext->HalfFloatType : GL_FLOAT;
+    mesh->attr_types[BC_VERTEX_ATTR_TEXCOORDS] = (format & BC_MESH_HALF_TEX) && ext->HalfFloatType ? ext->HalfFloatType : GL_FLOAT;
+    mesh->attr_types[BC_VERTEX_ATTR_NORMALS] =
+        (format & BC_MESH_PACKED_NORM) && ext->PackedNormals ? GL_INT_2_10_10_10_REV :
+        (format & (BC_MESH_PACKED_NORM | BC_MESH_BYTE_NORM)) ? GL_BYTE :
+        GL_FLOAT;
+    mesh->attr_types[BC_VERTEX_ATTR_COLORS] = (format & BC_MESH_BYTE_COL) ? GL_UNSIGNED_BYTE : GL_FLOAT;
+    mesh->stride = 0;
+    mesh->packed = false;
+    for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
+    {
+        mesh->attr_offsets[i] = mesh->stride;
+        if (mesh->comps[i] > 0)
+        {
+            mesh->stride += getAttribSize(mesh->attr_types[i], mesh->comps[i]);
+            mesh->packed |= (mesh->attr_types[i] != GL_FLOAT);
+        }
+    }
+}
+
+static const void * packVertexData(BCMesh *mesh, const float *vertices, int first, int count)
+{
+    const float *src = vertices + first * mesh->total_comps;
+    if (!mesh->packed)
+        return src;
+    int size = count * mesh->stride;
+    if (g_Context->PackBufferSize < size)
+    {
+        g_Context->PackBuffer = EXTEND_ARRAY(g_Context->PackBuffer, size, uint8_t);
+        g_Context->PackBufferSize = size;
+    }
+    // one pass per attribute, strided in and out
+    memset(g_Context->PackBuffer, 0, size);
+    for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
+    {
+        int comps = mesh->comps[i];
+        if (comps == 0)
+            continue;
+        uint8_t *dst = g_Context->PackBuffer + mesh->attr_offsets[i];
+        switch (mesh->attr_types[i])
+        {
+        case GL_FLOAT:
+            for (int v = 0; v < count; v++)
+                memcpy(dst + v * mesh->stride, src + v * mesh->total_comps, comps * sizeof(float));
+            break;
+        case GL_UNSIGNED_BYTE:
+            packUnorm8(src, mesh->total_comps, dst, mesh->stride, comps, count);
+            break;
+        case GL_BYTE:
+            packSnorm8(src, mesh->total_comps, dst, mesh->stride, comps, count);
+            break;
+        case GL_INT_2_10_10_10_REV:
+            packSnorm10(src, mesh->total_comps, dst, mesh->stride, comps, count);
+            break;
+        default:
+            packHalf(src, mesh->total_comps, dst, mesh->stride, comps, count);
+            break;
+        }
+        src += comps;
+    }
+    return g_Context->PackBuffer;
+}
+
+//
+// Mesh Arena
+//
+
+static int allocRange(BCFreeList *list, int count)
+{
+    if (count == 0)
+        return 0;
+    // first fit
+    for (int i = 0; i < list->count; i++)
+    {
+        BCArenaRange *range = &(list->ranges[i]);
+        if (range->count < count)
+            continue;
+        int start = range->start;
+        range->start += count;
+        range->count -= count;
+        if (range->count == 0)
+        {
+            memmove(range, range + 1, (list->count - i - 1) * sizeof(BCArenaRange));
+            list->count--;
+        }
+        list->used += count;
+        return start;
+    }
+    return -1;
+}
+
+static void freeRange(BCFreeList *list, int start, int count)
+{
+    if (count == 0)
+        return;
+    list->used -= count;
+    int i = 0;
+    while (i < list->count && list->ranges[i].start < start)
+        i++;
+    // coalesce with touching neighbours
+    bool merge_prev = (i > 0 && list->ranges[i - 1].start + list->ranges[i - 1].count == start);
+    bool merge_next = (i < list->count && start + count == list->ranges[i].start);
+    if (merge_prev && merge_next)
+    {
+        list->ranges[i - 1].count += count + list->ranges[i].count;
+        memmove(list->ranges + i, list->ranges + i + 1, (list->count - i - 1) * sizeof(BCArenaRange));
+        list->count--;
+    }
+    else if (merge_prev)
+    {
+        list->ranges[i - 1].count += count;
+    }
+    else if (merge_next)
+    {
+        list->ranges[i].start = start;
+        list->ranges[i].count += count;
+    }
+    else
+    {
+        if (list->count == list->capacity)
+        {
+            list->capacity = list->capacity ? list->capacity * 2 : 16;
+            list->ranges = EXTEND_ARRAY(list->ranges, list->capacity, BCArenaRange);
+        }
+        memmove(list->ranges + i + 1, list->ranges + i, (list->count - i) * sizeof(BCArenaRange));
+        list->ranges[i].start = start;
+        list->ranges[i].count = count;
+        list->count++;
+    }
+}
+
+static void resetFreeList(BCFreeList *list, int used, int size)
+{
+    // everything past the packed front is one free range
+    list->count = 0;
+    list->size = size;
+    list->used = size;
+    freeRange(list, used, size - used);
+}
+
+static int growCapacity(int capacity, int count)
+{
+    while (capacity < count)
+        capacity *= 2;
+    return capacity;
+}
+
+static void resizeArenaBuffers(BCMeshArena *arena, int num_vertices, int num_indices)
+{
+    // contents are uploaded again from the mesh copies
+    bindBuffer(GL_ARRAY_BUFFER, arena->vbo);
+    glBufferData(GL_ARRAY_BUFFER, num_vertices * arena->stride, NULL, GL_STATIC_DRAW);
+    bindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena->ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(uint16_t), NULL, GL_STATIC_DRAW);
+}
+
+static void uploadSharedMesh(BCMeshArena *arena, BCMesh *mesh)
+{
+    // data may have been resized since the ranges were allocated
+    int num_vertices = (mesh->num_vertices < mesh->arena_vertices) ? mesh->num_vertices : mesh->arena_vertices;
+    int num_indices = (mesh->num_indices < mesh->arena_indices) ? mesh->num_indices : mesh->arena_indices;
+    if (num_vertices)
+    {
+        bindBuffer(GL_ARRAY_BUFFER, arena->vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, mesh->base_vertex * arena->stride, num_vertices * arena->stride,
+            packVertexData(mesh, mesh->vertices, 0, num_vertices));
+    }
+    if (num_indices)
+    {
+        // rebased indices let the whole arena share one attribute setup
+        uint16_t *indices = NEW_ARRAY(num_indices, uint16_t);
+        for (int i = 0; i < num_indices; i++)
+            indices[i] = ((const uint16_t *) mesh->indices)[i] + mesh->base_vertex;
+        bindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena->ibo);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo_offset, num_indices * sizeof(uint16_t), indices);
+        free(indices);
+    }
+}
+
+static void repackArena(int index, int vert_capacity, int indx_capacity)
+{
+    BCMeshArena *arena = &(g_Context->Arenas[index]);
+    if (vert_capacity != arena->vertices.size || indx_capacity != arena->indices.size)
+    {
+        resizeArenaBuffers(arena, vert_capacity, indx_capacity);
+    }
+    // move live meshes to the front, closing the holes
+    int base_vertex = 0;
+    int first_index = 0;
+    BCRegistry *reg = &(g_Context->RM[RM_TYPE_MESH]);
+    for (int i = 0; i < reg->count; i++)
+    {
+        BCMesh *mesh = (BCMesh *) reg->objects[i];
+        if (mesh->type != BC_MESH_SHARED || mesh->arena != index)
+            continue;
+        mesh->base_vertex = base_vertex;
+        mesh->ibo_offset = first_index * sizeof(uint16_t);
+        base_vertex += mesh->arena_vertices;
+        first_index += mesh->arena_indices;
+        uploadSharedMesh(arena, mesh);
+    }
+    resetFreeList(&(arena->vertices), base_vertex, vert_capacity);
+    resetFreeList(&(arena->indices), first_index, indx_capacity);
+}
+
+static bool allocFromArena(int index, BCMesh *mesh)
+{
+    BCMeshArena *arena = &(g_Context->Arenas[index]);
+    int base_vertex = allocRange(&(arena->vertices), mesh->num_vertices);
+    int first_index = allocRange(&(arena->indices), mesh->num_indices);
+    if (base_vertex < 0 || first_index < 0)
+    {
+        if (base_vertex >= 0)
+            freeRange(&(arena->vertices), base_vertex, mesh->num_vertices);
+        if (first_index >= 0)
+            freeRange(&(arena->indices), first_index, mesh->num_indices);
+        // defragment, and grow if the free space isn't enough either
+        int vert_capacity = growCapacity(arena->vertices.size, arena->vertices.used + mesh->num_vertices);
+        int indx_capacity = growCapacity(arena->indices.size, arena->indices.used + mesh->num_indices);
+        if (vert_capacity > ARENA_MAX_VERTICES)
+            return false;
+        repackArena(index, vert_capacity, indx_capacity);
+        base_vertex = allocRange(&(arena->vertices), mesh->num_vertices);
+        first_index = allocRange(&(arena->indices), mesh->num_indices);
+    }
+    mesh->arena = index;
+    mesh->base_vertex = base_vertex;
+    mesh->ibo_offset = first_index * sizeof(uint16_t);
+    mesh->arena_vertices = mesh->num_vertices;
+    mesh->arena_indices = mesh->num_indices;
+    mesh->vbo_vertices = arena->vbo;
+    mesh->vbo_indices = arena->ibo;
+    mesh->vbo_offset = 0;
+    mesh->vao = arena->vao;
+    arena->num_meshes++;
+    return true;
+}
+
+static int createArena(BCMesh *mesh)
+{
+    // reuse slots of arenas that were emptied
+    int index = 0;
+    while (index < g_Context->ArenaCount && g_Context->Arenas[index].vbo)
+        index++;
+    if (index == g_Context->ArenaCount)
+    {
+        if (g_Context->ArenaCount == g_Context->ArenaCapacity)
+        {
+            g_Context->ArenaCapacity = g_Context->ArenaCapacity ? g_Context->ArenaCapacity * 2 : 8;
+            g_Context->Arenas = EXTEND_ARRAY(g_Context->Arenas, g_Context->ArenaCapacity, BCMeshArena);
+        }
+        memset(&(g_Context->Arenas[index]), 0, sizeof(BCMeshArena));
+        g_Context->ArenaCount++;
+    }
+    BCMeshArena *arena = &(g_Context->Arenas[index]);
+    arena->format = mesh->format;
+    arena->stride = mesh->stride;
+    arena->num_meshes = 0;
+    glGenBuffers(1, &(arena->vbo));
+    glGenBuffers(1, &(arena->ibo));
+    int vert_capacity = growCapacity(ARENA_MIN_VERTICES, mesh->num_vertices);
+    int indx_capacity = growCapacity(ARENA_MIN_INDICES, mesh->num_indices);
+    resizeArenaBuffers(arena, vert_capacity, indx_capacity);
+    resetFreeList(&(arena->vertices), 0, vert_capacity);
+    resetFreeList(&(arena->indices), 0, indx_capacity);
+    return index;
+}
+
+static void releaseArena(BCMeshArena *arena)
+{
+    if (arena->vao)
+    {
+        deleteVertexArray(&(arena->vao));
+    }
+    // the bound mesh may be gone already, force a rebind
+    g_Context->CurrentMesh = NULL;
+    if (arena->vbo)
+    {
+        deleteBuffer(&(arena->vbo));
+    }
+    if (arena->ibo)
+    {
+        deleteBuffer(&(arena->ibo));
+    }
+    arena->num_meshes = 0;
+}
+
+static void releaseSharedMesh(BCMesh *mesh)
+{
+    if (mesh->arena >= 0)
+    {
+        BCMeshArena *arena = &(g_Context->Arenas[mesh->arena]);
+        freeRange(&(arena->vertices), mesh->base_vertex, mesh->arena_vertices);
+        freeRange(&(arena->indices), mesh->ibo_offset / sizeof(uint16_t), mesh->arena_indices);
+        if (--arena->num_meshes == 0)
+        {
+            releaseArena(arena);
+        }
+    }
+    if (g_Context->CurrentMesh == mesh)
+    {
+        g_Context->CurrentMesh = NULL;
+    }
+    mesh->arena = -1;
+    mesh->base_vertex = 0;
+    mesh->ibo_offset = 0;
+    mesh->vbo_vertices = 0;
+    mesh->vbo_indices = 0;
+    mesh->vao = 0;
+}
+
+static bool updateSharedMesh(BCMesh *mesh)
+{
+    if (mesh->num_vertices > ARENA_MAX_VERTICES || mesh->index_size != 2)
+    {
+        if (mesh->index_size != 2)
+        {
+            bcLogWarning("Arenas only hold 16-bit indices (mesh has %d-bit), using BC_MESH_STATIC", mesh->index_size * 8);
+        }
+        else
+        {
+            bcLogWarning("Mesh too big for an arena (%d vertices), using BC_MESH_STATIC", mesh->num_vertices);
+        }
+        releaseSharedMesh(mesh);
+        mesh->type = BC_MESH_STATIC;
+        return false;
+    }
+    // ranges are kept while the data still fits
+    if (mesh->arena >= 0 && (mesh->num_vertices > mesh->arena_vertices || mesh->num_indices > mesh->arena_indices))
+    {
+        releaseSharedMesh(mesh);
+    }
+    if (mesh->arena < 0)
+    {
+        bool allocated = false;
+        for (int i = 0; i < g_Context->ArenaCount && !allocated; i++)
+        {
+            BCMeshArena *arena = &(g_Context->Arenas[i]);
+            if (arena->vbo && arena->format == mesh->format)
+                allocated = allocFromArena(i, mesh);
+        }
+        if (!allocated)
+        {
+            allocFromArena(createArena(mesh), mesh);
+        }
+    }
+    uploadSharedMesh(&(g_Context->Arenas[mesh->arena]), mesh);
+    return true;
+}
+
+static void releaseMeshArenas()
+{
+    for (int i = 0; i < g_Context->ArenaCount; i++)
+    {
+        releaseArena(&(g_Context->Arenas[i]));
+        free(g_Context->Arenas[i].vertices.ranges);
+        free(g_Context->Arenas[i].indices.ranges);
+    }
+    free(g_Context->Arenas);
+    g_Context->Arenas = NULL;
+    g_Context->ArenaCount = 0;
+    g_Context->ArenaCapacity = 0;
+}
+
+//
+// Mesh Codec
+//
+
+static const int s_CodecGroupBytes[4] = { 0, 8, 16, 32 };
+
+static uint16_t zigzag16(uint16_t delta)
+{
+    return (uint16_t) ((delta << 1) ^ (0u - (delta >> 15)));
+}
+
+static uint32_t zigzag32(uint32_t delta)
+{
+    return (delta << 1) ^ (0u - (delta >> 31));
+}
+
+static int writeVarint(uint8_t *out, uint64_t value)
+{
+    int n = 0;
+    while (value >= 0x80)
+    {
+        out[n++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t) value;
+    return n;
+}
+
+static const uint8_t * readVarint(const uint8_t *data, const uint8_t *end, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && data < end; shift += 7)
+    {
+        uint8_t byte = *data++;
+        result |= (uint64_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            *value = result;
+            return data;
+        }
+    }
+    return NULL;
+}
+
+// Deltas in groups of 16, stored in 0, 4, 8 or 16 bits picked by a 2-bit header
+static int encodeCodecLane(const uint16_t *values, int count, uint8_t *out)
+{
+    int num_groups = (count + CODEC_GROUP_SIZE - 1) / CODEC_GROUP_SIZE;
+    int header_size = (num_groups + 3) / 4;
+    memset(out, 0, header_size);
+    uint8_t *data = out + header_size;
+    uint16_t last = 0;
+    for (int g = 0; g < num_groups; g++)
+    {
+        uint16_t deltas[CODEC_GROUP_SIZE];
+        uint16_t bits = 0;
+        for (int i = 0; i < CODEC_GROUP_SIZE; i++)
+        {
+            int k = g * CODEC_GROUP_SIZE + i;
+            uint16_t value = (k < count) ? values[k] : last;
+            deltas[i] = zigzag16((uint16_t) (value - last));
+            bits |= deltas[i];
+            last = value;
+        }
+        int mode = (bits == 0) ? 0 : (bits < 0x10) ? 1 : (bits < 0x100) ? 2 : 3;
+        out[g / 4] |= mode << ((g % 4) * 2);
+        for (int i = 0; i < CODEC_GROUP_SIZE; i++)
+        {
+            if (mode == 1 && (i & 1) == 0)
+                data[i / 2] = (uint8_t) (deltas[i] | (deltas[i + 1] << 4));
+            else if (mode == 2)
+                data[i] = (uint8_t) deltas[i];
+            else if (mode == 3)
+            {
+                data[i * 2] = deltas[i] & 0xff;
+                data[i * 2 + 1] = deltas[i] >> 8;
+            }
+        }
+        data += s_CodecGroupBytes[mode];
+    }
+    return data - out;
+}
+
+#ifdef __SSE2__
+static __m128i decodeCodecGroup(const uint8_t *data, int mode, __m128i last, uint16_t *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = zero;
+    __m128i hi = zero;
+    if (mode == 1)
+    {
+        __m128i packed = _mm_loadl_epi64((const __m128i *) data);
+        __m128i mask = _mm_set1_epi8(0x0f);
+        __m128i bytes = _mm_unpacklo_epi8(_mm_and_si128(packed, mask), _mm_and_si128(_mm_srli_epi16(packed, 4), mask));
+        lo = _mm_unpacklo_epi8(bytes, zero);
+        hi = _mm_unpackhi_epi8(bytes, zero);
+    }
+    else if (mode == 2)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) data);
+        lo = _mm_unpacklo_epi8(bytes, zero);
+        hi = _mm_unpackhi_epi8(bytes, zero);
+    }
+    else if (mode == 3)
+    {
+        lo = _mm_loadu_si128((const __m128i *) data);
+        hi = _mm_loadu_si128((const __m128i *) (data + 16));
+    }
+    // undo zigzag, then prefix sum the deltas on top of the last value
+    const __m128i one = _mm_set1_epi16(1);
+    lo = _mm_xor_si128(_mm_srli_epi16(lo, 1), _mm_sub_epi16(zero, _mm_and_si128(lo, one)));
+    hi = _mm_xor_si128(_mm_srli_epi16(hi, 1), _mm_sub_epi16(zero, _mm_and_si128(hi, one)));
+    lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 2));
+    hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 2));
+    lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 4));
+    hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 4));
+    lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 8));
+    hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 8));
+    lo = _mm_add_epi16(lo, last);
+    last = _mm_shufflehi_epi16(lo, 0xff);
+    hi = _mm_add_epi16(hi, _mm_unpackhi_epi64(last, last));
+    _mm_storeu_si128((__m128i *) out, lo);
+    _mm_storeu_si128((__m128i *) (out + 8), hi);
+    last = _mm_shufflehi_epi16(hi, 0xff);
+    return _mm_unpackhi_epi64(last, last);
+}
+#endif
+
+// Returns the end of the lane, or NULL if it runs past the chunk
+static const uint8_t * decodeCodecLane(const uint8_t *data, const uint8_t *end, uint16_t *out, int count)
+{
+    int num_groups = (count + CODEC_GROUP_SIZE - 1) / CODEC_GROUP_SIZE;
+    int header_size = (num_groups + 3) / 4;
+    if (end - data < header_size)
+        return NULL;
+    const uint8_t *header = data;
+    ptrdiff_t size = header_size;
+    for (int g = 0; g < num_groups; g++)
+    {
+        size += s_CodecGroupBytes[(header[g / 4] >> ((g % 4) * 2)) & 3];
+    }
+    if (end - data < size)
+        return NULL;
+    data += header_size;
+#ifdef __SSE2__
+    __m128i last = _mm_setzero_si128();
+    for (int g = 0; g < num_groups; g++)
+    {
+        int mode = (header[g / 4] >> ((g % 4) * 2)) & 3;
+        last = decodeCodecGroup(data, mode, last, out + g * CODEC_GROUP_SIZE);
+        data += s_CodecGroupBytes[mode];
+    }
+#else
+    uint16_t last = 0;
+    for (int g = 0; g < num_groups; g++)
+    {
+        int mode = (header[g / 4] >> ((g % 4) * 2)) & 3;
+        for (int i = 0; i < CODEC_GROUP_SIZE; i++)
+        {
+            uint16_t delta = (mode == 1) ? (data[i / 2] >> ((i & 1) * 4)) & 0x0f :
+                (mode == 2) ? data[i] :
+                (mode == 3) ? data[i * 2] | (data[i * 2 + 1] << 8) : 0;
+            last += (delta >> 1) ^ (0u - (delta & 1));
+            out[g * CODEC_GROUP_SIZE + i] = last;
+        }
+        data += s_CodecGroupBytes[mode];
+    }
+#endif
+    return data;
+}
+
+// Vertex section: chunks of vertices, each one lane per component (two for exact floats)
+static uint8_t * encodeVertexSection(const float *vertices, int num_vertices, int comps, int bits, int *size)
+{
+    int num_chunks = (num_vertices + CODEC_CHUNK_VERTICES - 1) / CODEC_CHUNK_VERTICES;
+    int num_lanes = bits ? comps : 2 * comps;
+    int num_ranges = bits ? 2 * comps : 0;
+    int num_groups = CODEC_CHUNK_VERTICES / CODEC_GROUP_SIZE;
+    size_t table_size = sizeof(BCMeshFileCoded) + num_ranges * sizeof(float) + (num_chunks + 1) * sizeof(uint32_t);
+    size_t max_lane_size = (num_groups + 3) / 4 + num_groups * s_CodecGroupBytes[3];
+    uint8_t *data = NEW_ARRAY(table_size + (size_t) num_chunks * num_lanes * max_lane_size, uint8_t);
+    float *ranges = (float *) (data + sizeof(BCMeshFileCoded));
+    uint32_t *offsets = (uint32_t *) (ranges + num_ranges);
+    float max_value = (float) ((1 << bits) - 1);
+    for (int c = 0; c < comps && bits; c++)
+    {
+        float lo = num_vertices ? vertices[c] : 0;
+        float hi = lo;
+        for (int v = 1; v < num_vertices; v++)
+        {
+            float x = vertices[v * comps + c];
+            lo = (x < lo) ? x : lo;
+            hi = (x > hi) ? x : hi;
+        }
+        ranges[c * 2] = lo;
+        ranges[c * 2 + 1] = (hi - lo) / max_value;
+    }
+    uint16_t *lane = NEW_ARRAY(CODEC_CHUNK_VERTICES, uint16_t);
+    size_t offset = table_size;
+    for (int k = 0; k < num_chunks; k++)
+    {
+        offsets[k] = offset;
+        int first = k * CODEC_CHUNK_VERTICES;
+        int count = (num_vertices - first < CODEC_CHUNK_VERTICES) ? num_vertices - first : CODEC_CHUNK_VERTICES;
+        for (int l = 0; l < num_lanes; l++)
+        {
+            int c = bits ? l : l / 2;
+            const float *src = vertices + first * comps + c;
+            for (int v = 0; v < count; v++)
+            {
+                if (bits)
+                {
+                    float step = ranges[c * 2 + 1];
+                    float q = (step > 0) ? (src[v * comps] - ranges[c * 2]) / step + 0.5f : 0;
+                    lane[v] = (uint16_t) (!(q > 0) ? 0 : (q > max_value) ? max_value : q);
+                }
+                else
+                {
+                    uint32_t u;
+                    memcpy(&u, &(src[v * comps]), sizeof(u));
+                    lane[v] = (l & 1) ? (u >> 16) : (u & 0xffff);
+                }
+            }
+            offset += encodeCodecLane(lane, count, data + offset);
+        }
+    }
+    offsets[num_chunks] = offset;
+    free(lane);
+    BCMeshFileCoded coded = { offset, bits, num_lanes, num_chunks, CODEC_CHUNK_VERTICES };
+    memcpy(data, &coded, sizeof(coded));
+    *size = offset;
+    return data;
+}
+
+// Index section: a 4-bit code per index, 0 for the next unused vertex, 1-14 for
+// a recent vertex in the FIFO, 15 for a zigzag varint delta from the last such index
+static uint8_t * encodeIndexSection(const void *indices, int index_size, int num_indices, int *size)
+{
+    int num_chunks = (num_indices + CODEC_CHUNK_INDICES - 1) / CODEC_CHUNK_INDICES;
+    size_t table_size = sizeof(BCMeshFileCoded) + (num_chunks + 1) * sizeof(uint32_t);
+    uint8_t *data = NEW_ARRAY(table_size + (size_t) num_indices * 6 + num_chunks * 16, uint8_t);
+    uint32_t *offsets = (uint32_t *) (data + sizeof(BCMeshFileCoded));
+    size_t offset = table_size;
+    uint32_t next = 0;
+    for (int k = 0; k < num_chunks; k++)
+    {
+        offsets[k] = offset;
+        offset += writeVarint(data + offset, next);
+        int first = k * CODEC_CHUNK_INDICES;
+        int count = (num_indices - first < CODEC_CHUNK_INDICES) ? num_indices - first : CODEC_CHUNK_INDICES;
+        uint8_t *codes = data + offset;
+        offset += (count + 1) / 2;
+        uint32_t fifo[CODEC_INDEX_FIFO] = { 0 };
+        int head = 0;
+        uint32_t last = 0;
+        for (int i = 0; i < count; i++)
+        {
+            uint32_t index = (index_size == 4) ? ((const uint32_t *) indices)[first + i] : ((const uint16_t *) indices)[first + i];
+            int code = (index == next) ? 0 : 15;
+            for (int j = 0; j < CODEC_INDEX_FIFO - 2 && code == 15; j++)
+            {
+                if (fifo[(head - 1 - j) & (CODEC_INDEX_FIFO - 1)] == index)
+                    code = j + 1;
+            }
+            if (code == 15)
+            {
+                offset += writeVarint(data + offset, zigzag32(index - last));
+                last = index;
+            }
+            // only misses enter the FIFO
+            if (code == 0 || code == 15)
+                fifo[head++ & (CODEC_INDEX_FIFO - 1)] = index;
+            codes[i / 2] |= code << ((i & 1) * 4);
+            next = (index >= next) ? index + 1 : next;
+        }
+    }
+    offsets[num_chunks] = offset;
+    BCMeshFileCoded coded = { offset, 0, 1, num_chunks, CODEC_CHUNK_INDICES };
+    memcpy(data, &coded, sizeof(coded));
+    *size = offset;
+    return data;
+}
+
+static bool decodeVertexChunk(const BCMeshDecodeJob *job, int chunk, uint16_t *lanes)
+{
+    int first = chunk * job->chunk_size;
+    int count = (job->count - first < job->chunk_size) ? job->count - first : job->chunk_size;
+    const uint8_t *data = job->section + job->offsets[chunk];
+    const uint8_t *end = job->section + job->offsets[chunk + 1];
+    float *vertices = (float *) job->output + (size_t) first * job->comps;
+    uint16_t *high = lanes + job->chunk_size + CODEC_GROUP_SIZE;
+    for (int c = 0; c < job->comps; c++)
+    {
+        data = decodeCodecLane(data, end, lanes, count);
+        if (data && !job->bits)
+            data = decodeCodecLane(data, end, high, count);
+        if (data == NULL)
+            return false;
+        if (job->bits)
+        {
+            float base = job->ranges[c * 2];
+            float step = job->ranges[c * 2 + 1];
+            for (int v = 0; v < count; v++)
+                vertices[v * job->comps + c] = base + lanes[v] * step;
+        }
+        else
+        {
+            for (int v = 0; v < count; v++)
+            {
+                uint32_t u = lanes[v] | ((uint32_t) high[v] << 16);
+                memcpy(&(vertices[v * job->comps + c]), &u, sizeof(u));
+            }
+        }
+    }
+    return true;
+}
+
+static bool decodeIndexChunk(const BCMeshDecodeJob *job, int chunk)
+{
+    int first = chunk * job->chunk_size;
+    int count = (job->count - first < job->chunk_size) ? job->count - first : job->chunk_size;
+    const uint8_t *data = job->section + job->offsets[chunk];
+    const uint8_t *end = job->section + job->offsets[chunk + 1];
+    uint64_t start;
+    data = readVarint(data, end, &start);
+    if (data == NULL || end - data < (count + 1) / 2)
+        return false;
+    const uint8_t *codes = data;
+    data += (count + 1) / 2;
+    uint32_t fifo[CODEC_INDEX_FIFO] = { 0 };
+    int head = 0;
+    uint32_t next = (uint32_t) start;
+    uint32_t last = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int code = (codes[i / 2] >> ((i & 1) * 4)) & 0x0f;
+        uint32_t index = (code == 0) ? next : fifo[(head - code) & (CODEC_INDEX_FIFO - 1)];
+        if (code == 15)
+        {
+            uint64_t delta;
+            if (data < end && *data < 0x80)
+                delta = *data++;
+            else if ((data = readVarint(data, end, &delta)) == NULL)
+                return false;
+            index = last + (((uint32_t) delta >> 1) ^ (0u - ((uint32_t) delta & 1)));
+            last = index;
+        }
+        // the slot past the last one reachable is free to write
+        fifo[head & (CODEC_INDEX_FIFO - 1)] = index;
+        head += (code == 0 || code == 15);
+        next = (index >= next) ? index + 1 : next;
+        if (job->index_size == 4)
+            ((uint32_t *) job->output)[first + i] = index;
+        else
+            ((uint16_t *) job->output)[first + i] = (uint16_t) index;
+    }
+    return true;
+}
+
+static void * decodeMeshChunks(void *arg)
+{
+    BCMeshDecodeJob *job = (BCMeshDecodeJob *) arg;
+    // room for the low and high lanes of exact floats
+    uint16_t *lanes = NULL;
+    if (job->index_size == 0)
+        lanes = NEW_ARRAY(2 * (job->chunk_size + CODEC_GROUP_SIZE), uint16_t);
+    job->ok = (job->index_size != 0 || lanes != NULL);
+    for (int i = job->first_chunk; job->ok && i < job->end_chunk; i++)
+    {
+        job->ok = (job->index_size != 0) ? decodeIndexChunk(job, i) : decodeVertexChunk(job, i, lanes);
+    }
+    free(lanes);
+    return NULL;
+}
+
+static bool prepareDecodeJob(BCMeshDecodeJob *job, const uint8_t *section, int count, int num_lanes, int chunk_align)
+{
+    BCMeshFileCoded coded;
+    memcpy(&coded, section, sizeof(coded));
+    int num_ranges = (job->index_size == 0 && coded.bits) ? 2 * job->comps : 0;
+    uint64_t table_size = sizeof(coded) + num_ranges * sizeof(float) + ((uint64_t) coded.num_chunks + 1) * sizeof(uint32_t);
+    uint32_t expected_lanes = (job->index_size || coded.bits) ? num_lanes : num_lanes * 2;
+    if (coded.bits > 16 || (job->index_size && coded.bits) || coded.num_lanes != expected_lanes ||
+        coded.chunk_size == 0 || coded.chunk_size % chunk_align != 0 ||
+        coded.num_chunks != ((uint64_t) count + coded.chunk_size - 1) / coded.chunk_size || table_size > coded.size)
+    {
+        return false;
+    }
+    // every lane carries at least its group headers, every index a 4 bit code
+    uint64_t num_groups = ((uint64_t) count + CODEC_GROUP_SIZE - 1) / CODEC_GROUP_SIZE;
+    uint64_t min_size = job->index_size ? ((uint64_t) count + 1) / 2 : coded.num_lanes * ((num_groups + 3) / 4);
+    if (table_size + min_size > coded.size)
+        return false;
+    const uint32_t *offsets = (const uint32_t *) (section + sizeof(coded) + num_ranges * sizeof(float));
+    for (uint32_t i = 0; i < coded.num_chunks; i++)
+    {
+        if (offsets[i] < table_size || offsets[i] > offsets[i + 1] || offsets[i + 1] > coded.size)
+            return false;
+    }
+    job->section = section;
+    job->offsets = offsets;
+    job->ranges = (const float *) (section + sizeof(coded));
+    job->bits = coded.bits;
+    job->chunk_size = (coded.chunk_size < (uint32_t) count) ? (int) coded.chunk_size : count;
+    job->count = count;
+    job->first_chunk = 0;
+    job->end_chunk = coded.num_chunks;
+    return true;
+}
+
+// Decodes both sections into one buffer, vertices then indices
+static uint8_t * decodeMeshSections(const uint8_t *vertex_section, int num_vertices, int comps, const uint8_t *index_section, int num_indices, int index_size)
+{
+    BCMeshDecodeJob sections[2];
+    memset(sections, 0, sizeof(sections));
+    sections[0].comps = comps;
+    sections[1].index_size = index_size;
+    if (!prepareDecodeJob(&(sections[0]), vertex_section, num_vertices, comps, CODEC_GROUP_SIZE) ||
+        !prepareDecodeJob(&(sections[1]), index_section, num_indices, 1, 3))
+    {
+        return NULL;
+    }
+    uint64_t vertex_bytes = (uint64_t) num_vertices * comps * sizeof(float);
+    uint64_t decoded_size = vertex_bytes + (uint64_t) num_indices * index_size + 1;
+    if (decoded_size > SIZE_MAX)
+        return NULL;
+    size_t vertex_size = (size_t) vertex_bytes;
+    uint8_t *decoded = (uint8_t *) malloc((size_t) decoded_size);
+    if (decoded == NULL)
+        return NULL;
+    sections[0].output = decoded;
+    sections[1].output = decoded + vertex_size;
+    // chunks are independent, so big sections are split across threads
+    BCMeshDecodeJob jobs[2 * CODEC_DECODE_THREADS];
+    int num_jobs = 0;
+    int total_chunks = sections[0].end_chunk + sections[1].end_chunk;
+    for (int s = 0; s < 2; s++)
+    {
+        int num_chunks = sections[s].end_chunk;
+        int parts = (total_chunks >= CODEC_THREAD_CHUNKS) ? CODEC_DECODE_THREADS : 1;
+        for (int p = 0; p < parts; p++)
+        {
+            jobs[num_jobs] = sections[s];
+            jobs[num_jobs].first_chunk = num_chunks * p / parts;
+            jobs[num_jobs].end_chunk = num_chunks * (p + 1) / parts;
+            if (jobs[num_jobs].first_chunk < jobs[num_jobs].end_chunk)
+                num_jobs++;
+        }
+    }
+#ifndef __EMSCRIPTEN__
+    pthread_t threads[2 * CODEC_DECODE_THREADS];
+    bool threaded[2 * CODEC_DECODE_THREADS] = { false };
+#endif
+    for (int i = 0; i < num_jobs; i++)
+    {
+#ifndef __EMSCRIPTEN__
+        // the last job runs on this thread
+        if (total_chunks >= CODEC_THREAD_CHUNKS && i + 1 < num_jobs)
+            threaded[i] = (pthread_create(&threads[i], NULL, decodeMeshChunks, &jobs[i]) == 0);
+        if (!threaded[i])
+#endif
+            decodeMeshChunks(&jobs[i]);
+    }
+    bool ok = true;
+    for (int i = 0; i < num_jobs; i++)
+    {
+#ifndef __EMSCRIPTEN__
+        if (threaded[i])
+            pthread_join(threads[i], NULL);
+#endif
+        ok = ok && jobs[i].ok;
+    }
+    if (!ok)
+    {
+        free(decoded);
+        return NULL;
+    }
+    return decoded;
+}
+
+//
+// Dirty State
+//
+
+static void updateState(int flag, void *state, const void *value, size_t size)
+{
+    if (memcmp(state, value, size) == 0)
+    {
+        // already uploaded or pending
+        g_Context->Stats.skipped_uploads++;
+        return;
+    }
+    if (g_Context->DirtyFlags & flag)
+    {
+        // merged into a pending upload
+        g_Context->Stats.skipped_uploads++;
+    }
+    memcpy(state, value, size);
+    g_Context->DirtyFlags |= flag;
+#ifdef SUPPORT_GLSL
+    g_Context->InstancedDirty |= flag;
+#endif
+}
+
+#ifdef SUPPORT_GLSL
+static mat3_t getNormalMatrix(const mat4_t *m)
+{
+    // inverse transpose of the upper 3x3, its columns are cross products of the others
+    vec3_t c0 = vec3(m->v[0], m->v[1], m->v[2]);
+    vec3_t c1 = vec3(m->v[4], m->v[5], m->v[6]);
+    vec3_t c2 = vec3(m->v[8], m->v[9], m->v[10]);
+    vec3_t n0 = vec3_cross(c1, c2);
+    vec3_t n1 = vec3_cross(c2, c0);
+    vec3_t n2 = vec3_cross(c0, c1);
+    float det = vec3_dot(c0, n0);
+    float inv = (det != 0) ? 1.0f / det : 1.0f;
+    return mat3(n0.x * inv, n0.y * inv, n0.z * inv,
+                n1.x * inv, n1.y * inv, n1.z * inv,
+                n2.x * inv, n2.y * inv, n2.z * inv);
+}
+#endif
+
+static void uploadDirtyState()
+{
+    int dirty = g_Context->DirtyFlags;
+    if (dirty == 0)
+        return;
+#ifdef SUPPORT_GLSL
+    const int *loc = g_Context->ProgramShader->loc_uniforms;
+    if (dirty & DIRTY_PROJECTION_MATRIX)
+    {
+        glUniformMatrix4fv(loc[BC_SHADER_UNIFORM_PROJECTIONMATRIX], 1, GL_FALSE, g_Context->ProjectionMatrix.v);
+        g_Context->Stats.uniform_uploads++;
+    }
+    if (dirty & DIRTY_MODELVIEW_MATRIX)
+    {
+        glUniformMatrix4fv(loc[BC_SHADER_UNIFORM_MODELVIEWMATRIX], 1, GL_FALSE, g_Context->ModelViewMatrix.v);
+        g_Context->Stats.uniform_uploads++;
+    }
+    // once per draw instead of per vertex
+    if ((dirty & (DIRTY_PROJECTION_MATRIX | DIRTY_MODELVIEW_MATRIX)) && loc[BC_SHADER_UNIFORM_MVPMATRIX] != -1)
+    {
+        mat4_t mvp = mat4_multiply(g_Context->ProjectionMatrix, g_Context->ModelViewMatrix);
+        glUniformMatrix4fv(loc[BC_SHADER_UNIFORM_MVPMATRIX], 1, GL_FALSE, mvp.v);
+        g_Context->Stats.uniform_uploads++;
+    }
+    if ((dirty & DIRTY_MODELVIEW_MATRIX) && loc[BC_SHADER_UNIFORM_NORMALMATRIX] != -1)
+    {
+        mat3_t normal = getNormalMatrix(&(g_Context->ModelViewMatrix));
+        glUniformMatrix3fv(loc[BC_SHADER_UNIFORM_NORMALMATRIX], 1, GL_FALSE, normal.v);
+        g_Context->Stats.uniform_uploads++;
+    }
+    if (dirty & DIRTY_TEXTURE_MATRIX)
+    {
+        glUniformMatrix3fv(loc[BC_SHADER_UNIFORM_TEXTUREMATRIX], 1, GL_FALSE, g_Context->TextureMatrix.v);
+        g_Context->Stats.uniform_uploads++;
+    }
+    if (dirty & DIRTY_COLORS)
+    {
+        glUniform4fv(loc[BC_SHADER_UNIFORM_COLOR_ARRAY], BC_COLOR_TYPE_MAX, (float *) g_Context->ColorArray);
+        g_Context->Stats.uniform_uploads++;
+    }
+    if (dirty & DIRTY_LIGHTING)
+    {
+        glUniform1i(loc[BC_SHADER_UNIFORM_LIGHT_ENABLED], g_Context->LightingEnabled);
+        if (g_Context->LightingEnabled)
+            glUniform4f(loc[BC_SHADER_UNIFORM_LIGHT_COLOR], 1, 1, 1, 1);
+        g_Context->Stats.uniform_uploads++;
+    }
+    if (dirty & DIRTY_LIGHT_POSITION)
+    {
+        glUniform3fv(loc[BC_SHADER_UNIFORM_LIGHT_POSITION], 1, g_Context->LightPosition.v);
+        g_Context->Stats.uniform_uploads++;
+    }
+    if (dirty & DIRTY_ALPHA_TEST)
+    {
+        glUniform1i(loc[BC_SHADER_UNIFORM_ALPHATEST], g_Context->AlphaTestEnabled);
+        g_Context->Stats.uniform_uploads++;
+    }
+    if (dirty & DIRTY_TEXTURE)
+    {
+        BCTexture *texture = g_Context->CurrentTexture;
+        glUniform1i(loc[BC_SHADER_UNIFORM_USETEXTURE], texture ? 1 : 0);
+        if (texture)
+        {
+            glUniform1i(loc[BC_SHADER_UNIFORM_TEXTURE], 0);
+            glUniform1i(loc[BC_SHADER_UNIFORM_ALPHAONLYTEXTURE], texture->format == GL_ALPHA ? 1 : 0);
+        }
+        g_Context->Stats.uniform_uploads++;
+    }
+    if (dirty & DIRTY_VERTEX_COLOR)
+    {
+        glUniform1i(loc[BC_SHADER_UNIFORM_VERTEX_COLOR_ENABLED], g_Context->VertexColorEnabled);
+        g_Context->Stats.uniform_uploads++;
+    }
+#else
+    if (dirty & DIRTY_PROJECTION_MATRIX)
+    {
+        glMatrixMode(GL_PROJECTION);
+        glLoadMatrixf(g_Context->ProjectionMatrix.v);
+        glMatrixMode(GL_MODELVIEW);
+        g_Context->Stats.uniform_uploads++;
+    }
+    if (dirty & DIRTY_MODELVIEW_MATRIX)
+    {
+        glLoadMatrixf(g_Context->ModelViewMatrix.v);
+        g_Context->Stats.uniform_uploads++;
+    }
+    // TODO: texture matrix not implemented for OpenGL legacy mode!
+    if (dirty & DIRTY_COLORS)
+    {
+        glColor4fv((float *) &(g_Context->ColorArray[BC_COLOR_TYPE_PRIMARY]));
+        glMaterialfv(GL_FRONT, GL_DIFFUSE, (float *) &(g_Context->ColorArray[BC_COLOR_TYPE_DIFFUSE]));
+        glMaterialfv(GL_FRONT, GL_AMBIENT, (float *) &(g_Context->ColorArray[BC_COLOR_TYPE_AMBIENT]));
+        glMaterialfv(GL_FRONT, GL_SPECULAR, (float *) &(g_Context->ColorArray[BC_COLOR_TYPE_SPECULAR]));
+        glMaterialfv(GL_FRONT, GL_EMISSION, (float *) &(g_Context->ColorArray[BC_COLOR_TYPE_EMISSION]));
+        g_Context->Stats.uniform_uploads++;
+    }
+#endif
+    g_Context->DirtyFlags = 0;
+}
+
+//
+// Mipmaps
+//
+
+static void * resizeMipmap(void *arg)
+{
+    BCMipmapJob *job = (BCMipmapJob *) arg;
+    const BCImage *src = job->src;
+    BCImage *dst = job->dst;
+    // a band of output rows, sampled from the matching part of the source
+    float t0 = (float) job->first_row / dst->height;
+    float t1 = (float) (job->first_row + job->num_rows) / dst->height;
+    unsigned char *out = dst->data + job->first_row * dst->width * dst->comps;
+    // alpha only is not gamma encoded
+    stbir_colorspace space = (src->comps == 1) ? STBIR_COLORSPACE_LINEAR : STBIR_COLORSPACE_SRGB;
+    int alpha = (src->comps == 4) ? 3 : (src->comps == 2) ? 1 : STBIR_ALPHA_CHANNEL_NONE;
+    stbir_resize_region(src->data, src->width, src->height, 0, out, dst->width, job->num_rows, 0,
+        STBIR_TYPE_UINT8, src->comps, alpha, 0, STBIR_EDGE_CLAMP, STBIR_EDGE_CLAMP,
+        STBIR_FILTER_DEFAULT, STBIR_FILTER_DEFAULT, space, NULL, 0, t0, 1, t1);
+    return NULL;
+}
+
+static void buildMipmaps(BCTexture *texture)
+{
+    const BCImage *src = texture->image;
+    int n = 0;
+    while ((src->width >> (n + 1)) > 0 || (src->height >> (n + 1)) > 0)
+        n++;
+    texture->mipmaps = NEW_ARRAY(n, BCImage *);
+    texture->num_mipmaps = n;
+    // each level comes from the previous one, its rows are split over a fixed number of threads
+    for (int i = 0; i < n; i++)
+    {
+        int w = src->width >> 1;
+        int h = src->height >> 1;
+        BCImage *level = bcCreateImage(w > 0 ? w : 1, h > 0 ? h : 1, src->comps);
+        texture->mipmaps[i] = level;
+        int parts = (level->width * level->height >= MIPMAP_THREAD_PIXELS) ? MIPMAP_THREADS : 1;
+        BCMipmapJob jobs[MIPMAP_THREADS];
+        for (int p = 0; p < parts; p++)
+        {
+            jobs[p].src = src;
+            jobs[p].dst = level;
+            jobs[p].first_row = level->height * p / parts;
+            jobs[p].num_rows = level->height * (p + 1) / parts - jobs[p].first_row;
+        }
+#ifndef __EMSCRIPTEN__
+        pthread_t threads[MIPMAP_THREADS];
+        bool threaded[MIPMAP_THREADS] = { false };
+#endif
+        for (int p = 0; p < parts; p++)
+        {
+#ifndef __EMSCRIPTEN__
+            // the last band runs on this thread
+            if (p + 1 < parts)
+                threaded[p] = (pthread_create(&threads[p], NULL, resizeMipmap, &jobs[p]) == 0);
+            if (!threaded[p])
+#endif
+                resizeMipmap(&jobs[p]);
+        }
+#ifndef __EMSCRIPTEN__
+        for (int p = 0; p < parts; p++)
+        {
+            if (threaded[p])
+                pthread_join(threads[p], NULL);
+        }
+#endif
+        src = level;
+    }
+}
+
+static void releaseMipmaps(BCTexture *texture)
+{
+    for (int i = 0; i < texture->num_mipmaps; i++)
+    {
+        bcDestroyImage(texture->mipmaps[i]);
+    }
+    free(texture->mipmaps);
+    texture->mipmaps = NULL;
+    texture->num_mipmaps = 0;
+}
+
+//
+// Texture Loader
+//
+
+static void destroyTextureRequest(BCTextureRequest *request)
+{
+    if (request->image)
+        bcDestroyImage(request->image);
+    free(request->filename);
+    free(request);
+}
+
+static BCTextureRequest * findTextureRequest(BCTextureRequestState state)
+{
+    // highest priority first, oldest first on ties
+    BCTextureRequest *found = NULL;
+    for (clist_node_t *node = g_Context->TextureRequests->head; node; node = node->next)
+    {
+        BCTextureRequest *request = (BCTextureRequest *) node->data;
+        if (request->state == state && (found == NULL || request->priority > found->priority))
+            found = request;
+    }
+    return found;
+}
+
+static void decodeTextureRequest(BCTextureRequest *request)
+{
+    request->state = TEXTURE_REQUEST_DECODING;
+    pthread_mutex_unlock(&(g_Context->TextureRequestMutex));
+    BCImage *image = bcCreateImageFromFile(request->filename);
+    pthread_mutex_lock(&(g_Context->TextureRequestMutex));
+    if (request->state == TEXTURE_REQUEST_CANCELLED)
+    {
+        // texture was destroyed meanwhile
+        if (image)
+            bcDestroyImage(image);
+        clist_delete_node(g_Context->TextureRequests, request);
+        destroyTextureRequest(request);
+        return;
+    }
+    request->image = image;
+    request->state = TEXTURE_REQUEST_DECODED;
+}
+
+#ifndef __EMSCRIPTEN__
+static void * textureLoadWorker(void *arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&(g_Context->TextureRequestMutex));
+    while (!g_Context->TextureLoadQuit)
+    {
+        BCTextureRequest *request = findTextureRequest(TEXTURE_REQUEST_PENDING);
+        if (request == NULL)
+        {
+            pthread_cond_wait(&(g_Context->TextureRequestCond), &(g_Context->TextureRequestMutex));
+            continue;
+        }
+        decodeTextureRequest(request);
+    }
+    pthread_mutex_unlock(&(g_Context->TextureRequestMutex));
+    return NULL;
+}
+#endif
+
+static void startTextureLoader()
+{
+    g_Context->TextureRequests = NEW_OBJECT(clist_t);
+    g_Context->TextureLoadQuit = false;
+    pthread_mutex_init(&(g_Context->TextureRequestMutex), NULL);
+    pthread_cond_init(&(g_Context->TextureRequestCond), NULL);
+#ifndef __EMSCRIPTEN__
+    for (int i = 0; i < TEXTURE_LOAD_WORKERS; i++)
+    {
+        pthread_create(&(g_Context->TextureLoadWorkers[i]), NULL, textureLoadWorker, NULL);
+    }
+#endif
+}
+
+static void stopTextureLoader()
+{
+    if (g_Context->TextureRequests == NULL)
+        return;
+    pthread_mutex_lock(&(g_Context->TextureRequestMutex));
+    g_Context->TextureLoadQuit = true;
+    pthread_cond_broadcast(&(g_Context->TextureRequestCond));
+    pthread_mutex_unlock(&(g_Context->TextureRequestMutex));
+#ifndef __EMSCRIPTEN__
+    for (int i = 0; i < TEXTURE_LOAD_WORKERS; i++)
+    {
+        pthread_join(g_Context->TextureLoadWorkers[i], NULL);
+    }
+#endif
+    while (g_Context->TextureRequests->head)
+    {
+        BCTextureRequest *request = (BCTextureRequest *) g_Context->TextureRequests->head->data;
+        clist_delete_node(g_Context->TextureRequests, request);
+        destroyTextureRequest(request);
+    }
+    pthread_cond_destroy(&(g_Context->TextureRequestCond));
+    pthread_mutex_destroy(&(g_Context->TextureRequestMutex));
+    free(g_Context->TextureRequests);
+    g_Context->TextureRequests = NULL;
+}
+
+static void cancelTextureRequest(BCTexture *texture)
+{
+    if (g_Context->TextureRequests == NULL)
+        return;
+    pthread_mutex_lock(&(g_Context->TextureRequestMutex));
+    for (clist_node_t *node = g_Context->TextureRequests->head; node; node = node->next)
+    {
+        BCTextureRequest *request = (BCTextureRequest *) node->data;
+        if (request->texture != texture)
+            continue;
+        if (request->state == TEXTURE_REQUEST_DECODING)
+        {
+            // the worker owns it until decoding is done
+            request->state = TEXTURE_REQUEST_CANCELLED;
+        }
+        else
+        {
+            clist_delete_node(g_Context->TextureRequests, request);
+            destroyTextureRequest(request);
+        }
+        break;
+    }
+    pthread_mutex_unlock(&(g_Context->TextureRequestMutex));
+}
+
+static void uploadTextureRequest(BCTextureRequest *request)
+{
+    BCTexture *texture = request->texture;
+    if (request->image == NULL)
+    {
+        bcLogWarning("Texture '%s' not loaded!", request->filename);
+        bcSendEvent(BC_EVENT_TEXTURE_LOADED, 0, 0, 0, texture);
+        return;
+    }
+    // swap the placeholder for the decoded image
+    if (texture->image)
+        bcDestroyImage(texture->image);
+    releaseMipmaps(texture);
+    deleteTexture(&(texture->id));
+    texture->image = request->image;
+    texture->width = request->image->width;
+    texture->height = request->image->height;
+    texture->flags = request->flags;
+    request->image = NULL;
+    bcUpdateTexture(texture);
+    if (texture->flags & BC_TEXTURE_DETACHED)
+    {
+        bcDestroyImage(texture->image);
+        texture->image = NULL;
+    }
+    bcSendEvent(BC_EVENT_TEXTURE_LOADED, 1, texture->width, texture->height, texture);
+}
+
+static void updateTextureRequests()
+{
+    if (g_Context->TextureRequests == NULL || !g_Context->Started)
+        return;
+    pthread_mutex_lock(&(g_Context->TextureRequestMutex));
+#ifdef __EMSCRIPTEN__
+    // no workers, decode one image per frame here
+    BCTextureRequest *pending = findTextureRequest(TEXTURE_REQUEST_PENDING);
+    if (pending)
+        decodeTextureRequest(pending);
+#endif
+    int uploaded = 0;
+    BCTextureRequest *request;
+    while ((request = findTextureRequest(TEXTURE_REQUEST_DECODED)) != NULL)
+    {
+        BCImage *image = request->image;
+        int size = image ? image->width * image->height * image->comps : 0;
+        // always make progress, even with images over the budget
+        if (uploaded > 0 && uploaded + size > g_Context->TextureUploadBudget)
+            break;
+        clist_delete_node(g_Context->TextureRequests, request);
+        pthread_mutex_unlock(&(g_Context->TextureRequestMutex));
+        uploadTextureRequest(request);
+        destroyTextureRequest(request);
+        uploaded += size ? size : 1;
+        pthread_mutex_lock(&(g_Context->TextureRequestMutex));
+    }
+    pthread_mutex_unlock(&(g_Context->TextureRequestMutex));
+}
+
+//
+// Restore
+//
+
+static void queueRestoreItem(int type, uint32_t handle)
+{
+    if (g_Context->RestoreQueueCount == g_Context->RestoreQueueCapacity)
+    {
+        g_Context->RestoreQueueCapacity = g_Context->RestoreQueueCapacity ? g_Context->RestoreQueueCapacity * 2 : 64;
+        g_Context->RestoreQueue = EXTEND_ARRAY(g_Context->RestoreQueue, g_Context->RestoreQueueCapacity, BCRestoreItem);
+    }
+    BCRestoreItem *item = &(g_Context->RestoreQueue[g_Context->RestoreQueueCount++]);
+    item->type = type;
+    item->handle = handle;
+    item->frame = 0;
+}
+
+// NULL once the object is destroyed or already restored
+static void * getRestoreObject(BCRestoreItem *item)
+{
+    void *object = getRegistryObject(&(g_Context->RM[item->type]), item->handle);
+    if (object == NULL)
+        return NULL;
+    if (item->type == RM_TYPE_TEXTURE)
+    {
+        BCTexture *texture = (BCTexture *) object;
+        item->frame = texture->RM_frame;
+        return texture->RM_pending ? texture : NULL;
+    }
+    BCMesh *mesh = (BCMesh *) object;
+    item->frame = mesh->RM_frame;
+    return mesh->RM_pending ? mesh : NULL;
+}
+
+static void restoreTexture(BCTexture *texture)
+{
+    float t = bcGetTime();
+    texture->RM_pending = false;
+    bcUpdateTexture(texture);
+    g_Context->RestoreTimeLeft -= (bcGetTime() - t) * 1000.0f;
+    g_Context->RestoreStats.restored_textures++;
+}
+
+static void restoreMesh(BCMesh *mesh)
+{
+    float t = bcGetTime();
+    mesh->RM_pending = false;
+    bcUpdateMesh(mesh);
+    g_Context->RestoreTimeLeft -= (bcGetTime() - t) * 1000.0f;
+    g_Context->RestoreStats.restored_meshes++;
+}
+
+static unsigned int getRestoredTextureId(BCTexture *texture)
+{
+    texture->RM_frame = g_Context->FrameCounter;
+    if (texture->RM_pending)
+    {
+        // upload on first use while the budget lasts
+        if (g_Context->RestoreTimeLeft <= 0)
+            return g_Context->PlaceholderTexture;
+        restoreTexture(texture);
+    }
+    return texture->id;
+}
+
+static void createPlaceholderTexture()
+{
+    static const unsigned char white[4] = { 255, 255, 255, 255 };
+    glGenTextures(1, &(g_Context->PlaceholderTexture));
+    bindTexture(0, g_Context->PlaceholderTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+}
+
+static int compareRestoreItems(const void *a, const void *b)
+{
+    // most recently drawn first
+    return ((const BCRestoreItem *) b)->frame - ((const BCRestoreItem *) a)->frame;
+}
+
+static void updateRestoreQueue()
+{
+    BCRestoreItem *queue = g_Context->RestoreQueue;
+    int n = 0;
+    for (int i = 0; i < g_Context->RestoreQueueCount; i++)
+    {
+        if (getRestoreObject(&(queue[i])))
+            queue[n++] = queue[i];
+    }
+    qsort(queue, n, sizeof(BCRestoreItem), compareRestoreItems);
+    int done = 0;
+    // always make progress, even with the budget spent on first use
+    while (done < n && (done == 0 || g_Context->RestoreTimeLeft > 0))
+    {
+        BCRestoreItem *item = &(queue[done++]);
+        void *object = getRestoreObject(item);
+        if (object == NULL)
+            continue;
+        if (item->type == RM_TYPE_TEXTURE)
+            restoreTexture((BCTexture *) object);
+        else
+            restoreMesh((BCMesh *) object);
+    }
+    memmove(queue, queue + done, (n - done) * sizeof(BCRestoreItem));
+    g_Context->RestoreQueueCount = n - done;
+    g_Context->RestoreStats.pending = g_Context->RestoreQueueCount;
+    if (g_Context->RestoreQueueCount == 0 && g_Context->Restoring)
+    {
+        g_Context->RestoreStats.total_restore_ms = (bcGetTime() - g_Context->RestoreStartTime) * 1000.0f;
+        g_Context->Restoring = false;
+    }
+}
+
+//
+// Init
+//
+
+void bcCreateGfx()
+{
+    g_Context = NEW_OBJECT(BCContext);
+    for (int i = 0; i < RM_TYPE_MAX; i++)
+    {
+        g_Context->RM[i].free_slot = -1;
+    }
+    g_Context->TextureUploadBudget = TEXTURE_UPLOAD_BUDGET;
+    g_Context->LODTriangleSize = LOD_TRIANGLE_SIZE;
+}
+
+#ifdef SUPPORT_GLSL
+static void destroyShaderVariants(BCShader **variants)
+{
+    for (int i = 0; i < SHADER_VARIANT_MAX; i++)
+    {
+        // failed variants point at one with fewer features
+        bool alias = false;
+        for (int j = 0; j < i && !alias; j++)
+            alias = (variants[j] == variants[i]);
+        if (variants[i] && !alias)
+            bcDestroyShader(variants[i]);
+    }
+    memset(variants, 0, SHADER_VARIANT_MAX * sizeof(BCShader *));
+}
+#endif
+
+void bcDestroyGfx()
+{
+    if (g_Context->ReusableSolidMesh)
+    {
+        bcDestroyMesh(g_Context->ReusableSolidMesh);
+        g_Context->ReusableSolidMesh = NULL;
+    }
+    if (g_Context->ReusableCubeMesh)
+    {
+        bcDestroyMesh(g_Context->ReusableCubeMesh);
+        g_Context->ReusableCubeMesh = NULL;
+    }
+    if (g_Context->ReusableWireCubeMesh)
+    {
+        bcDestroyMesh(g_Context->ReusableWireCubeMesh);
+        g_Context->ReusableWireCubeMesh = NULL;
+    }
+    if (g_Context->ReusablePlaneMesh)
+    {
+        bcDestroyMesh(g_Context->ReusablePlaneMesh);
+        g_Context->ReusablePlaneMesh = NULL;
+    }
+    if (g_Context->SpriteBatchMesh)
+    {
+        bcDestroyMesh(g_Context->SpriteBatchMesh);
+        g_Context->SpriteBatchMesh = NULL;
+    }
+    free(g_Context->SpriteBatch);
+    free(g_Context->RenderQueue);
+    free(g_Context->RenderKeys);
+    if (g_Context->InstanceMesh)
+    {
+        bcDestroyMesh(g_Context->InstanceMesh);
+        g_Context->InstanceMesh = NULL;
+    }
+    free(g_Context->InstanceData);
+    free(g_Context->RestoreQueue);
+    free(g_Context->PackBuffer);
+    stopTextureLoader();
+    releaseStreamBuffer(&(g_Context->StreamVertices));
+    releaseStreamBuffer(&(g_Context->StreamIndices));
+    if (g_Context->SpriteIndexBuffer)
+    {
+        deleteBuffer(&(g_Context->SpriteIndexBuffer));
+    }
+    releaseMeshArenas();
+#ifdef SUPPORT_GLSL
+    destroyShaderVariants(g_Context->DefaultVariants);
+    destroyShaderVariants(g_Context->InstancedVariants);
+    g_Context->DefaultShader = NULL;
+    g_Context->InstancedShader = NULL;
+    g_Context->InstancedProgram = NULL;
+    g_Context->ProgramShader = NULL;
+#endif
+    for (int i = 0; i < RM_TYPE_MAX; i++)
+    {
+        releaseRegistry(&(g_Context->RM[i]));
+    }
+    free(g_Context);
+    g_Context = NULL;
+}
+
+void bcStartGfx()
+{
+    g_Context->RestoreStartTime = bcGetTime();
+    bcLog("OpenGL: %s", glGetString(GL_VERSION));
+    bcLog("Device: %s", glGetString(GL_RENDERER));
+    bcLog("GLSL: %s", glGetString(GL_SHADING_LANGUAGE_VERSION));
+    loadExtensions();
+    // init context
+    g_Context->ColorArray[BC_COLOR_TYPE_PRIMARY] = SET_COLOR(1, 1, 1, 1);
+    g_Context->ColorArray[BC_COLOR_TYPE_SECONDARY] = SET_COLOR(1, 1, 1, 1);
+    g_Context->ColorArray[BC_COLOR_TYPE_DIFFUSE] = SET_COLOR(0.8f, 0.8f, 0.8f, 1);
+    g_Context->ColorArray[BC_COLOR_TYPE_AMBIENT] = SET_COLOR(0.2f, 0.2f, 0.2f, 1);
+    g_Context->ColorArray[BC_COLOR_TYPE_SPECULAR] = SET_COLOR(0, 0, 0, 1);
+    g_Context->ColorArray[BC_COLOR_TYPE_EMISSION] = SET_COLOR(0, 0, 0, 1);
+    g_Context->DirtyFlags = DIRTY_ALL;
+#ifdef SUPPORT_GLSL
+    g_Context->InstancedDirty = DIRTY_ALL;
+#endif
+    g_Context->VertexCounter = -1;
+    g_Context->IndexCounter = -1;
+#ifdef SUPPORT_GLSL
+    // compiled by the restore below, the other variants are built on demand
+    if (!g_Context->DefaultShader)
+    {
+        g_Context->DefaultShader = bcCreateShader(s_DefaultShaderVertexCode, s_DefaultShaderFragmentCode);
+        g_Context->DefaultShader->features = SHADER_VARIANT;
+        g_Context->DefaultVariants[0] = g_Context->DefaultShader;
+    }
+    if (!g_Context->InstancedShader && g_Context->Ext.InstancedArrays)
+    {
+        g_Context->InstancedShader = bcCreateShader(s_InstancedShaderVertexCode, s_DefaultShaderFragmentCode);
+        g_Context->InstancedShader->features = SHADER_VARIANT;
+        g_Context->InstancedVariants[0] = g_Context->InstancedShader;
+    }
+#else
+    glAlphaFunc(GL_GREATER, 0.1f);
+    glDisable(GL_LIGHTING);
+    glEnable(GL_NORMALIZE);
+    glEnable(GL_COLOR_MATERIAL);
+    glShadeModel(GL_SMOOTH);
+#endif
+    // glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_FASTEST);
+    // gl default
+    invalidateState();
+    setCapability(STATE_CULL_FACE, false);
+    setCapability(STATE_DEPTH_TEST, false);
+    setCapability(STATE_BLEND, true);
+    setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    setDepthFunc(GL_LEQUAL);
+    glFrontFace(GL_CCW);
+    // RM
+    memset(&(g_Context->RestoreStats), 0, sizeof(BCRestoreStats));
+    g_Context->RestoreTimeLeft = g_Context->RestoreBudget;
+    // with a budget only shaders are restored here, the rest on use or at frame end
+    bool lazy = g_Context->RestoreBudget > 0;
+    if (lazy)
+    {
+        createPlaceholderTexture();
+    }
+    BCRegistry *rm = g_Context->RM;
+    for (int i = 0; i < rm[RM_TYPE_SHADER].count; i++)
+    {
+        bcUpdateShader((BCShader *) rm[RM_TYPE_SHADER].objects[i]);
+    }
+    for (int i = 0; i < rm[RM_TYPE_TEXTURE].count; i++)
+    {
+        BCTexture *texture = (BCTexture *) rm[RM_TYPE_TEXTURE].objects[i];
+        if (lazy)
+        {
+            texture->RM_pending = true;
+            queueRestoreItem(RM_TYPE_TEXTURE, texture->RM_handle);
+        }
+        else
+        {
+            restoreTexture(texture);
+        }
+    }
+    for (int i = 0; i < rm[RM_TYPE_MESH].count; i++)
+    {
+        // streamed data is transient
+        BCMesh *mesh = (BCMesh *) rm[RM_TYPE_MESH].objects[i];
+        if (mesh->type == BC_MESH_STREAM)
+            continue;
+        if (lazy)
+        {
+            mesh->RM_pending = true;
+            queueRestoreItem(RM_TYPE_MESH, mesh->RM_handle);
+        }
+        else
+        {
+            restoreMesh(mesh);
+        }
+    }
+    g_Context->RestoreStats.pending = g_Context->RestoreQueueCount;
+    g_Context->Restoring = g_Context->RestoreQueueCount > 0;
+    if (!g_Context->Restoring)
+    {
+        g_Context->RestoreStats.total_restore_ms = (bcGetTime() - g_Context->RestoreStartTime) * 1000.0f;
+    }
+    g_Context->RestoreFirstFrame = true;
+    g_Context->Started = true;
+    bcBindShader(NULL);
+}
+
+void bcStopGfx()
+{
+    BCRegistry *rm = g_Context->RM;
+    for (int i = 0; i < rm[RM_TYPE_SHADER].count; i++)
+    {
+        bcReleaseShader((BCShader *) rm[RM_TYPE_SHADER].objects[i]);
+    }
+    for (int i = 0; i < rm[RM_TYPE_TEXTURE].count; i++)
+    {
+        bcReleaseTexture((BCTexture *) rm[RM_TYPE_TEXTURE].objects[i]);
+    }
+    for (int i = 0; i < rm[RM_TYPE_MESH].count; i++)
+    {
+        bcReleaseMesh((BCMesh *) rm[RM_TYPE_MESH].objects[i]);
+    }
+    releaseStreamBuffer(&(g_Context->StreamVertices));
+    releaseStreamBuffer(&(g_Context->StreamIndices));
+    if (g_Context->SpriteIndexBuffer)
+    {
+        deleteBuffer(&(g_Context->SpriteIndexBuffer));
+    }
+    if (g_Context->PlaceholderTexture)
+    {
+        deleteTexture(&(g_Context->PlaceholderTexture));
+    }
+    g_Context->RestoreQueueCount = 0;
+    g_Context->Restoring = false;
+    g_Context->CurrentMesh = NULL;
+#ifdef SUPPORT_GLSL
+    g_Context->ProgramShader = NULL;
+#endif
+    invalidateState();
+    g_Context->Started = false;
+}
+
+void bcBeginGfxFrame()
+{
+    memset(&(g_Context->Stats), 0, sizeof(BCGfxStats));
+    g_Context->FrameCounter++;
+    g_Context->RestoreTimeLeft = g_Context->RestoreBudget;
+    updateTextureRequests();
+}
+
+void bcEndGfxFrame()
+{
+    g_Context->FrameStats = g_Context->Stats;
+    if (g_Context->RestoreFirstFrame)
+    {
+        g_Context->RestoreStats.time_to_first_frame_ms = (bcGetTime() - g_Context->RestoreStartTime) * 1000.0f;
+        g_Context->RestoreFirstFrame = false;
+    }
+    if (g_Context->RestoreQueueCount > 0)
+    {
+        updateRestoreQueue();
+    }
+}
+
+//
+// Shader
+//
+
+#ifdef SUPPORT_GLSL
+
+static int buildShaderPrelude(char *generated_code, unsigned int shaderType, int features)
+{
+    const char *type_str = (shaderType == GL_VERTEX_SHADER) ? "VERTEX" : "FRAGMENT";
+    char sline[200];
+    // defines
+    sprintf(generated_code, "#define %s\n", type_str);
+    for (int i = 0; s_ShaderFeatureDefines[i]; i++)
+    {
+        if (features & (1 << i))
+        {
+            sprintf(sline, "#define %s\n", s_ShaderFeatureDefines[i]);
+            strcat(generated_code, sline);
+        }
+    }
+    for (int i = 0; s_DefaultShaderConstInts[i].name; i++)
+    {
+        sprintf(sline, "#define %s %d\n", s_DefaultShaderConstInts[i].name, s_DefaultShaderConstInts[i].value);
+        strcat(generated_code, sline);
+    }
+    // attributes
+    if (shaderType == GL_VERTEX_SHADER)
+    {
+        for (int i = 0; s_DefaultShaderAttributes[i].name; i++)
+        {
+            sprintf(sline, "attribute %s %s;\n", s_DefaultShaderAttributes[i].type, s_DefaultShaderAttributes[i].name);
+            strcat(generated_code, sline);
+        }
+    }
+    // uniforms
+    for (int i = 0; s_DefaultShaderUniforms[i].name; i++)
+    {
+        if (s_DefaultShaderUniforms[i].size > 1)
+            sprintf(sline, "uniform %s %s[%d];\n", s_DefaultShaderUniforms[i].type, s_DefaultShaderUniforms[i].name, s_DefaultShaderUniforms[i].size);
+        else
+            sprintf(sline, "uniform %s %s;\n", s_DefaultShaderUniforms[i].type, s_DefaultShaderUniforms[i].name);
+        strcat(generated_code, sline);
+    }
+    // varyings
+    for (int i = 0; s_DefaultShaderVars[i].name; i++)
+    {
+        sprintf(sline, "varying %s %s;\n", s_DefaultShaderVars[i].type, s_DefaultShaderVars[i].name);
+        strcat(generated_code, sline);
+    }
+    return strlen(generated_code);
+}
+
+static uint64_t hashString(uint64_t hash, const char *str)
+{
+    // FNV-1a, the terminator separates consecutive strings
+    if (str == NULL)
+        str = "";
+    do
+    {
+        hash ^= (uint8_t) *str;
+        hash *= 1099511628211ull;
+    } while (*str++);
+    return hash;
+}
+
+static uint64_t hashShaderProgram(BCShader *shader)
+{
+    char generated_code[2000];
+    uint64_t hash = 14695981039346656037ull;
+    hash = hashString(hash, GLSL_VERSION);
+    buildShaderPrelude(generated_code, GL_VERTEX_SHADER, shader->features);
+    hash = hashString(hash, generated_code);
+    hash = hashString(hash, shader->vs_code);
+    buildShaderPrelude(generated_code, GL_FRAGMENT_SHADER, shader->features);
+    hash = hashString(hash, generated_code);
+    hash = hashString(hash, shader->fs_code);
+    // attribute bindings are baked into the binary
+    for (int i = 0; s_InstanceShaderAttributes[i].name; i++)
+    {
+        hash = hashString(hash, s_InstanceShaderAttributes[i].name);
+    }
+    hash = hashString(hash, (const char *) glGetString(GL_VERSION));
+    hash = hashString(hash, (const char *) glGetString(GL_RENDERER));
+    return hash;
+}
+
+static bool loadProgramBinary(BCShader *shader, uint64_t hash)
+{
+    char path[100];
+    sprintf(path, PROGRAM_CACHE_DIR "/%016llx.bin", (unsigned long long) hash);
+    BCFile *file = bcOpenFile(path, BC_FILE_READ_DATA);
+    if (file == NULL)
+        return false;
+    BCProgramFileHeader header;
+    void *binary = NULL;
+    bool valid = bcReadFile(file, &header, sizeof(header)) == sizeof(header) &&
+        memcmp(header.signature, s_ProgramFileSignature, 4) == 0 &&
+        header.version == s_ProgramFileVersion &&
+        header.hash == hash &&
+        header.length > 0;
+    if (valid)
+    {
+        binary = malloc(header.length);
+        valid = bcReadFile(file, binary, header.length) == header.length;
+    }
+    bcCloseFile(file);
+    if (valid)
+    {
+        // the driver rejects binaries from other versions or devices
+        shader->programId = glCreateProgram();
+        g_Context->Ext.ProgramBinary(shader->programId, header.format, binary, header.length);
+        GLint linked = GL_FALSE;
+        glGetProgramiv(shader->programId, GL_LINK_STATUS, &linked);
+        if (linked == GL_FALSE)
+        {
+            deleteProgram(shader->programId);
+            shader->programId = 0;
+            valid = false;
+        }
+    }
+    free(binary);
+    if (!valid)
+    {
+        bcLogWarning("Discarding program cache %s", path);
+        bcRemoveFile(path);
+    }
+    return valid;
+}
+
+static void saveProgramBinary(BCShader *shader, uint64_t hash)
+{
+    GLint length = 0;
+    glGetProgramiv(shader->programId, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    void *binary = malloc(length);
+    GLenum format = 0;
+    g_Context->Ext.GetProgramBinary(shader->programId, length, &length, &format, binary);
+    BCProgramFileHeader header;
+    memcpy(header.signature, s_ProgramFileSignature, 4);
+    header.version = s_ProgramFileVersion;
+    header.hash = hash;
+    header.format = format;
+    header.length = length;
+    char path[100];
+    sprintf(path, PROGRAM_CACHE_DIR "/%016llx.bin", (unsigned long long) hash);
+    if (!bcFileExists(PROGRAM_CACHE_DIR))
+        bcCreateDir(PROGRAM_CACHE_DIR);
+    BCFile *file = bcOpenFile(path, BC_FILE_WRITE_DATA);
+    if (file)
+    {
+        bcWriteFile(file, &header, sizeof(header));
+        bcWriteFile(file, binary, length);
+        bcCloseFile(file);
+    }
+    else
+    {
+        bcLogWarning("Can't write to file: %s", path);
+    }
+    free(binary);
+}
+
+static void getShaderUniforms(BCShader *shader)
+{
+    for (int i = 0; i < BC_SHADER_UNIFORM_MAX; i++)
+    {
+        shader->loc_uniforms[i] = glGetUniformLocation(shader->programId, s_DefaultShaderUniforms[i].name);
+        // variants drop whatever their features don't use
+        if (shader->loc_uniforms[i] == -1 && !(shader->features & SHADER_VARIANT))
+            bcLogWarning("Shader uniform '%s' not found!", s_DefaultShaderUniforms[i].name);
+    }
+}
+
+static unsigned int loadShader(const char *code, unsigned int shaderType, int features)
+{
+    const char *type_str = (shaderType == GL_VERTEX_SHADER) ? "VERTEX" : "FRAGMENT";
+    // generated code
+    char generated_code[2000];
+    int generated_len = buildShaderPrelude(generated_code, shaderType, features);
+    // init shader source
+    const char *strings[3] = { GLSL_VERSION,  generated_code, code };
+    int lengths[3] = { (int) strlen(GLSL_VERSION), generated_len, (int) strlen(code) };
+#if DEBUG_SHADER
+    // print shader code
+    printf("\n>>> SHADER type=%d <<<\n%s%s%s\n>>> END <<<\n", strings[0], strings[1], strings[2]);
+#endif
+    // create and compile
+    GLuint shaderId = glCreateShader(shaderType);
+    if (shaderId == 0)
+    {
+        bcLogError("glCreateShader failed!");
+        return 0;
+    }
+    glShaderSource(shaderId, 3, strings, lengths);
+    glCompileShader(shaderId);
+    GLint compileError = 0;
+    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileError);
+    // parse error log
+    char errorLog[2000];
+    GLsizei errorLen = 0;
+    glGetShaderInfoLog(shaderId, 2000, &errorLen, errorLog);
+    if (errorLen)
+    {
+        if (compileError == GL_FALSE)
+        {
+            bcLogError("Compile %s shader:\n%s", type_str, errorLog);
+        }
+        else
+        {
+            bcLogWarning("Compile %s shader:\n%s", type_str, errorLog);
+        }
+    }
+    if (compileError == GL_FALSE)
+    {
+        glDeleteShader(shaderId);
+        bcLogError("Shader not created!");
+        return 0;
+    }
+    return shaderId;
+}
+
+static BCShader * createShader(const char *vs_code, const char *fs_code, int features)
+{
+    BCShader *shader = NEW_OBJECT(BCShader);
+    shader->vs_code = cstr_strdup(vs_code);
+    shader->fs_code = cstr_strdup(fs_code);
+    shader->features = features;
+    if (g_Context->Started && !bcUpdateShader(shader))
+    {
+        // never registered, so not a bcDestroyShader
+        bcReleaseShader(shader);
+        free(shader->vs_code);
+        free(shader->fs_code);
+        free(shader);
+        return NULL;
+    }
+    shader->RM_handle = addRegistryObject(&(g_Context->RM[RM_TYPE_SHADER]), shader);
+    return shader;
+}
+
+static int getShaderFeatures()
+{
+    int features = 0;
+    BCTexture *texture = g_Context->CurrentTexture;
+    if (texture)
+    {
+        // alpha test only looks at texels
+        features |= SHADER_FEATURE_TEXTURE;
+        if (g_Context->AlphaTestEnabled)
+            features |= SHADER_FEATURE_ALPHA_TEST;
+        if (texture->format == GL_ALPHA)
+            features |= SHADER_FEATURE_ALPHA_ONLY_TEXTURE;
+    }
+    if (g_Context->LightingEnabled)
+        features |= SHADER_FEATURE_LIGHTING;
+    if (g_Context->VertexColorEnabled)
+        features |= SHADER_FEATURE_VERTEX_COLOR;
+    return features;
+}
+
+// Cached variant with the most of the requested features, texturing first
+static int findFallbackVariant(BCShader **variants, int features)
+{
+    int best = 0;
+    int best_score = 0;
+    for (int f = 1; f < SHADER_VARIANT_MAX; f++)
+    {
+        if (variants[f] == NULL || f == features || (f & ~features))
+            continue;
+        int score = (f & SHADER_FEATURE_TEXTURE) ? SHADER_VARIANT_MAX : 0;
+        for (int bit = f; bit; bit &= bit - 1)
+            score++;
+        if (score > best_score)
+        {
+            best = f;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+static void bindShaderVariant()
+{
+    BCShader **variants = NULL;
+    if (g_Context->CurrentShader == g_Context->DefaultShader)
+        variants = g_Context->DefaultVariants;
+    else if (g_Context->CurrentShader == g_Context->InstancedShader)
+        variants = g_Context->InstancedVariants;
+    if (variants == NULL || !(g_Context->DirtyFlags & DIRTY_SHADER_FEATURES))
+        return;
+    int features = getShaderFeatures();
+    if (variants[features] == NULL)
+    {
+        variants[features] = createShader(variants[0]->vs_code, variants[0]->fs_code, features | SHADER_VARIANT);
+        if (variants[features] == NULL)
+        {
+            // fall back without retrying every draw
+            int fallback = findFallbackVariant(variants, features);
+            bcLogError("Shader variant 0x%x failed, using 0x%x instead!", features, fallback);
+            variants[features] = variants[fallback];
+        }
+    }
+    BCShader *shader = variants[features];
+    if (g_Context->ProgramShader != shader)
+    {
+        // uniforms are per program
+        g_Context->ProgramShader = shader;
+        g_Context->DirtyFlags = DIRTY_ALL;
+    }
+    useProgram(shader->programId);
+}
+
+BCShader * bcCreateShaderFromSingleFile(const char *filename)
+{
+    char *code = bcLoadTextFile(filename, NULL);
+    if (code == NULL)
+        return NULL;
+    BCShader *shader = bcCreateShader(code, code);
+    free(code);
+    return shader;
+}
+
+BCShader * bcCreateShaderFromFile(const char *vsFilename, const char *fsFilename)
+{
+    char *vsCode = bcLoadTextFile(vsFilename, NULL);
+    if (vsCode == NULL)
+    {
+        return NULL;
+    }
+    char *fsCode = bcLoadTextFile(fsFilename, NULL);
+    if (fsCode == NULL)
+    {
+        free(vsCode);
+        return NULL;
+    }
+    BCShader *shader = bcCreateShader(vsCode, fsCode);
+    free(vsCode);
+    free(fsCode);
+    return shader;
+}
+
+BCShader * bcCreateShader(const char *vs_code, const char *fs_code)
+{
+    return createShader(vs_code, fs_code, 0);
+}
+
+bool bcUpdateShader(BCShader *shader)
+{
+    uint64_t hash = 0;
+    if (g_Context->Ext.ProgramBinaries)
+    {
+        hash = hashShaderProgram(shader);
+        if (loadProgramBinary(shader, hash))
+        {
+            getShaderUniforms(shader);
+            return true;
+        }
+    }
     // vertex shaders
-    shader->vs_id = bcLoadShader(shader->vs_code, GL_VERTEX_SHADER);
+    shader->vs_id = loadShader(shader->vs_code, GL_VERTEX_SHADER, shader->features);
     if (shader->vs_id == 0)
     {
-        return false;
+        return false;
+    }
+    // fragment shader
+    shader->fs_id = loadShader(shader->fs_code, GL_FRAGMENT_SHADER, shader->features);
+    if (shader->fs_id == 0)
+    {
+        return false;
+    }
+    // create program
+    shader->programId = glCreateProgram();
+    if (shader->programId == 0)
+    {
+        bcLogError("Error creating shader program!");
+        return false;
+    }
+    glAttachShader(shader->programId, shader->vs_id);
+    glAttachShader(shader->programId, shader->fs_id);
+    // bind attributes
+    for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
+    {
+        glBindAttribLocation(shader->programId, i, s_DefaultShaderAttributes[i].name);
+    }
+    for (int i = 0; s_InstanceShaderAttributes[i].name; i++)
+    {
+        glBindAttribLocation(shader->programId, BC_VERTEX_ATTR_MAX + i, s_InstanceShaderAttributes[i].name);
+    }
+    if (!bcLinkShaderProgram(shader->programId))
+    {
+        return false;
+    }
+    if (g_Context->Ext.ProgramBinaries)
+    {
+        saveProgramBinary(shader, hash);
+    }
+    getShaderUniforms(shader);
+    return true;
+}
+
+
+void bcReleaseShader(BCShader *shader)
+{
+    if (!shader)
+    {
+        bcLogError("Invalid shader!");
+        return;
+    }
+    if (shader->vs_id)
+        glDeleteShader(shader->vs_id);
+    if (shader->fs_id)
+        glDeleteShader(shader->fs_id);
+    deleteProgram(shader->programId);
+}
+
+void bcDestroyShader(BCShader *shader)
+{
+    if (!shader)
+    {
+        bcLogError("Invalid shader!");
+        return;
+    }
+    bcReleaseShader(shader);
+    free(shader->vs_code);
+    free(shader->fs_code);
+    removeRegistryObject(&(g_Context->RM[RM_TYPE_SHADER]), shader->RM_handle);
+    free(shader);
+}
+
+BCShader * bcGetShaderFromHandle(uint32_t handle)
+{
+    return (BCShader *) getRegistryObject(&(g_Context->RM[RM_TYPE_SHADER]), handle);
+}
+
+void bcBindShader(BCShader *shader)
+{
+    if (shader == NULL)
+        shader = g_Context->DefaultShader;
+    if (g_Context->CurrentShader != shader)
+    {
+        // uniforms are per program
+        g_Context->DirtyFlags = DIRTY_ALL;
+    }
+    g_Context->CurrentShader = shader;
+    // queued draws bind their own program, default variants are picked at draw time
+    if (!g_Context->RenderQueueActive && !(shader->features & SHADER_VARIANT))
+    {
+        g_Context->ProgramShader = shader;
+        useProgram(shader->programId);
+    }
+}
+
+unsigned int bcLoadShader(const char *code, unsigned int shaderType)
+{
+    return loadShader(code, shaderType, 0);
+}
+
+bool bcLinkShaderProgram(unsigned int programId)
+{
+    // link program
+    glLinkProgram(programId);
+    GLint linkError = 0;
+    glGetProgramiv(programId, GL_LINK_STATUS, &linkError);
+    if (linkError == GL_FALSE) {
+        char errorLog[2000];
+        GLsizei errorLen = 0;
+        glGetProgramInfoLog(programId, 2000, &errorLen, errorLog);
+        bcLogError("Link program:\n%s", errorLog);
+        return false;
+    }
+    // validate program
+    glValidateProgram(programId);
+    GLint validateError = 0;
+    glGetProgramiv(programId, GL_VALIDATE_STATUS, &validateError);
+    if (validateError == GL_FALSE) {
+        char errorLog[2000];
+        GLsizei errorLen = 0;
+        glGetProgramInfoLog(programId, 2000, &errorLen, errorLog);
+        bcLogError("Validate program:\n%s", errorLog);
+        return false;
+    }
+    return true;
+}
+
+#else // SUPPORT_GLSL
+
+BCShader * bcCreateShader(const char *vs_code, const char *fs_code) { return NULL; }
+BCShader * bcCreateShaderFromSingleFile(const char *filename) { return NULL; }
+BCShader * bcCreateShaderFromFile(const char *vsFilename, const char *fsFilename) { return NULL; }
+void bcUpdateShader(BCShader *shader) { }
+void bcReleaseShader(BCShader *shader) { }
+void bcDestroyShader(BCShader *shader) { }
+void bcBindShader(BCShader *shader) { }
+unsigned int bcLoadShader(const char *code, unsigned int shaderType) { return 0; }
+bool bcLinkShaderProgram(unsigned int programId) { return false; }
+
+#endif // SUPPORT_GLSL
+
+//
+// Image
+//
+
+BCImage * bcCreateImage(int width, int height, int comps)
+{
+    BCImage *image = NEW_OBJECT(BCImage);
+    image->width = width;
+    image->height = height;
+    image->comps = comps;
+    image->data = calloc(1, width * height * comps);
+    return image;
+}
+
+BCImage * bcCreateImageFromFile(const char *filename)
+{
+#if 0
+    int x, y, comp;
+    unsigned char *data = stbi_load(filename, &x, &y, &comp, 0);
+    if (data == NULL)
+    {
+        bcLogWarning("Image file '%s' not found!", filename);
+        return NULL;
+    }
+    BCImage *image = NEW_OBJECT(BCImage);
+    image->width = x;
+    image->height = y;
+    image->comps = comp;
+    image->data = data;
+    return image;
+#else
+    int size = 0;
+    unsigned char *data = bcLoadDataFile(filename, &size);
+    if (data == NULL)
+    {
+        bcLogWarning("Image file '%s' not found!", filename);
+        return NULL;
+    }
+    if (size <= 0)
+    {
+        bcLogWarning("Image file '%s' not valid!", filename);
+        free(data);
+        return NULL;
+    }
+    BCImage *image = bcCreateImageFromMemory(data, size);
+    free(data);
+    return image;
+#endif
+}
+
+BCImage * bcCreateImageFromMemory(void *buffer, int size)
+{
+    int x, y, comp;
+    unsigned char *data = stbi_load_from_memory(buffer, size, &x, &y, &comp, 0);
+    if (data == NULL)
+    {
+        bcLogWarning("Image data not valid!");
+        return NULL;
+    }
+    BCImage *image = NEW_OBJECT(BCImage);
+    image->width = x;
+    image->height = y;
+    image->comps = comp;
+    image->data = data;
+    return image;
+}
+
+void bcDestroyImage(BCImage *image)
+{
+    free(image->data);
+    free(image);
+}
+
+//
+// Texture
+//
+
+BCTexture * bcCreateTextureFromFile(const char *filename, int flags)
+{
+    BCImage *image = bcCreateImageFromFile(filename);
+    if (image == NULL)
+        return NULL;
+    return bcCreateTextureFromImage(image, flags);
+}
+
+BCTexture * bcCreateTextureFromImage(BCImage *image, int flags)
+{
+    BCTexture *texture = NEW_OBJECT(BCTexture);
+    texture->width = image->width;
+    texture->height = image->height;
+    texture->image = image;
+    texture->flags = flags;
+    if (g_Context->Started)
+    {
+        bcUpdateTexture(texture);
+    }
+    if (flags & BC_TEXTURE_DETACHED)
+    {
+        bcDestroyImage(image);
+        texture->image = NULL;
+    }
+    texture->RM_handle = addRegistryObject(&(g_Context->RM[RM_TYPE_TEXTURE]), texture);
+    return texture;
+}
+
+BCTexture * bcLoadTextureAsync(const char *filename, int flags, int priority)
+{
+    if (g_Context->TextureRequests == NULL)
+    {
+        startTextureLoader();
+    }
+    // white placeholder until the real image is uploaded
+    BCImage *image = bcCreateImage(1, 1, 4);
+    memset(image->data, 255, 4);
+    BCTexture *texture = bcCreateTextureFromImage(image, flags & ~BC_TEXTURE_DETACHED);
+    BCTextureRequest *request = NEW_OBJECT(BCTextureRequest);
+    request->state = TEXTURE_REQUEST_PENDING;
+    request->filename = cstr_strdup(filename);
+    request->texture = texture;
+    request->flags = flags;
+    request->priority = priority;
+    pthread_mutex_lock(&(g_Context->TextureRequestMutex));
+    clist_add_node(g_Context->TextureRequests, request);
+    pthread_cond_signal(&(g_Context->TextureRequestCond));
+    pthread_mutex_unlock(&(g_Context->TextureRequestMutex));
+    return texture;
+}
+
+void bcSetTextureUploadBudget(int bytes_per_frame)
+{
+    g_Context->TextureUploadBudget = bytes_per_frame;
+}
+
+static void uploadTextureLevel(int level, int internalFormat, int format, BCImage *image)
+{
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        level,
+        internalFormat,
+        image->width,
+        image->height,
+        0,
+        format,
+        GL_UNSIGNED_BYTE,
+        image->data);
+}
+
+void bcUpdateTexture(BCTexture *texture)
+{
+    texture->RM_pending = false;
+    int internalFormat;
+    switch (texture->image->comps)
+    {
+    case 1:
+        internalFormat = GL_ALPHA;
+        texture->format = GL_ALPHA;
+        break;
+    case 3:
+        internalFormat = GL_RGB;
+        texture->format = GL_RGB;
+        break;
+    case 4:
+        internalFormat = GL_RGBA;
+        texture->format = GL_RGBA;
+        break;
+    }
+    bool mipmaps = !(texture->flags & (BC_TEXTURE_LINEAR | BC_TEXTURE_NEAREST)) &&
+        (texture->flags & (BC_TEXTURE_MIPMAP | BC_TEXTURE_MIPMAP_CPU));
+    if (mipmaps && !g_Context->Ext.NonPowerOfTwoMipmaps &&
+        ((texture->width & (texture->width - 1)) || (texture->height & (texture->height - 1))))
+    {
+        bcLogWarning("Mipmaps of NPOT texture %dx%d not supported!", texture->width, texture->height);
+        mipmaps = false;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glGenTextures(1, &(texture->id));
+    bindTexture(0, texture->id);
+    // filter flags
+    if (texture->flags & BC_TEXTURE_LINEAR)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    else if (texture->flags & BC_TEXTURE_NEAREST)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    else if (mipmaps)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    else
+    {
+        // linear filter by default
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    // wrap flags
+    if (texture->flags & BC_TEXTURE_REPEAT)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    }
+    else if (texture->flags & BC_TEXTURE_CLAMP)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    uploadTextureLevel(0, internalFormat, texture->format, texture->image);
+    if (mipmaps)
+    {
+        if (!(texture->flags & BC_TEXTURE_MIPMAP_CPU) && g_Context->Ext.GenerateMipmap)
+        {
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+        else
+        {
+            // a kept chain is reused on context restore
+            if (texture->mipmaps == NULL)
+                buildMipmaps(texture);
+            for (int i = 0; i < texture->num_mipmaps; i++)
+            {
+                uploadTextureLevel(i + 1, internalFormat, texture->format, texture->mipmaps[i]);
+            }
+            if (texture->flags & BC_TEXTURE_DETACHED)
+                releaseMipmaps(texture);
+        }
+    }
+    bindTexture(0, 0);
+}
+
+void bcReleaseTexture(BCTexture *texture)
+{
+    if (!texture)
+    {
+        bcLogError("Invalid texture!");
+        return;
+    }
+    deleteTexture(&(texture->id));
+}
+
+void bcDestroyTexture(BCTexture *texture)
+{
+    if (!texture)
+    {
+        bcLogError("Invalid texture!");
+        return;
+    }
+    cancelTextureRequest(texture);
+    releaseMipmaps(texture);
+    if (texture->image)
+        bcDestroyImage(texture->image);
+    bcReleaseTexture(texture);
+    removeRegistryObject(&(g_Context->RM[RM_TYPE_TEXTURE]), texture->RM_handle);
+    free(texture);
+}
+
+BCTexture * bcGetTextureFromHandle(uint32_t handle)
+{
+    return (BCTexture *) getRegistryObject(&(g_Context->RM[RM_TYPE_TEXTURE]), handle);
+}
+
+void bcBindTexture(BCTexture *texture)
+{
+    if (texture && !g_Context->RenderQueueActive)
+    {
+        bindTexture(0, getRestoredTextureId(texture));
+    }
+#ifdef SUPPORT_GLSL
+    updateState(DIRTY_TEXTURE, &(g_Context->CurrentTexture), &texture, sizeof(BCTexture *));
+#else
+    g_Context->CurrentTexture = texture;
+    if (texture)
+        glEnable(GL_TEXTURE_2D);
+    else
+        glDisable(GL_TEXTURE_2D);
+#endif
+}
+
+//
+// Atlas
+//
+
+static BCAtlasPage * addAtlasPage(BCAtlas *atlas)
+{
+    atlas->pages = EXTEND_ARRAY(atlas->pages, atlas->num_pages + 1, BCAtlasPage);
+    BCAtlasPage *page = &(((BCAtlasPage *) atlas->pages)[atlas->num_pages++]);
+    page->nodes = NEW_ARRAY(atlas->width + 1, BCSkylineNode);
+    page->nodes[0].width = atlas->width;
+    page->num_nodes = 1;
+    page->packed_area = 0;
+    page->live_area = 0;
+    BCImage *image = bcCreateImage(atlas->width, atlas->height, 4);
+    page->texture = bcCreateTextureFromImage(image, atlas->flags & ~BC_TEXTURE_DETACHED);
+    return page;
+}
+
+static void resetAtlasPage(BCAtlas *atlas, BCAtlasPage *page)
+{
+    page->nodes[0].x = 0;
+    page->nodes[0].y = 0;
+    page->nodes[0].width = atlas->width;
+    page->num_nodes = 1;
+    page->packed_area = 0;
+    page->live_area = 0;
+    memset(page->texture->image->data, 0, atlas->width * atlas->height * 4);
+}
+
+static int fitSkyline(BCAtlas *atlas, BCAtlasPage *page, int index, int w, int h)
+{
+    // lowest y the rect can rest on when starting at this node
+    int x = page->nodes[index].x;
+    if (x + w > atlas->width)
+        return -1;
+    int y = 0;
+    for (int i = index, left = w; left > 0; i++)
+    {
+        if (page->nodes[i].y > y)
+            y = page->nodes[i].y;
+        if (y + h > atlas->height)
+            return -1;
+        left -= page->nodes[i].width;
+    }
+    return y;
+}
+
+static bool packSkyline(BCAtlas *atlas, BCAtlasPage *page, int w, int h, int *out_x, int *out_y)
+{
+    // bottom-left: lowest top edge, then narrowest node
+    int best = -1, best_top = 0, best_width = 0, best_y = 0;
+    for (int i = 0; i < page->num_nodes; i++)
+    {
+        int y = fitSkyline(atlas, page, i, w, h);
+        if (y < 0)
+            continue;
+        if (best < 0 || y + h < best_top || (y + h == best_top && page->nodes[i].width < best_width))
+        {
+            best = i;
+            best_top = y + h;
+            best_width = page->nodes[i].width;
+            best_y = y;
+        }
+    }
+    if (best < 0)
+        return false;
+    *out_x = page->nodes[best].x;
+    *out_y = best_y;
+    // new node covers the rect, the ones below it shrink or go away
+    BCSkylineNode node = { *out_x, best_y + h, w };
+    memmove(&(page->nodes[best + 1]), &(page->nodes[best]), (page->num_nodes - best) * sizeof(BCSkylineNode));
+    page->nodes[best] = node;
+    page->num_nodes++;
+    for (int i = best + 1; i < page->num_nodes; i++)
+    {
+        BCSkylineNode *prev = &(page->nodes[i - 1]);
+        BCSkylineNode *cur = &(page->nodes[i]);
+        int shrink = prev->x + prev->width - cur->x;
+        if (shrink <= 0)
+            break;
+        cur->x += shrink;
+        cur->width -= shrink;
+        if (cur->width > 0)
+            break;
+        memmove(cur, cur + 1, (page->num_nodes - i - 1) * sizeof(BCSkylineNode));
+        page->num_nodes--;
+        i--;
+    }
+    // merge neighbours at the same height
+    for (int i = 0; i < page->num_nodes - 1; i++)
+    {
+        if (page->nodes[i].y == page->nodes[i + 1].y)
+        {
+            page->nodes[i].width += page->nodes[i + 1].width;
+            memmove(&(page->nodes[i + 1]), &(page->nodes[i + 2]), (page->num_nodes - i - 2) * sizeof(BCSkylineNode));
+            page->num_nodes--;
+            i--;
+        }
+    }
+    page->packed_area += w * h;
+    page->live_area += w * h;
+    return true;
+}
+
+static void blitAtlasRegion(BCAtlas *atlas, BCAtlasRegion *region)
+{
+    // copy with edge pixels extruded into the padding, keeps filtering and mips clean
+    BCAtlasPage *page = &(((BCAtlasPage *) atlas->pages)[region->page]);
+    BCImage *dst = page->texture->image;
+    BCImage *src = region->image;
+    int pad = atlas->padding;
+    for (int y = -pad; y < src->height + pad; y++)
+    {
+        int sy = (y < 0) ? 0 : (y >= src->height) ? src->height - 1 : y;
+        for (int x = -pad; x < src->width + pad; x++)
+        {
+            int sx = (x < 0) ? 0 : (x >= src->width) ? src->width - 1 : x;
+            memcpy(&(dst->data[((region->y + y) * dst->width + region->x + x) * 4]), &(src->data[(sy * src->width + sx) * 4]), 4);
+        }
+    }
+}
+
+static void uploadAtlasRegion(BCAtlas *atlas, BCAtlasRegion *region)
+{
+    if (!g_Context->Started)
+        return;
+    BCAtlasPage *page = &(((BCAtlasPage *) atlas->pages)[region->page]);
+    BCTexture *texture = page->texture;
+    // the whole page is uploaded on restore
+    if (texture->RM_pending)
+        return;
+    if (texture->flags & (BC_TEXTURE_MIPMAP | BC_TEXTURE_MIPMAP_CPU))
+    {
+        // levels depend on the whole page
+        releaseMipmaps(texture);
+        deleteTexture(&(texture->id));
+        bcUpdateTexture(texture);
+        return;
+    }
+    // GLES2 has no unpack row length, so send whole rows of the padded rect
+    int pad = atlas->padding;
+    int y = region->y - pad;
+    int h = region->height + pad * 2;
+    bindTexture(0, texture->id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, atlas->width, h, GL_RGBA, GL_UNSIGNED_BYTE, &(texture->image->data[y * atlas->width * 4]));
+}
+
+static bool placeAtlasRegion(BCAtlas *atlas, BCAtlasRegion *region)
+{
+    int w = region->width + atlas->padding * 2;
+    int h = region->height + atlas->padding * 2;
+    for (int i = 0; i < atlas->num_pages; i++)
+    {
+        int x, y;
+        if (packSkyline(atlas, &(((BCAtlasPage *) atlas->pages)[i]), w, h, &x, &y))
+        {
+            region->page = i;
+            region->x = x + atlas->padding;
+            region->y = y + atlas->padding;
+            region->texture = ((BCAtlasPage *) atlas->pages)[i].texture;
+            region->sx = (float) region->x / atlas->width;
+            region->sy = (float) region->y / atlas->height;
+            region->sw = (float) region->width / atlas->width;
+            region->sh = (float) region->height / atlas->height;
+            blitAtlasRegion(atlas, region);
+            return true;
+        }
+    }
+    return false;
+}
+
+static float getAtlasFragmentation(BCAtlas *atlas)
+{
+    int packed = 0, live = 0;
+    for (int i = 0; i < atlas->num_pages; i++)
+    {
+        packed += ((BCAtlasPage *) atlas->pages)[i].packed_area;
+        live += ((BCAtlasPage *) atlas->pages)[i].live_area;
+    }
+    return packed ? 1.0f - (float) live / packed : 0;
+}
+
+static int compareAtlasRegions(const void *a, const void *b)
+{
+    const BCAtlasRegion *ra = *(const BCAtlasRegion **) a;
+    const BCAtlasRegion *rb = *(const BCAtlasRegion **) b;
+    if (ra->height != rb->height)
+        return rb->height - ra->height;
+    return rb->width - ra->width;
+}
+
+BCAtlas * bcCreateAtlas(int width, int height, int padding, int flags)
+{
+    BCAtlas *atlas = NEW_OBJECT(BCAtlas);
+    atlas->width = width;
+    atlas->height = height;
+    atlas->padding = padding;
+    atlas->flags = flags;
+    addAtlasPage(atlas);
+    return atlas;
+}
+
+void bcDestroyAtlas(BCAtlas *atlas)
+{
+    if (atlas == NULL)
+        return;
+    for (int i = 0; i < atlas->num_regions; i++)
+    {
+        bcDestroyImage(atlas->regions[i]->image);
+        free(atlas->regions[i]);
+    }
+    for (int i = 0; i < atlas->num_pages; i++)
+    {
+        BCAtlasPage *page = &(((BCAtlasPage *) atlas->pages)[i]);
+        bcDestroyTexture(page->texture);
+        free(page->nodes);
+    }
+    free(atlas->regions);
+    free(atlas->pages);
+    free(atlas);
+}
+
+BCAtlasRegion * bcAddAtlasImage(BCAtlas *atlas, BCImage *image)
+{
+    if (image == NULL)
+    {
+        bcLogError("Invalid image!");
+        return NULL;
+    }
+    if (image->width + atlas->padding * 2 > atlas->width || image->height + atlas->padding * 2 > atlas->height)
+    {
+        bcLogError("Image %dx%d too big for atlas!", image->width, image->height);
+        return NULL;
+    }
+    BCAtlasRegion *region = NEW_OBJECT(BCAtlasRegion);
+    region->width = image->width;
+    region->height = image->height;
+    // private RGBA copy, pages are rebuilt from it on repack
+    region->image = bcCreateImage(image->width, image->height, 4);
+    for (int i = 0; i < image->width * image->height; i++)
+    {
+        unsigned char *src = &(image->data[i * image->comps]);
+        unsigned char *dst = &(region->image->data[i * 4]);
+        // alpha only is white with coverage, luminance alpha is gray with alpha
+        dst[0] = (image->comps >= 3) ? src[0] : (image->comps == 2) ? src[0] : 255;
+        dst[1] = (image->comps >= 3) ? src[1] : (image->comps == 2) ? src[0] : 255;
+        dst[2] = (image->comps >= 3) ? src[2] : (image->comps == 2) ? src[0] : 255;
+        dst[3] = (image->comps == 4) ? src[3] : (image->comps == 2) ? src[1] : (image->comps == 1) ? src[0] : 255;
+    }
+    if (atlas->num_regions == atlas->max_regions)
+    {
+        atlas->max_regions = atlas->max_regions ? atlas->max_regions * 2 : 64;
+        atlas->regions = EXTEND_ARRAY(atlas->regions, atlas->max_regions, BCAtlasRegion *);
+    }
+    atlas->regions[atlas->num_regions++] = region;
+    if (!placeAtlasRegion(atlas, region))
+    {
+        if (getAtlasFragmentation(atlas) > ATLAS_REPACK_THRESHOLD)
+        {
+            // repack places the new region too
+            bcRepackAtlas(atlas);
+            return region;
+        }
+        addAtlasPage(atlas);
+        placeAtlasRegion(atlas, region);
+    }
+    uploadAtlasRegion(atlas, region);
+    return region;
+}
+
+BCAtlasRegion * bcAddAtlasFile(BCAtlas *atlas, const char *filename)
+{
+    BCImage *image = bcCreateImageFromFile(filename);
+    if (image == NULL)
+        return NULL;
+    BCAtlasRegion *region = bcAddAtlasImage(atlas, image);
+    bcDestroyImage(image);
+    return region;
+}
+
+void bcRemoveAtlasRegion(BCAtlas *atlas, BCAtlasRegion *region)
+{
+    for (int i = 0; i < atlas->num_regions; i++)
+    {
+        if (atlas->regions[i] != region)
+            continue;
+        // space is reclaimed by the next repack
+        BCAtlasPage *page = &(((BCAtlasPage *) atlas->pages)[region->page]);
+        page->live_area -= (region->width + atlas->padding * 2) * (region->height + atlas->padding * 2);
+        atlas->regions[i] = atlas->regions[--atlas->num_regions];
+        bcDestroyImage(region->image);
+        free(region);
+        return;
+    }
+    bcLogWarning("Region not in atlas!");
+}
+
+void bcRepackAtlas(BCAtlas *atlas)
+{
+    for (int i = 0; i < atlas->num_pages; i++)
+    {
+        resetAtlasPage(atlas, &(((BCAtlasPage *) atlas->pages)[i]));
+    }
+    // tallest first packs a skyline tightest
+    BCAtlasRegion **sorted = NEW_ARRAY(atlas->num_regions, BCAtlasRegion *);
+    memcpy(sorted, atlas->regions, atlas->num_regions * sizeof(BCAtlasRegion *));
+    qsort(sorted, atlas->num_regions, sizeof(BCAtlasRegion *), compareAtlasRegions);
+    for (int i = 0; i < atlas->num_regions; i++)
+    {
+        if (!placeAtlasRegion(atlas, sorted[i]))
+        {
+            addAtlasPage(atlas);
+            placeAtlasRegion(atlas, sorted[i]);
+        }
+    }
+    free(sorted);
+    // first fit leaves empty pages only at the end, the first one is kept for new regions
+    while (atlas->num_pages > 1 && ((BCAtlasPage *) atlas->pages)[atlas->num_pages - 1].packed_area == 0)
+    {
+        BCAtlasPage *page = &(((BCAtlasPage *) atlas->pages)[--atlas->num_pages]);
+        bcDestroyTexture(page->texture);
+        free(page->nodes);
+    }
+    if (!g_Context->Started)
+        return;
+    for (int i = 0; i < atlas->num_pages; i++)
+    {
+        BCTexture *texture = ((BCAtlasPage *) atlas->pages)[i].texture;
+        releaseMipmaps(texture);
+        deleteTexture(&(texture->id));
+        bcUpdateTexture(texture);
+    }
+}
+
+void bcDrawAtlasRegion2D(BCAtlasRegion *region, float x, float y, float w, float h)
+{
+    bcDrawTexture2D(region->texture, x, y, w, h, region->sx, region->sy, region->sw, region->sh);
+}
+
+//
+// View State
+//
+
+void bcClear(BCColor color)
+{
+    glClearColor(color.r, color.g, color.b, color.a);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    setViewport(0, 0, bcGetDisplayWidth(), bcGetDisplayHeight());
+}
+
+void bcViewport(int x, int y, int width, int height)
+{
+    if (width == 0)
+        width = bcGetDisplayWidth();
+    if (height == 0)
+        height = bcGetDisplayHeight();
+    setViewport(x, bcGetDisplayHeight() - height, width, height);
+}
+
+void bcSetBlend(bool enabled)
+{
+    setCapability(STATE_BLEND, enabled);
+}
+
+void bcSetDepthTest(bool enabled)
+{
+    setCapability(STATE_DEPTH_TEST, enabled);
+}
+
+void bcSetAlphaTest(bool enabled)
+{
+#ifdef SUPPORT_GLSL
+    updateState(DIRTY_ALPHA_TEST, &(g_Context->AlphaTestEnabled), &enabled, sizeof(bool));
+#else
+    if (enabled)
+        glEnable(GL_ALPHA_TEST);
+    else
+        glDisable(GL_ALPHA_TEST);
+    g_Context->AlphaTestEnabled = enabled;
+#endif
+}
+
+void bcSetCulling(bool enabled)
+{
+    setCapability(STATE_CULL_FACE, enabled);
+}
+
+void bcSetWireframe(bool enabled)
+{
+#ifndef SUPPORT_GLES
+    if (enabled)
+        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    else
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+#endif
+}
+
+void bcSetLighting(bool enabled)
+{
+#ifdef SUPPORT_GLSL
+    updateState(DIRTY_LIGHTING, &(g_Context->LightingEnabled), &enabled, sizeof(bool));
+#else
+    if (enabled)
+    {
+        glEnable(GL_LIGHTING);
+        glEnable(GL_LIGHT0);
+    }
+    else
+    {
+        glDisable(GL_LIGHTING);
+    }
+    g_Context->LightingEnabled = enabled;
+#endif
+}
+
+void bcLightPosition(float x, float y, float z)
+{
+#ifdef SUPPORT_GLSL
+    vec3_t pos = vec3(x, y, z);
+    updateState(DIRTY_LIGHT_POSITION, &(g_Context->LightPosition), &pos, sizeof(vec3_t));
+#else
+    // fixed function transforms the light by the current modelview
+    uploadDirtyState();
+    float lightPos[] = { x, y, z, 1 };
+    glLightfv(GL_LIGHT0, GL_POSITION, lightPos);
+#endif
+}
+
+void bcSetProjectionMatrix(float *m)
+{
+    g_Context->FrustumNeedUpdate = true;
+    updateState(DIRTY_PROJECTION_MATRIX, &(g_Context->ProjectionMatrix), m, sizeof(mat4_t));
+}
+
+void bcSetModelViewMatrix(float *m)
+{
+    g_Context->FrustumNeedUpdate = true;
+    updateState(DIRTY_MODELVIEW_MATRIX, &(g_Context->ModelViewMatrix), m, sizeof(mat4_t));
+}
+
+void bcSetTextureMatrix(float *m)
+{
+    updateState(DIRTY_TEXTURE_MATRIX, &(g_Context->TextureMatrix), m, sizeof(mat3_t));
+}
+
+float * bcGetProjectionMatrix()
+{
+    return g_Context->ProjectionMatrix.v;
+}
+
+float * bcGetModelViewMatrix()
+{
+    return g_Context->ModelViewMatrix.v;
+}
+
+float * bcGetTextureMatrix()
+{
+    return g_Context->TextureMatrix.v;
+}
+
+void bcSetScissor(bool enabled)
+{
+    setCapability(STATE_SCISSOR_TEST, enabled);
+}
+
+void bcScissorRect(int x, int y, int w, int h)
+{
+    y = bcGetDisplayHeight() - y - h;
+    setScissor(x, y, w, h);
+}
+
+void bcSetFrustumCulling(bool enabled)
+{
+    g_Context->FrustumCulling = enabled;
+}
+
+void bcSetLODTriangleSize(float pixels)
+{
+    // 0 always draws the full mesh
+    g_Context->LODTriangleSize = pixels;
+}
+
+void bcSetColor(BCColor color, BCColorType type)
+{
+    updateState(DIRTY_COLORS, &(g_Context->ColorArray[type]), &color, sizeof(BCColor));
+}
+
+const BCGfxStats * bcGetGfxStats()
+{
+    return &(g_Context->FrameStats);
+}
+
+void bcSetRestoreBudget(float ms_per_frame)
+{
+    g_Context->RestoreBudget = ms_per_frame;
+}
+
+const BCRestoreStats * bcGetRestoreStats()
+{
+    return &(g_Context->RestoreStats);
+}
+
+//
+// Render Queue
+//
+
+static void captureRenderItem(BCRenderItem *item)
+{
+#ifdef SUPPORT_GLSL
+    item->shader = g_Context->CurrentShader;
+#endif
+    item->texture = g_Context->CurrentTexture;
+    item->projection = g_Context->ProjectionMatrix;
+    item->modelview = g_Context->ModelViewMatrix;
+    item->texture_matrix = g_Context->TextureMatrix;
+    memcpy(item->colors, g_Context->ColorArray, sizeof(item->colors));
+    item->light_position = g_Context->LightPosition;
+    item->lighting = g_Context->LightingEnabled;
+    item->alpha_test = g_Context->AlphaTestEnabled;
+    memcpy(item->caps, g_Context->State.caps, sizeof(item->caps));
+}
+
+static void applyRenderItem(BCRenderItem *item)
+{
+#ifdef SUPPORT_GLSL
+    bcBindShader(item->shader);
+    bcLightPosition(item->light_position.x, item->light_position.y, item->light_position.z);
+#endif
+    bcBindTexture(item->texture);
+    bcSetProjectionMatrix(item->projection.v);
+    bcSetModelViewMatrix(item->modelview.v);
+    bcSetTextureMatrix(item->texture_matrix.v);
+    for (int i = 0; i < BC_COLOR_TYPE_MAX; i++)
+    {
+        bcSetColor(item->colors[i], i);
+    }
+    if (item->lighting != g_Context->LightingEnabled)
+        bcSetLighting(item->lighting);
+    if (item->alpha_test != g_Context->AlphaTestEnabled)
+        bcSetAlphaTest(item->alpha_test);
+    // after lighting, which toggles culling on its own
+    for (int i = 0; i < STATE_CAP_MAX; i++)
+    {
+        if (item->caps[i] != STATE_UNKNOWN)
+            setCapability(i, item->caps[i]);
+    }
+}
+
+static uint64_t getRenderKey(BCRenderItem *item)
+{
+    // eye space distance, positive floats keep their order as integers
+    float c[3] = { 0, 0, 0 };
+    if (item->mesh->has_bounds)
+        memcpy(c, item->mesh->bounds_center, sizeof(c));
+    mat4_t *m = &(item->modelview);
+    float depth = -(m->m20 * c[0] + m->m21 * c[1] + m->m22 * c[2] + m->m23);
+    if (!(depth > 0))
+        depth = 0;
+    uint32_t depth_bits;
+    memcpy(&depth_bits, &depth, sizeof(depth_bits));
+    uint64_t depth_key = depth_bits >> (32 - RENDER_DEPTH_BITS);
+    uint64_t shader_key = 0;
+#ifdef SUPPORT_GLSL
+    shader_key = item->shader->programId & ((1 << RENDER_SHADER_BITS) - 1);
+#endif
+    uint64_t texture_key = (item->texture ? item->texture->id : 0) & ((1 << RENDER_TEXTURE_BITS) - 1);
+    // shared meshes sort by arena, those draws skip the rebind
+    uint64_t mesh_key = (item->mesh->type == BC_MESH_SHARED) ? (uint64_t) (item->mesh->arena + 1) :
+        ((uintptr_t) item->mesh / sizeof(BCMesh)) & ((1 << RENDER_MESH_BITS) - 1);
+    int layer = g_Context->RenderLayer;
+    layer = (layer < 0) ? 0 : (layer >= (1 << RENDER_LAYER_BITS)) ? (1 << RENDER_LAYER_BITS) - 1 : layer;
+    uint64_t key = (uint64_t) layer << 60;
+    if (g_Context->RenderTranslucent)
+    {
+        // back to front, state only breaks ties
+        key |= (uint64_t) 1 << 59;
+        key |= (((1 << RENDER_DEPTH_BITS) - 1) - depth_key) << 35;
+        key |= shader_key << 25;
+        key |= texture_key << 13;
+        key |= mesh_key;
+    }
+    else
+    {
+        // fewest switches first, then front to back
+        key |= shader_key << 49;
+        key |= texture_key << 37;
+        key |= mesh_key << 24;
+        key |= depth_key;
+    }
+    return key;
+}
+
+static void queueRenderItem(BCMesh *mesh, int start, int count)
+{
+    if (g_Context->RenderQueueCount == g_Context->RenderQueueCapacity)
+    {
+        g_Context->RenderQueueCapacity = g_Context->RenderQueueCapacity ? g_Context->RenderQueueCapacity * 2 : 256;
+        g_Context->RenderQueue = EXTEND_ARRAY(g_Context->RenderQueue, g_Context->RenderQueueCapacity, BCRenderItem);
+        // second half is the radix sort scratch
+        g_Context->RenderKeys = EXTEND_ARRAY(g_Context->RenderKeys, g_Context->RenderQueueCapacity * 2, BCRenderKey);
+    }
+    int index = g_Context->RenderQueueCount++;
+    BCRenderItem *item = &(g_Context->RenderQueue[index]);
+    item->mesh = mesh;
+    item->start = start;
+    item->count = count;
+    captureRenderItem(item);
+    g_Context->RenderKeys[index].key = getRenderKey(item);
+    g_Context->RenderKeys[index].index = index;
+}
+
+static BCRenderKey * sortRenderKeys(BCRenderKey *keys, BCRenderKey *temp, int n)
+{
+    // LSD radix sort, stable so equal keys keep submission order
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        int counts[256] = { 0 };
+        for (int i = 0; i < n; i++)
+            counts[(keys[i].key >> shift) & 0xff]++;
+        if (counts[(keys[0].key >> shift) & 0xff] == n)
+            continue;
+        int offset = 0;
+        for (int i = 0; i < 256; i++)
+        {
+            int c = counts[i];
+            counts[i] = offset;
+            offset += c;
+        }
+        for (int i = 0; i < n; i++)
+            temp[counts[(keys[i].key >> shift) & 0xff]++] = keys[i];
+        BCRenderKey *swap = keys;
+        keys = temp;
+        temp = swap;
+    }
+    return keys;
+}
+
+void bcBeginRenderQueue()
+{
+    if (g_Context->RenderQueueActive)
+    {
+        bcLogWarning("Render queue already started!");
+        return;
+    }
+    g_Context->RenderQueueActive = true;
+    g_Context->RenderQueueCount = 0;
+    g_Context->RenderLayer = 0;
+    g_Context->RenderTranslucent = false;
+}
+
+void bcSetRenderLayer(int layer, bool translucent)
+{
+    g_Context->RenderLayer = layer;
+    g_Context->RenderTranslucent = translucent;
+}
+
+void bcEndRenderQueue()
+{
+    if (!g_Context->RenderQueueActive)
+    {
+        bcLogWarning("Render queue not started!");
+        return;
+    }
+    g_Context->RenderQueueActive = false;
+    int n = g_Context->RenderQueueCount;
+    if (n == 0)
+        return;
+    BCRenderItem current;
+    captureRenderItem(&current);
+    BCRenderKey *keys = sortRenderKeys(g_Context->RenderKeys, g_Context->RenderKeys + g_Context->RenderQueueCapacity, n);
+    for (int i = 0; i < n; i++)
+    {
+        BCRenderItem *item = &(g_Context->RenderQueue[keys[i].index]);
+        applyRenderItem(item);
+        bcDrawMeshRange(item->mesh, item->start, item->count);
+    }
+    // leave the app state as it was before the flush
+    applyRenderItem(&current);
+    g_Context->RenderQueueCount = 0;
+}
+
+//
+// Command Buffer
+//
+
+// Recording touches only the buffer, so any thread can record into its own
+// buffer while the GL thread is busy. Memory is kept across resets.
+
+BCCommandBuffer * bcCreateCommandBuffer()
+{
+    return NEW_OBJECT(BCCommandBuffer);
+}
+
+void bcDestroyCommandBuffer(BCCommandBuffer *buffer)
+{
+    if (buffer == NULL)
+        return;
+    free(buffer->commands);
+    free(buffer->data);
+    free(buffer);
+}
+
+void bcResetCommandBuffer(BCCommandBuffer *buffer)
+{
+    buffer->num_commands = 0;
+    buffer->num_data = 0;
+}
+
+static BCCommand * addCommand(BCCommandBuffer *buffer, BCCommandType type)
+{
+    if (buffer->num_commands == buffer->max_commands)
+    {
+        buffer->max_commands = buffer->max_commands ? buffer->max_commands * 2 : 256;
+        buffer->commands = EXTEND_ARRAY(buffer->commands, buffer->max_commands, BCCommand);
+    }
+    BCCommand *cmd = &(((BCCommand *) buffer->commands)[buffer->num_commands++]);
+    cmd->type = type;
+    return cmd;
+}
+
+static int addCommandData(BCCommandBuffer *buffer, const float *data, int size)
+{
+    if (buffer->num_data + size > buffer->max_data)
+    {
+        while (buffer->num_data + size > buffer->max_data)
+            buffer->max_data = buffer->max_data ? buffer->max_data * 2 : 1024;
+        buffer->data = EXTEND_ARRAY(buffer->data, buffer->max_data, float);
+    }
+    int offset = buffer->num_data;
+    memcpy(buffer->data + offset, data, size * sizeof(float));
+    buffer->num_data += size;
+    return offset;
+}
+
+void bcCmdBindShader(BCCommandBuffer *buffer, BCShader *shader)
+{
+    addCommand(buffer, BC_CMD_BIND_SHADER)->object = shader;
+}
+
+void bcCmdBindTexture(BCCommandBuffer *buffer, BCTexture *texture)
+{
+    addCommand(buffer, BC_CMD_BIND_TEXTURE)->object = texture;
+}
+
+void bcCmdSetBlend(BCCommandBuffer *buffer, bool enabled)
+{
+    addCommand(buffer, BC_CMD_SET_BLEND)->enabled = enabled;
+}
+
+void bcCmdSetDepthTest(BCCommandBuffer *buffer, bool enabled)
+{
+    addCommand(buffer, BC_CMD_SET_DEPTH_TEST)->enabled = enabled;
+}
+
+void bcCmdSetAlphaTest(BCCommandBuffer *buffer, bool enabled)
+{
+    addCommand(buffer, BC_CMD_SET_ALPHA_TEST)->enabled = enabled;
+}
+
+void bcCmdSetCulling(BCCommandBuffer *buffer, bool enabled)
+{
+    addCommand(buffer, BC_CMD_SET_CULLING)->enabled = enabled;
+}
+
+void bcCmdSetLighting(BCCommandBuffer *buffer, bool enabled)
+{
+    addCommand(buffer, BC_CMD_SET_LIGHTING)->enabled = enabled;
+}
+
+void bcCmdSetColor(BCCommandBuffer *buffer, BCColor color, BCColorType type)
+{
+    BCCommand *cmd = addCommand(buffer, BC_CMD_SET_COLOR);
+    cmd->color.value = color;
+    cmd->color.type = type;
+}
+
+void bcCmdSetProjectionMatrix(BCCommandBuffer *buffer, const float *m)
+{
+    int offset = addCommandData(buffer, m, 16);
+    addCommand(buffer, BC_CMD_SET_PROJECTION_MATRIX)->offset = offset;
+}
+
+void bcCmdSetModelViewMatrix(BCCommandBuffer *buffer, const float *m)
+{
+    int offset = addCommandData(buffer, m, 16);
+    addCommand(buffer, BC_CMD_SET_MODELVIEW_MATRIX)->offset = offset;
+}
+
+void bcCmdDrawMesh(BCCommandBuffer *buffer, BCMesh *mesh)
+{
+    // count, culling and LOD are resolved on the GL thread
+    BCCommand *cmd = addCommand(buffer, BC_CMD_DRAW_MESH);
+    cmd->draw.mesh = mesh;
+    cmd->draw.start = 0;
+    cmd->draw.count = 0;
+}
+
+void bcCmdDrawMeshRange(BCCommandBuffer *buffer, BCMesh *mesh, int start, int count)
+{
+    BCCommand *cmd = addCommand(buffer, BC_CMD_DRAW_MESH_RANGE);
+    cmd->draw.mesh = mesh;
+    cmd->draw.start = start;
+    cmd->draw.count = count;
+}
+
+void bcCmdBegin(BCCommandBuffer *buffer, BCDrawMode mode)
+{
+    addCommand(buffer, BC_CMD_BEGIN)->mode = mode;
+}
+
+void bcCmdEnd(BCCommandBuffer *buffer)
+{
+    addCommand(buffer, BC_CMD_END);
+}
+
+static void addVertexCommand(BCCommandBuffer *buffer, BCCommandType type, float x, float y, float z, float w)
+{
+    BCCommand *cmd = addCommand(buffer, type);
+    cmd->v[0] = x;
+    cmd->v[1] = y;
+    cmd->v[2] = z;
+    cmd->v[3] = w;
+}
+
+void bcCmdVertex3f(BCCommandBuffer *buffer, float x, float y, float z)
+{
+    addVertexCommand(buffer, BC_CMD_VERTEX, x, y, z, 0);
+}
+
+void bcCmdTexCoord2f(BCCommandBuffer *buffer, float u, float v)
+{
+    addVertexCommand(buffer, BC_CMD_TEXCOORD, u, v, 0, 0);
+}
+
+void bcCmdNormal3f(BCCommandBuffer *buffer, float x, float y, float z)
+{
+    addVertexCommand(buffer, BC_CMD_NORMAL, x, y, z, 0);
+}
+
+void bcCmdColor4f(BCCommandBuffer *buffer, float r, float g, float b, float a)
+{
+    addVertexCommand(buffer, BC_CMD_COLOR, r, g, b, a);
+}
+
+static void executeCommandBuffer(BCCommandBuffer *buffer)
+{
+    BCCommand *commands = (BCCommand *) buffer->commands;
+    for (int i = 0; i < buffer->num_commands; i++)
+    {
+        BCCommand *cmd = &commands[i];
+        switch (cmd->type)
+        {
+        case BC_CMD_BIND_SHADER:
+#ifdef SUPPORT_GLSL
+            bcBindShader((BCShader *) cmd->object);
+#endif
+            break;
+        case BC_CMD_BIND_TEXTURE:
+            bcBindTexture((BCTexture *) cmd->object);
+            break;
+        case BC_CMD_SET_BLEND:
+            bcSetBlend(cmd->enabled);
+            break;
+        case BC_CMD_SET_DEPTH_TEST:
+            bcSetDepthTest(cmd->enabled);
+            break;
+        case BC_CMD_SET_ALPHA_TEST:
+            bcSetAlphaTest(cmd->enabled);
+            break;
+        case BC_CMD_SET_CULLING:
+            bcSetCulling(cmd->enabled);
+            break;
+        case BC_CMD_SET_LIGHTING:
+            bcSetLighting(cmd->enabled);
+            break;
+        case BC_CMD_SET_COLOR:
+            bcSetColor(cmd->color.value, cmd->color.type);
+            break;
+        case BC_CMD_SET_PROJECTION_MATRIX:
+            bcSetProjectionMatrix(buffer->data + cmd->offset);
+            break;
+        case BC_CMD_SET_MODELVIEW_MATRIX:
+            bcSetModelViewMatrix(buffer->data + cmd->offset);
+            break;
+        case BC_CMD_DRAW_MESH:
+            bcDrawMesh(cmd->draw.mesh);
+            break;
+        case BC_CMD_DRAW_MESH_RANGE:
+            bcDrawMeshRange(cmd->draw.mesh, cmd->draw.start, cmd->draw.count);
+            break;
+        case BC_CMD_BEGIN:
+            bcBegin(cmd->mode);
+            break;
+        case BC_CMD_END:
+            bcEnd();
+            break;
+        case BC_CMD_VERTEX:
+            bcVertex3f(cmd->v[0], cmd->v[1], cmd->v[2]);
+            break;
+        case BC_CMD_TEXCOORD:
+            bcTexCoord2f(cmd->v[0], cmd->v[1]);
+            break;
+        case BC_CMD_NORMAL:
+            bcNormal3f(cmd->v[0], cmd->v[1], cmd->v[2]);
+            break;
+        case BC_CMD_COLOR:
+            bcColor4f(cmd->v[0], cmd->v[1], cmd->v[2], cmd->v[3]);
+            break;
+        }
+    }
+}
+
+void bcExecuteCommandBuffers(BCCommandBuffer **buffers, int count)
+{
+    // matrices belong to the caller's stack, restore them after replay
+    mat4_t projection = g_Context->ProjectionMatrix;
+    mat4_t modelview = g_Context->ModelViewMatrix;
+    for (int i = 0; i < count; i++)
+    {
+        if (buffers[i])
+            executeCommandBuffer(buffers[i]);
+    }
+    bcSetProjectionMatrix(projection.v);
+    bcSetModelViewMatrix(modelview.v);
+}
+
+//
+// Mesh
+//
+
+static void updateMeshBounds(BCMesh *mesh, const float *vertices, int num_vertices)
+{
+    int pos_comps = mesh->comps[BC_VERTEX_ATTR_POSITIONS];
+    mesh->has_bounds = (vertices && num_vertices > 0 && pos_comps > 0);
+    if (!mesh->has_bounds)
+        return;
+    for (int j = 0; j < 3; j++)
+    {
+        mesh->bounds_min[j] = (j < pos_comps) ? vertices[j] : 0;
+        mesh->bounds_max[j] = mesh->bounds_min[j];
+    }
+    for (int i = 1; i < num_vertices; i++)
+    {
+        const float *v = vertices + i * mesh->total_comps;
+        for (int j = 0; j < pos_comps && j < 3; j++)
+        {
+            mesh->bounds_min[j] = fminf(mesh->bounds_min[j], v[j]);
+            mesh->bounds_max[j] = fmaxf(mesh->bounds_max[j], v[j]);
+        }
+    }
+    // sphere around the box center, tighter than the half diagonal
+    float radius_sq = 0;
+    for (int j = 0; j < 3; j++)
+        mesh->bounds_center[j] = (mesh->bounds_min[j] + mesh->bounds_max[j]) * 0.5f;
+    for (int i = 0; i < num_vertices; i++)
+    {
+        const float *v = vertices + i * mesh->total_comps;
+        float d_sq = 0;
+        for (int j = 0; j < pos_comps && j < 3; j++)
+            d_sq += (v[j] - mesh->bounds_center[j]) * (v[j] - mesh->bounds_center[j]);
+        radius_sq = fmaxf(radius_sq, d_sq);
+    }
+    mesh->bounds_radius = sqrtf(radius_sq);
+}
+
+static void expandMeshBounds(BCMesh *mesh, const BCMeshRange *ranges, int num_ranges)
+{
+    // grow only, bounds stay conservative without a full pass
+    int pos_comps = mesh->comps[BC_VERTEX_ATTR_POSITIONS];
+    float radius_sq = mesh->bounds_radius * mesh->bounds_radius;
+    for (int r = 0; r < num_ranges; r++)
+    {
+        for (int i = ranges[r].first; i < ranges[r].first + ranges[r].count; i++)
+        {
+            const float *v = mesh->vertices + i * mesh->total_comps;
+            float d_sq = 0;
+            for (int j = 0; j < pos_comps && j < 3; j++)
+            {
+                mesh->bounds_min[j] = fminf(mesh->bounds_min[j], v[j]);
+                mesh->bounds_max[j] = fmaxf(mesh->bounds_max[j], v[j]);
+                d_sq += (v[j] - mesh->bounds_center[j]) * (v[j] - mesh->bounds_center[j]);
+            }
+            radius_sq = fmaxf(radius_sq, d_sq);
+        }
+    }
+    mesh->bounds_radius = sqrtf(radius_sq);
+}
+
+unsigned int bcGetMeshIndex(const BCMesh *mesh, int i)
+{
+    return (mesh->index_size == 4) ? ((const uint32_t *) mesh->indices)[i] : ((const uint16_t *) mesh->indices)[i];
+}
+
+void bcSetMeshIndex(BCMesh *mesh, int i, unsigned int value)
+{
+    if (mesh->index_size == 4)
+        ((uint32_t *) mesh->indices)[i] = value;
+    else
+        ((uint16_t *) mesh->indices)[i] = (uint16_t) value;
+}
+
+static void resizeMeshIndices(BCMesh *mesh, int count)
+{
+    if (mesh->index_size == 4)
+        mesh->indices = EXTEND_ARRAY((uint32_t *) mesh->indices, count, uint32_t);
+    else
+        mesh->indices = EXTEND_ARRAY((uint16_t *) mesh->indices, count, uint16_t);
+}
+
+static void copyIndices(void *dst, int dst_size, const void *src, int src_size, int count)
+{
+    if (dst_size == src_size)
+    {
+        memcpy(dst, src, count * src_size);
+    }
+    else if (dst_size == 4)
+    {
+        for (int i = 0; i < count; i++)
+            ((uint32_t *) dst)[i] = ((const uint16_t *) src)[i];
+    }
+    else
+    {
+        for (int i = 0; i < count; i++)
+            ((uint16_t *) dst)[i] = ((const uint32_t *) src)[i];
+    }
+}
+
+// GLES2 needs OES_element_index_uint, only known once the context started
+static bool checkIndexSupport(int index_size)
+{
+    if (index_size == 4 && g_Context->Started && !g_Context->Ext.ElementIndexUint)
+    {
+        bcLogError("32-bit indices are not supported!");
+        return false;
+    }
+    return true;
+}
+
+static GLenum getIndexType(const BCMesh *mesh)
+{
+    return (mesh->index_size == 4) ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+}
+
+static int getFormatComps(int format, int *comps)
+{
+    memset(comps, 0, BC_VERTEX_ATTR_MAX * sizeof(int));
+    comps[BC_VERTEX_ATTR_POSITIONS] =
+        (format & BC_MESH_POS2) ? 2 :
+        (format & BC_MESH_POS3) ? 3 :
+        (format & BC_MESH_POS4) ? 4 :
+        0;
+    comps[BC_VERTEX_ATTR_TEXCOORDS] =
+        (format & BC_MESH_TEX2) ? 2 :
+        (format & BC_MESH_TEX3) ? 3 :
+        0;
+    comps[BC_VERTEX_ATTR_NORMALS] =
+        (format & BC_MESH_NORM) ? 3 :
+        0;
+    comps[BC_VERTEX_ATTR_COLORS] =
+        (format & BC_MESH_COL1) ? 1 :
+        (format & BC_MESH_COL3) ? 3 :
+        (format & BC_MESH_COL4) ? 4 :
+        0;
+    int total_comps = 0;
+    for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
+    {
+        total_comps += comps[i];
+    }
+    return total_comps;
+}
+
+static BCMesh * createMesh(int format, const float *vert_data, int vert_num, const void *indx_data, int indx_size, int indx_num, BCMeshType type)
+{
+    if (type == BC_MESH_OPTIMIZED && !vert_data)
+    {
+        bcLogError("BC_MESH_OPTIMIZED must have data!");
+        return NULL;
+    }
+    if (indx_num && !checkIndexSupport((vert_num > INDEX16_MAX_VERTICES) ? 4 : 2))
+    {
+        return NULL;
+    }
+    BCMesh *mesh = NEW_OBJECT(BCMesh);
+    mesh->num_vertices = vert_num;
+    mesh->num_indices = indx_num;
+    mesh->format = format;
+    mesh->type = type;
+    mesh->arena = -1;
+    mesh->lod_frame = -1;
+    // small meshes keep the compact index format
+    mesh->index_size = (vert_num > INDEX16_MAX_VERTICES) ? 4 : 2;
+    // calculate components
+    mesh->total_comps = getFormatComps(format, mesh->comps);
+    updateVertexLayout(mesh);
+    if (type != BC_MESH_STREAM)
+    {
+        updateMeshBounds(mesh, vert_data, vert_num);
+    }
+    if (mesh->type == BC_MESH_OPTIMIZED)
+    {
+        // init VBOs
+        if (mesh->num_vertices)
+        {
+            glGenBuffers(1, &(mesh->vbo_vertices));
+            bindBuffer(GL_ARRAY_BUFFER, mesh->vbo_vertices);
+            glBufferData(GL_ARRAY_BUFFER, mesh->num_vertices * mesh->stride,
+                packVertexData(mesh, vert_data, 0, mesh->num_vertices), GL_STATIC_DRAW);
+        }
+        // init vbo_indices
+        if (mesh->num_indices)
+        {
+            void *converted = NULL;
+            if (indx_data && indx_size != mesh->index_size)
+            {
+                converted = malloc(mesh->num_indices * mesh->index_size);
+                copyIndices(converted, mesh->index_size, indx_data, indx_size, mesh->num_indices);
+            }
+            glGenBuffers(1, &(mesh->vbo_indices));
+            bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo_indices);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->num_indices * mesh->index_size, converted ? converted : indx_data, GL_STATIC_DRAW);
+            free(converted);
+        }
+    }
+    else
+    {
+        // allocate vertex and index data holders
+        if (mesh->num_vertices)
+        {
+            mesh->vertices = NEW_ARRAY(mesh->num_vertices * mesh->total_comps, float);
+            if (vert_data)
+                memcpy(mesh->vertices, vert_data, mesh->num_vertices * mesh->total_comps * sizeof(float));
+        }
+        if (mesh->num_indices)
+        {
+            mesh->indices = malloc((size_t) mesh->num_indices * mesh->index_size);
+            if (indx_data)
+                copyIndices(mesh->indices, mesh->index_size, indx_data, indx_size, mesh->num_indices);
+        }
+        // update VBOs
+        if (g_Context->Started && (vert_data || indx_data))
+        {
+            bcUpdateMesh(mesh);
+        }
+    }
+    // draw params
+    mesh->draw_mode = GL_TRIANGLES;
+    mesh->draw_count = (mesh->num_indices > 0) ? mesh->num_indices : mesh->num_vertices;
+    mesh->RM_handle = addRegistryObject(&(g_Context->RM[RM_TYPE_MESH]), mesh);
+    return mesh;
+}
+
+BCMesh * bcCreateMesh(int format, const float *vert_data, int vert_num, const uint16_t *indx_data, int indx_num, BCMeshType type)
+{
+    return createMesh(format, vert_data, vert_num, indx_data, sizeof(uint16_t), indx_num, type);
+}
+
+BCMesh * bcCreateMesh32(int format, const float *vert_data, int vert_num, const uint32_t *indx_data, int indx_num, BCMeshType type)
+{
+    return createMesh(format, vert_data, vert_num, indx_data, sizeof(uint32_t), indx_num, type);
+}
+
+BCMesh * bcCopyMesh(BCMesh *src)
+{
+    if (src == NULL)
+    {
+        bcLogError("Invalid mesh!");
+        return NULL;
+    }
+    BCMesh *mesh = createMesh(src->format, src->vertices, src->num_vertices, src->indices, src->index_size, src->num_indices, src->type);
+    if (src->num_vertices)
+    {
+        memcpy(mesh->vertices, src->vertices, src->num_vertices * src->total_comps * sizeof(float));
+    }
+    if (src->num_indices)
+    {
+        memcpy(mesh->indices, src->indices, src->num_indices * src->index_size);
+    }
+    memcpy(mesh->lods, src->lods, sizeof(mesh->lods));
+    mesh->num_lods = src->num_lods;
+    if (src->num_parts)
+    {
+        mesh->parts = NEW_ARRAY(src->num_parts, BCMeshRange);
+        memcpy(mesh->parts, src->parts, src->num_parts * sizeof(BCMeshRange));
+        mesh->num_parts = src->num_parts;
     }
-    // fragment shader
-    shader->fs_id = bcLoadShader(shader->fs_code, GL_FRAGMENT_SHADER);
-    if (shader->fs_id == 0)
+    mesh->draw_count = src->draw_count;
+    return mesh;
+}
+
+static void releaseVertexArray(BCMesh *mesh)
+{
+    if (mesh->vao)
     {
-        return false;
+        deleteVertexArray(&(mesh->vao));
     }
-    // create program
-    shader->programId = glCreateProgram();
-    if (shader->programId == 0)
+    // attribute setup points at buffers that are about to change
+    if (g_Context->CurrentMesh == mesh)
     {
-        bcLogError("Error creating shader program!");
-        return false;
+        g_Context->CurrentMesh = NULL;
     }
-    glAttachShader(shader->programId, shader->vs_id);
-    glAttachShader(shader->programId, shader->fs_id);
-    // bind attributes
-    for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
+}
+
+static void streamMesh(BCMesh *mesh, int num_vertices, int num_indices)
+{
+    // append written data to the shared stream buffers
+    if (num_vertices)
     {
-        glBindAttribLocation(shader->programId, i, s_DefaultShaderAttributes[i].name);
+        mesh->vbo_offset = streamData(&(g_Context->StreamVertices), GL_ARRAY_BUFFER,
+            mesh->vertices, num_vertices * mesh->total_comps * sizeof(float));
+        mesh->vbo_vertices = g_Context->StreamVertices.id;
     }
-    if (!bcLinkShaderProgram(shader->programId))
+    if (num_indices)
     {
-        return false;
+        mesh->ibo_offset = streamData(&(g_Context->StreamIndices), GL_ELEMENT_ARRAY_BUFFER,
+            mesh->indices, num_indices * mesh->index_size);
+        mesh->vbo_indices = g_Context->StreamIndices.id;
     }
-    // get uniforms
-    for (int i = 0; i < BC_SHADER_UNIFORM_MAX; i++)
+    mesh->stream_vertices = num_vertices;
+    mesh->stream_indices = num_indices;
+    mesh->stream_generation = g_Context->StreamGeneration;
+    // buffers stay bound, only attribute offsets need to be updated
+    if (g_Context->CurrentMesh == mesh)
     {
-        shader->loc_uniforms[i] = glGetUniformLocation(shader->programId, s_DefaultShaderUniforms[i].name);
-        if (shader->loc_uniforms[i] == -1)
-            bcLogWarning("Shader uniform '%s' not found!", s_DefaultShaderUniforms[i].name);
+        g_Context->CurrentMesh = NULL;
     }
-    return shader;
 }
 
+static void refreshStreamMesh(BCMesh *mesh)
+{
+    // the ring wrapped or was released since the mesh was streamed
+    if (mesh->type == BC_MESH_STREAM && mesh->stream_generation != g_Context->StreamGeneration)
+    {
+        streamMesh(mesh, mesh->stream_vertices, mesh->stream_indices);
+    }
+}
 
-void bcReleaseShader(BCShader *shader)
+static void markDirtyRange(BCMeshRange *ranges, int *num_ranges, int first, int count, int limit)
 {
-    if (!shader)
+    if (first < 0)
     {
-        bcLogError("Invalid shader!");
+        count += first;
+        first = 0;
+    }
+    if (first + count > limit)
+        count = limit - first;
+    if (count <= 0)
         return;
+    // insert sorted by first
+    BCMeshRange list[BC_MESH_DIRTY_RANGES + 1];
+    int n = 0;
+    int i = 0;
+    while (i < *num_ranges && ranges[i].first <= first)
+        list[n++] = ranges[i++];
+    list[n].first = first;
+    list[n++].count = count;
+    while (i < *num_ranges)
+        list[n++] = ranges[i++];
+    // coalesce overlapping and nearby spans
+    int last = 0;
+    for (i = 1; i < n; i++)
+    {
+        int end = list[last].first + list[last].count;
+        if (list[i].first <= end + MESH_DIRTY_GAP)
+        {
+            int i_end = list[i].first + list[i].count;
+            list[last].count = ((i_end > end) ? i_end : end) - list[last].first;
+        }
+        else
+        {
+            list[++last] = list[i];
+        }
     }
-    if (shader->vs_id)
-        glDeleteShader(shader->vs_id);
-    if (shader->fs_id)
-        glDeleteShader(shader->fs_id);
-    glDeleteProgram(shader->programId);
+    n = last + 1;
+    // out of slots, join the closest pair
+    if (n > BC_MESH_DIRTY_RANGES)
+    {
+        int best = 0;
+        int best_gap = list[1].first - (list[0].first + list[0].count);
+        for (i = 1; i < n - 1; i++)
+        {
+            int gap = list[i + 1].first - (list[i].first + list[i].count);
+            if (gap < best_gap)
+            {
+                best = i;
+                best_gap = gap;
+            }
+        }
+        list[best].count = list[best + 1].first + list[best + 1].count - list[best].first;
+        memmove(list + best + 1, list + best + 2, (n - best - 2) * sizeof(BCMeshRange));
+        n--;
+    }
+    memcpy(ranges, list, n * sizeof(BCMeshRange));
+    *num_ranges = n;
 }
 
-void bcDestroyShader(BCShader *shader)
+void bcMarkMeshDirty(BCMesh *mesh, int first, int count)
 {
-    if (!shader)
+    if (mesh == NULL)
     {
-        bcLogError("Invalid shader!");
+        bcLogError("Invalid mesh!");
         return;
     }
-    bcReleaseShader(shader);
-    free(shader->vs_code);
-    free(shader->fs_code);
-    free(shader);
-    clist_delete_node(g_Context->RM_list, shader);
+    markDirtyRange(mesh->dirty_vertices, &(mesh->num_dirty_vertices), first, count, mesh->num_vertices);
 }
 
-void bcBindShader(BCShader *shader)
+void bcMarkMeshIndicesDirty(BCMesh *mesh, int first, int count)
 {
-    if (shader == NULL)
-        shader = g_Context->DefaultShader;
-    g_Context->CurrentShader = shader;
-    glUseProgram(shader->programId);
-    // applyProjectionMatrix();
-    // applyCurrentMatrix();
+    if (mesh == NULL)
+    {
+        bcLogError("Invalid mesh!");
+        return;
+    }
+    markDirtyRange(mesh->dirty_indices, &(mesh->num_dirty_indices), first, count, mesh->num_indices);
 }
 
-unsigned int bcLoadShader(const char *code, unsigned int shaderType)
+static const void * getUploadData(BCMesh *mesh, GLenum target, int first, int count)
 {
-    const char *type_str = (shaderType == GL_VERTEX_SHADER) ? "VERTEX" : "FRAGMENT";
-    // generated code
-    char generated_code[2000];
-    char sline[200];
-    // defines
-    sprintf(generated_code, "#define %s\n", type_str);
-    for (int i = 0; s_DefaultShaderConstInts[i].name; i++)
+    if (target == GL_ELEMENT_ARRAY_BUFFER)
+        return (const char *) mesh->indices + first * mesh->index_size;
+    return packVertexData(mesh, mesh->vertices, first, count);
+}
+
+static void uploadDirtyRanges(BCMesh *mesh, GLenum target, const BCMeshRange *ranges, int num_ranges)
+{
+    int elem_size = (target == GL_ARRAY_BUFFER) ? mesh->stride : mesh->index_size;
+    int total = (target == GL_ARRAY_BUFFER) ? mesh->num_vertices : mesh->num_indices;
+    int dirty = 0;
+    for (int i = 0; i < num_ranges; i++)
+        dirty += ranges[i].count;
+    if (dirty * 2 > total)
+    {
+        // mostly rewritten, orphan instead of syncing with pending draws
+        glBufferData(target, total * elem_size, getUploadData(mesh, target, 0, total), GL_DYNAMIC_DRAW);
+        return;
+    }
+    for (int i = 0; i < num_ranges; i++)
     {
-        sprintf(sline, "#define %s %d\n", s_DefaultShaderConstInts[i].name, s_DefaultShaderConstInts[i].value);
-        strcat(generated_code, sline);
+        glBufferSubData(target, ranges[i].first * elem_size, ranges[i].count * elem_size,
+            getUploadData(mesh, target, ranges[i].first, ranges[i].count));
     }
-    // attributes
-    if (shaderType == GL_VERTEX_SHADER)
+}
+
+static void updateMesh(BCMesh *mesh, bool bounds)
+{
+    if (mesh == NULL)
     {
-        for (int i = 0; s_DefaultShaderAttributes[i].name; i++)
-        {
-            sprintf(sline, "attribute %s %s;\n", s_DefaultShaderAttributes[i].type, s_DefaultShaderAttributes[i].name);
-            strcat(generated_code, sline);
-        }
+        bcLogError("Invalid mesh!");
+        return;
     }
-    // uniforms
-    for (int i = 0; s_DefaultShaderUniforms[i].name; i++)
+    if (mesh->type == BC_MESH_OPTIMIZED)
     {
-        if (s_DefaultShaderUniforms[i].size > 1)
-            sprintf(sline, "uniform %s %s[%d];\n", s_DefaultShaderUniforms[i].type, s_DefaultShaderUniforms[i].name, s_DefaultShaderUniforms[i].size);
+        bcLogWarning("Can't update BC_MESH_OPTIMIZED");
+        return;
+    }
+    if (mesh->type == BC_MESH_NO_VBO)
+    {
+        bcLogWarning("Can't update BC_MESH_NO_VBO");
+        return;
+    }
+    if (mesh->type == BC_MESH_STREAM)
+    {
+        streamMesh(mesh, mesh->num_vertices, mesh->num_indices);
+        return;
+    }
+    mesh->RM_pending = false;
+    // once anything is marked, unmarked data is known to be clean
+    int num_dirty_vertices = mesh->num_dirty_vertices;
+    int num_dirty_indices = mesh->num_dirty_indices;
+    bool partial = (num_dirty_vertices > 0 || num_dirty_indices > 0);
+    mesh->num_dirty_vertices = 0;
+    mesh->num_dirty_indices = 0;
+    // bcEndMesh computes them over the written range instead
+    if (bounds)
+    {
+        if (partial && mesh->has_bounds)
+            expandMeshBounds(mesh, mesh->dirty_vertices, num_dirty_vertices);
         else
-            sprintf(sline, "uniform %s %s;\n", s_DefaultShaderUniforms[i].type, s_DefaultShaderUniforms[i].name);
-        strcat(generated_code, sline);
+            updateMeshBounds(mesh, mesh->vertices, mesh->num_vertices);
     }
-    // varyings
-    for (int i = 0; s_DefaultShaderVars[i].name; i++)
+    // supported attribute types may differ after a restart
+    updateVertexLayout(mesh);
+    if (mesh->type == BC_MESH_SHARED && updateSharedMesh(mesh))
     {
-        sprintf(sline, "varying %s %s;\n", s_DefaultShaderVars[i].type, s_DefaultShaderVars[i].name);
-        strcat(generated_code, sline);
+        return;
     }
-    // init shader source
-    const char *strings[3] = { GLSL_VERSION,  generated_code, code };
-    int lengths[3] = { (int) strlen(GLSL_VERSION), (int) strlen(generated_code), (int) strlen(code) };
-#if DEBUG_SHADER
-    // print shader code
-    printf("\n>>> SHADER type=%d <<<\n%s%s%s\n>>> END <<<\n", strings[0], strings[1], strings[2]);
-#endif
-    // create and compile
-    GLuint shaderId = glCreateShader(shaderType);
-    if (shaderId == 0)
+    if (mesh->type == BC_MESH_STATIC)
     {
-        bcLogError("glCreateShader failed!");
-        return 0;
+        releaseVertexArray(mesh);
+        if (mesh->vbo_vertices)
+        {
+            deleteBuffer(&(mesh->vbo_vertices));
+        }
+        if (mesh->vbo_indices)
+        {
+            deleteBuffer(&(mesh->vbo_indices));
+        }
     }
-    glShaderSource(shaderId, 3, strings, lengths);
-    glCompileShader(shaderId);
-    GLint compileError = 0;
-    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &compileError);
-    // parse error log
-    char errorLog[2000];
-    GLsizei errorLen = 0;
-    glGetShaderInfoLog(shaderId, 2000, &errorLen, errorLog);
-    if (errorLen)
+    if (mesh->num_vertices)
     {
-        if (compileError == GL_FALSE)
+        if (mesh->vbo_vertices)
         {
-            bcLogError("Compile %s shader:\n%s", type_str, errorLog);
+            bindBuffer(GL_ARRAY_BUFFER, mesh->vbo_vertices);
+            if (partial)
+                uploadDirtyRanges(mesh, GL_ARRAY_BUFFER, mesh->dirty_vertices, num_dirty_vertices);
+            else
+                glBufferSubData(GL_ARRAY_BUFFER, 0, mesh->num_vertices * mesh->stride,
+                    packVertexData(mesh, mesh->vertices, 0, mesh->num_vertices));
         }
         else
         {
-            bcLogWarning("Compile %s shader:\n%s", type_str, errorLog);
+            releaseVertexArray(mesh);
+            glGenBuffers(1, &(mesh->vbo_vertices));
+            bindBuffer(GL_ARRAY_BUFFER, mesh->vbo_vertices);
+            glBufferData(GL_ARRAY_BUFFER, mesh->num_vertices * mesh->stride,
+                packVertexData(mesh, mesh->vertices, 0, mesh->num_vertices),
+                (mesh->type == BC_MESH_STATIC) ? GL_STATIC_DRAW : GL_DYNAMIC_DRAW);
         }
     }
-    if (compileError == GL_FALSE)
+    if (mesh->num_indices)
     {
-        glDeleteShader(shaderId);
-        bcLogError("Shader not created!");
-        return 0;
-    }
-    return shaderId;
-}
-
-bool bcLinkShaderProgram(unsigned int programId)
-{
-    // link program
-    glLinkProgram(programId);
-    GLint linkError = 0;
-    glGetProgramiv(programId, GL_LINK_STATUS, &linkError);
-    if (linkError == GL_FALSE) {
-        char errorLog[2000];
-        GLsizei errorLen = 0;
-        glGetProgramInfoLog(programId, 2000, &errorLen, errorLog);
-        bcLogError("Link program:\n%s", errorLog);
-        return false;
+        if (mesh->vbo_indices)
+        {
+            bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo_indices);
+            if (partial)
+                uploadDirtyRanges(mesh, GL_ELEMENT_ARRAY_BUFFER, mesh->dirty_indices, num_dirty_indices);
+            else
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, mesh->num_indices * mesh->index_size, mesh->indices);
+        }
+        else
+        {
+            releaseVertexArray(mesh);
+            glGenBuffers(1, &(mesh->vbo_indices));
+            bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo_indices);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->num_indices * mesh->index_size,
+                mesh->indices,
+                (mesh->type == BC_MESH_STATIC) ? GL_STATIC_DRAW : GL_DYNAMIC_DRAW);
+        }
     }
-    // validate program
-    glValidateProgram(programId);
-    GLint validateError = 0;
-    glGetProgramiv(programId, GL_VALIDATE_STATUS, &validateError);
-    if (validateError == GL_FALSE) {
-        char errorLog[2000];
-        GLsizei errorLen = 0;
-        glGetProgramInfoLog(programId, 2000, &errorLen, errorLog);
-        bcLogError("Validate program:\n%s", errorLog);
-        return false;
+    // reset state machine
+    if (g_Context->CurrentMesh)
+    {
+        bcBindMesh(NULL);
     }
-    return true;
 }
 
-#else // SUPPORT_GLSL
-
-BCShader * bcCreateShader(const char *vs_code, const char *fs_code) { return NULL; }
-BCShader * bcCreateShaderFromSingleFile(const char *filename) { return NULL; }
-BCShader * bcCreateShaderFromFile(const char *vsFilename, const char *fsFilename) { return NULL; }
-void bcUpdateShader(BCShader *shader) { }
-void bcReleaseShader(BCShader *shader) { }
-void bcDestroyShader(BCShader *shader) { }
-void bcBindShader(BCShader *shader) { }
-unsigned int bcLoadShader(const char *code, unsigned int shaderType) { return 0; }
-bool bcLinkShaderProgram(unsigned int programId) { return false; }
-
-#endif // SUPPORT_GLSL
-
-//
-// Image
-//
-
-BCImage * bcCreateImage(int width, int height, int comps)
+void bcUpdateMesh(BCMesh *mesh)
 {
-    BCImage *image = NEW_OBJECT(BCImage);
-    image->width = width;
-    image->height = height;
-    image->comps = comps;
-    image->data = calloc(1, width * height * comps);
-    return image;
+    updateMesh(mesh, true);
 }
 
-BCImage * bcCreateImageFromFile(const char *filename)
+void bcReleaseMesh(BCMesh *mesh)
 {
-#if 0
-    int x, y, comp;
-    unsigned char *data = stbi_load(filename, &x, &y, &comp, 0);
-    if (data == NULL)
+    if (mesh == NULL)
     {
-        bcLogWarning("Image file '%s' not found!", filename);
-        return NULL;
+        bcLogError("Invalid mesh!");
+        return;
     }
-    BCImage *image = NEW_OBJECT(BCImage);
-    image->width = x;
-    image->height = y;
-    image->comps = comp;
-    image->data = data;
-    return image;
-#else
-    int size = 0;
-    unsigned char *data = bcLoadDataFile(filename, &size);
-    if (data == NULL)
+    if (mesh->type == BC_MESH_STREAM)
+    {
+        // stream buffers are owned by the context
+        mesh->vbo_vertices = 0;
+        mesh->vbo_indices = 0;
+        return;
+    }
+    if (mesh->type == BC_MESH_SHARED)
+    {
+        releaseSharedMesh(mesh);
+        return;
+    }
+    releaseVertexArray(mesh);
+    if (mesh->vbo_vertices)
     {
-        bcLogWarning("Image file '%s' not found!", filename);
-        return NULL;
+        deleteBuffer(&(mesh->vbo_vertices));
     }
-    if (size <= 0)
+    if (mesh->vbo_indices)
     {
-        bcLogWarning("Image file '%s' not valid!", filename);
-        return NULL;
+        deleteBuffer(&(mesh->vbo_indices));
     }
-    return bcCreateImageFromMemory(data, size);
-#endif
 }
 
-BCImage * bcCreateImageFromMemory(void *buffer, int size)
+void bcDestroyMesh(BCMesh *mesh)
 {
-    int x, y, comp;
-    unsigned char *data = stbi_load_from_memory(buffer, size, &x, &y, &comp, 0);
-    if (data == NULL)
+    if (mesh == NULL)
     {
-        bcLogWarning("Image data not valid!");
-        return NULL;
+        bcLogError("Invalid mesh!");
+        return;
     }
-    BCImage *image = NEW_OBJECT(BCImage);
-    image->width = x;
-    image->height = y;
-    image->comps = comp;
-    image->data = data;
-    return image;
+    bcReleaseMesh(mesh);
+    free(mesh->vertices);
+    free(mesh->indices);
+    free(mesh->parts);
+    removeRegistryObject(&(g_Context->RM[RM_TYPE_MESH]), mesh->RM_handle);
+    free(mesh);
 }
 
-void bcDestroyImage(BCImage *image)
+BCMesh * bcGetMeshFromHandle(uint32_t handle)
 {
-    free(image->data);
-    free(image);
+    return (BCMesh *) getRegistryObject(&(g_Context->RM[RM_TYPE_MESH]), handle);
 }
 
-//
-// Texture
-//
-
-BCTexture * bcCreateTextureFromFile(const char *filename, int flags)
+static void updateFrustum()
 {
-    BCImage *image = bcCreateImageFromFile(filename);
-    if (image == NULL)
-        return NULL;
-    return bcCreateTextureFromImage(image, flags);
+    // planes in object space, from the rows of projection * modelview
+    mat4_t m = mat4_multiply(g_Context->ProjectionMatrix, g_Context->ModelViewMatrix);
+    for (int i = 0; i < 6; i++)
+    {
+        int row = i / 2;
+        float sign = (i % 2) ? -1.0f : 1.0f;
+        float *plane = g_Context->FrustumPlanes[i];
+        for (int j = 0; j < 4; j++)
+            plane[j] = m.v[j * 4 + 3] + sign * m.v[j * 4 + row];
+        float len = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        if (len > 0)
+        {
+            for (int j = 0; j < 4; j++)
+                plane[j] /= len;
+        }
+    }
+    g_Context->FrustumNeedUpdate = false;
 }
 
-BCTexture * bcCreateTextureFromImage(BCImage *image, int flags)
+bool bcIsMeshVisible(BCMesh *mesh)
 {
-    BCTexture *texture = NEW_OBJECT(BCTexture);
-    texture->RM_type = RM_TYPE_TEXTURE;
-    texture->width = image->width;
-    texture->height = image->height;
-    texture->image = image;
-    texture->flags = flags;
-    if (g_Context->Started)
-    {
-        bcUpdateTexture(texture);
-    }
-    if (flags & BC_TEXTURE_DETACHED)
-    {
-        bcDestroyImage(image);
-        texture->image = NULL;
+    if (mesh == NULL || !mesh->has_bounds)
+        return true;
+    if (g_Context->FrustumNeedUpdate)
+        updateFrustum();
+    for (int i = 0; i < 6; i++)
+    {
+        const float *plane = g_Context->FrustumPlanes[i];
+        // sphere first, then the box corner furthest along the plane normal
+        float d = plane[0] * mesh->bounds_center[0] + plane[1] * mesh->bounds_center[1] + plane[2] * mesh->bounds_center[2] + plane[3];
+        if (d < -mesh->bounds_radius)
+            return false;
+        if (d < mesh->bounds_radius)
+        {
+            float px = (plane[0] >= 0) ? mesh->bounds_max[0] : mesh->bounds_min[0];
+            float py = (plane[1] >= 0) ? mesh->bounds_max[1] : mesh->bounds_min[1];
+            float pz = (plane[2] >= 0) ? mesh->bounds_max[2] : mesh->bounds_min[2];
+            if (plane[0] * px + plane[1] * py + plane[2] * pz + plane[3] < 0)
+                return false;
+        }
     }
-    clist_add_node(g_Context->RM_list, texture);
-    return texture;
+    return true;
 }
 
-void bcUpdateTexture(BCTexture *texture)
+static bool cullMesh(BCMesh *mesh)
 {
-    int internalFormat;
-    switch (texture->image->comps)
-    {
-    case 1:
-        internalFormat = GL_ALPHA;
-        texture->format = GL_ALPHA;
-        break;
-    case 3:
-        internalFormat = GL_RGB;
-        texture->format = GL_RGB;
-        break;
-    case 4:
-        internalFormat = GL_RGBA;
-        texture->format = GL_RGBA;
-        break;
-    }
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glGenTextures(1, &(texture->id));
-    glBindTexture(GL_TEXTURE_2D, (texture->id));
-    // filter flags
-    if (texture->flags & BC_TEXTURE_LINEAR)
-    {
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    }
-    else if (texture->flags & BC_TEXTURE_NEAREST)
-    {
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    }
-    else if (texture->flags & BC_TEXTURE_MIPMAP)
-    {
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_NEAREST);
-        // mMipmaps = true;
-    }
-    else
+    if (bcIsMeshVisible(mesh))
     {
-        // linear filter by default
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        g_Context->Stats.visible_meshes++;
+        return true;
     }
-    // wrap flags
-    if (texture->flags & BC_TEXTURE_REPEAT)
+    g_Context->Stats.culled_meshes++;
+    return false;
+}
+
+static int findMeshLOD(BCMesh *mesh, float triangles)
+{
+    // coarsest level that still fills the budget
+    int lod = 0;
+    while (lod + 1 < mesh->num_lods && mesh->lods[lod + 1].count / 3 >= triangles)
+        lod++;
+    return lod;
+}
+
+static int selectMeshLOD(BCMesh *mesh, int previous)
+{
+    if (!mesh->has_bounds)
+        return 0;
+    const float *mv = g_Context->ModelViewMatrix.v;
+    const float *p = g_Context->ProjectionMatrix.v;
+    float eye[4];
+    for (int i = 0; i < 4; i++)
+        eye[i] = mv[i] * mesh->bounds_center[0] + mv[4 + i] * mesh->bounds_center[1] + mv[8 + i] * mesh->bounds_center[2] + mv[12 + i];
+    float w = p[3] * eye[0] + p[7] * eye[1] + p[11] * eye[2] + p[15] * eye[3];
+    if (w <= 0)
+        return 0;
+    float scale = 0;
+    for (int i = 0; i < 3; i++)
+        scale = fmaxf(scale, mv[i * 4 + 0] * mv[i * 4 + 0] + mv[i * 4 + 1] * mv[i * 4 + 1] + mv[i * 4 + 2] * mv[i * 4 + 2]);
+    int height = g_Context->State.viewport[3];
+    if (height == STATE_UNKNOWN)
+        height = bcGetDisplayHeight();
+    // projected bounding sphere area decides the triangle budget
+    float radius = mesh->bounds_radius * sqrtf(scale) * fabsf(p[5]) * height * 0.5f / w;
+    float budget = (float) M_PI * radius * radius / g_Context->LODTriangleSize;
+    int lod = findMeshLOD(mesh, budget);
+    // the caller's previous level only changes once the budget moved far enough
+    if (previous >= 0 && lod > previous)
     {
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        int coarser = findMeshLOD(mesh, budget * (1 + LOD_HYSTERESIS));
+        lod = (coarser > previous) ? coarser : previous;
     }
-    else if (texture->flags & BC_TEXTURE_CLAMP)
+    else if (previous >= 0 && lod < previous)
     {
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        int finer = findMeshLOD(mesh, budget * (1 - LOD_HYSTERESIS));
+        lod = (finer < previous) ? finer : previous;
     }
-    glTexImage2D(
-        GL_TEXTURE_2D,
-        0,
-        internalFormat,
-        texture->image->width,
-        texture->image->height,
-        0,
-        texture->format,
-        GL_UNSIGNED_BYTE,
-        texture->image->data);
-    // if (mMipmaps) {
-    //     glGenerateMipmap(GL_TEXTURE_2D);
-    // }
-    glBindTexture(GL_TEXTURE_2D, 0);
+    return lod;
 }
 
-void bcReleaseTexture(BCTexture *texture)
+int bcSelectMeshLOD(BCMesh *mesh, int previous)
 {
-    if (!texture)
+    if (mesh == NULL)
     {
-        bcLogError("Invalid texture!");
-        return;
+        bcLogWarning("Invalid mesh!");
+        return 0;
     }
-    glDeleteTextures(1, &(texture->id));
-    texture->id = 0;
+    if (mesh->num_lods < 2)
+        return 0;
+    if (previous >= mesh->num_lods)
+        previous = mesh->num_lods - 1;
+    return selectMeshLOD(mesh, previous);
 }
 
-void bcDestroyTexture(BCTexture *texture)
+// Draws the level picked against previous and returns it, or -1 if culled
+static int drawMeshLOD(BCMesh *mesh, int previous)
 {
-    if (!texture)
+    if (g_Context->FrustumCulling && !cullMesh(mesh))
+        return -1;
+    if (mesh->num_lods > 1 && g_Context->LODTriangleSize > 0)
     {
-        bcLogError("Invalid texture!");
-        return;
+        int level = selectMeshLOD(mesh, (previous < mesh->num_lods) ? previous : mesh->num_lods - 1);
+        bcDrawMeshRange(mesh, mesh->lods[level].first, mesh->lods[level].count);
+        return level;
     }
-    if (texture->image)
-        bcDestroyImage(texture->image);
-    bcReleaseTexture(texture);
-    free(texture);
-    clist_delete_node(g_Context->RM_list, texture);
+    bcDrawMeshRange(mesh, 0, mesh->draw_count);
+    return 0;
 }
 
-void bcBindTexture(BCTexture *texture)
+void bcDrawMesh(BCMesh *mesh)
 {
-    glActiveTexture(GL_TEXTURE0);
-    if (texture)
+    if (mesh == NULL)
     {
-        glBindTexture(GL_TEXTURE_2D, texture->id);
+        bcLogError("Invalid mesh!");
+        return;
     }
-#ifdef SUPPORT_GLSL
-    glUniform1i(g_Context->CurrentShader->loc_uniforms[BC_SHADER_UNIFORM_USETEXTURE], texture ? 1 : 0);
-    if (texture)
+    // the level from the last frame is only meaningful if the mesh is drawn once per frame
+    int frame = g_Context->FrameCounter;
+    if (mesh->lod_frame == frame)
     {
-        glUniform1i(g_Context->CurrentShader->loc_uniforms[BC_SHADER_UNIFORM_TEXTURE], 0);
-        glUniform1i(g_Context->CurrentShader->loc_uniforms[BC_SHADER_UNIFORM_ALPHAONLYTEXTURE], texture->format == GL_ALPHA ? 1 : 0);
+        drawMeshLOD(mesh, -1);
+        return;
     }
-#else
-    if (texture)
-        glEnable(GL_TEXTURE_2D);
-    else
-        glDisable(GL_TEXTURE_2D);
-#endif
-}
-
-//
-// View State
-//
-
-void bcClear(BCColor color)
-{
-    glClearColor(color.r, color.g, color.b, color.a);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glViewport(0, 0, bcGetDisplayWidth(), bcGetDisplayHeight());
+    int previous = (mesh->lod_frame == frame - 1) ? mesh->lod_level : -1;
+    int level = drawMeshLOD(mesh, previous);
+    mesh->lod_level = level;
+    mesh->lod_frame = frame;
 }
 
-void bcViewport(int x, int y, int width, int height)
+void bcDrawMeshLOD(BCMesh *mesh, int *state)
 {
-    if (width == 0)
-        width = bcGetDisplayWidth();
-    if (height == 0)
-        height = bcGetDisplayHeight();
-    glViewport(x, bcGetDisplayHeight() - height, width, height);
+    if (mesh == NULL || state == NULL)
+    {
+        bcLogError("Invalid mesh!");
+        return;
+    }
+    int level = drawMeshLOD(mesh, *state);
+    if (level >= 0)
+        *state = level;
 }
 
-void bcSetBlend(bool enabled)
+#ifdef SUPPORT_GLSL
+static bool useVertexArray(BCMesh *mesh)
 {
-    if (enabled)
-        glEnable(GL_BLEND);
-    else
-        glDisable(GL_BLEND);
+    // streamed meshes move every frame, client arrays can't be recorded
+    return g_Context->Ext.VertexArrayObject && mesh->type != BC_MESH_STREAM && mesh->vbo_vertices;
 }
 
-void bcSetDepthTest(bool enabled)
+static void setupVertexAttributes(BCMesh *mesh)
 {
-    if (enabled)
-        glEnable(GL_DEPTH_TEST);
-    else
-        glDisable(GL_DEPTH_TEST);
+    bindBuffer(GL_ARRAY_BUFFER, mesh->vbo_vertices);
+    // client arrays are never packed
+    bool packed = mesh->packed && mesh->vbo_vertices;
+    char *vert_ptr = (mesh->vbo_vertices ? (char *) (intptr_t) mesh->vbo_offset : (char *) mesh->vertices);
+    int stride = packed ? mesh->stride : mesh->total_comps * (int) sizeof(float);
+    int offset = 0;
+    for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
+    {
+        if (mesh->comps[i] > 0)
+        {
+            int type = packed ? mesh->attr_types[i] : GL_FLOAT;
+            int size = (type == GL_INT_2_10_10_10_REV) ? 4 : mesh->comps[i];
+            setVertexAttribArray(i, true);
+            glVertexAttribPointer(i, size, type, isNormalizedType(type), stride, vert_ptr + (packed ? mesh->attr_offsets[i] : offset));
+            offset += mesh->comps[i] * sizeof(float);
+        }
+        else
+        {
+            setVertexAttribArray(i, false);
+        }
+    }
 }
+#endif
 
-void bcSetAlphaTest(bool enabled)
+void bcBindMesh(BCMesh *mesh)
 {
+    if (mesh)
+    {
+        mesh->RM_frame = g_Context->FrameCounter;
+        // geometry has no placeholder, restore on first use
+        if (mesh->RM_pending)
+            restoreMesh(mesh);
+        refreshStreamMesh(mesh);
+    }
+    if (g_Context->CurrentMesh == mesh)
+    {
+        bcLogWarning("Mesh already assigned!");
+        return;
+    }
+    // meshes in one arena share buffers and attribute setup
+    BCMesh *current = g_Context->CurrentMesh;
+    if (mesh && current && mesh->type == BC_MESH_SHARED && current->type == BC_MESH_SHARED
+        && mesh->arena >= 0 && mesh->arena == current->arena)
+    {
+        mesh->vao = current->vao;
+        g_Context->CurrentMesh = mesh;
+        return;
+    }
+    if (mesh == NULL)
+    {
+        // unbind mesh
 #ifdef SUPPORT_GLSL
-    glUniform1i(g_Context->CurrentShader->loc_uniforms[BC_SHADER_UNIFORM_ALPHATEST], enabled);
+        if (g_Context->Ext.VertexArrayObject)
+        {
+            bindVertexArray(0);
+        }
+        for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
+        {
+            setVertexAttribArray(i, false);
+        }
 #else
-    if (enabled)
-        glEnable(GL_ALPHA_TEST);
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_COLOR_ARRAY);
+#endif
+        bindBuffer(GL_ARRAY_BUFFER, 0);
+        bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
     else
-        glDisable(GL_ALPHA_TEST);
+    {
+        // bind mesh
+#ifdef SUPPORT_GLSL
+        unsigned int *vao = (mesh->type == BC_MESH_SHARED && mesh->arena >= 0) ? &(g_Context->Arenas[mesh->arena].vao) : &(mesh->vao);
+        if (!useVertexArray(mesh))
+        {
+            bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo_indices);
+            setupVertexAttributes(mesh);
+        }
+        else if (*vao == 0)
+        {
+            // record the attribute setup once
+            g_Context->Ext.GenVertexArrays(1, vao);
+            bindVertexArray(*vao);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo_indices);
+            g_Context->State.element_buffer = mesh->vbo_indices;
+            setupVertexAttributes(mesh);
+        }
+        else
+        {
+            bindVertexArray(*vao);
+        }
+        mesh->vao = *vao;
+        updateState(DIRTY_VERTEX_COLOR, &(g_Context->VertexColorEnabled), &(mesh->comps[BC_VERTEX_ATTR_COLORS]), sizeof(int));
+#else
+        bindBuffer(GL_ARRAY_BUFFER, mesh->vbo_vertices);
+        bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo_indices);
+        // client arrays are never packed
+        bool packed = mesh->packed && mesh->vbo_vertices;
+        char *vert_ptr = (mesh->vbo_vertices ? (char *) (intptr_t) mesh->vbo_offset : (char *) mesh->vertices);
+        int stride = packed ? mesh->stride : mesh->total_comps * (int) sizeof(float);
+        int offset = 0;
+        for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
+        {
+            if (mesh->comps[i] > 0)
+            {
+                int type = packed ? mesh->attr_types[i] : GL_FLOAT;
+                char *ptr = vert_ptr + (packed ? mesh->attr_offsets[i] : offset);
+                glEnableClientState(s_ClientStateType[i].type);
+                switch (i)
+                {
+                case BC_VERTEX_ATTR_POSITIONS:
+                    glVertexPointer(mesh->comps[i], type, stride, ptr);
+                    break;
+                case BC_VERTEX_ATTR_NORMALS:
+                    glNormalPointer(type, stride, ptr);
+                    break;
+                case BC_VERTEX_ATTR_TEXCOORDS:
+                    glTexCoordPointer(mesh->comps[i], type, stride, ptr);
+                    break;
+                case BC_VERTEX_ATTR_COLORS:
+                    glColorPointer(mesh->comps[i], type, stride, ptr);
+                    break;
+                }
+                offset += mesh->comps[i] * sizeof(float);
+            }
+            else
+            {
+                glDisableClientState(s_ClientStateType[i].type);
+            }
+        }
 #endif
+    }
+    g_Context->CurrentMesh = mesh;
 }
 
-void bcSetCulling(bool enabled)
+void bcDrawMeshPart(BCMeshPart part)
 {
-    if (enabled)
-        glEnable(GL_CULL_FACE);
-    else
-        glDisable(GL_CULL_FACE);
+    if (part.mesh && g_Context->FrustumCulling && !cullMesh(part.mesh))
+        return;
+    bcDrawMeshRange(part.mesh, part.start, part.count);
 }
 
-void bcSetWireframe(bool enabled)
+static void bindQueuedState()
 {
-#ifndef SUPPORT_GLES
-    if (enabled)
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    else
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    // binds are only recorded while the queue is active, immediate draws need them now
+#ifdef SUPPORT_GLSL
+    BCShader *shader = g_Context->CurrentShader;
+    if (!(shader->features & SHADER_VARIANT) && g_Context->ProgramShader != shader)
+    {
+        // uniforms are per program
+        g_Context->ProgramShader = shader;
+        g_Context->DirtyFlags = DIRTY_ALL;
+        useProgram(shader->programId);
+    }
 #endif
+    if (g_Context->CurrentTexture)
+    {
+        bindTexture(0, getRestoredTextureId(g_Context->CurrentTexture));
+    }
 }
 
-void bcSetLighting(bool enabled)
+void bcDrawMeshRange(BCMesh *mesh, int start, int count)
 {
-#ifdef SUPPORT_GLSL
-    glUniform1i(g_Context->CurrentShader->loc_uniforms[BC_SHADER_UNIFORM_LIGHT_ENABLED], enabled);
-    if (enabled)
+    if (mesh == NULL)
     {
-        glUniform4f(g_Context->CurrentShader->loc_uniforms[BC_SHADER_UNIFORM_LIGHT_COLOR], 1, 1, 1, 1);
-        glEnable(GL_CULL_FACE);
+        bcLogError("Invalid mesh!");
+        return;
     }
-    else
+    if (mesh->num_indices && !checkIndexSupport(mesh->index_size))
     {
-        glDisable(GL_CULL_FACE);
+        return;
     }
-#else
-    if (enabled)
+    // streamed data is overwritten before the queue executes
+    if (g_Context->RenderQueueActive && mesh->type != BC_MESH_STREAM)
     {
-        glEnable(GL_LIGHTING);
-        glEnable(GL_LIGHT0);
+        queueRenderItem(mesh, start, count);
+        return;
     }
-    else
+    if (g_Context->RenderQueueActive)
     {
-        glDisable(GL_LIGHTING);
+        bindQueuedState();
+    }
+    refreshStreamMesh(mesh);
+    if (g_Context->CurrentMesh != mesh)
+    {
+        bcBindMesh(mesh);
     }
-#endif
-    g_Context->LightingEnabled = enabled;
-}
-
-void bcLightPosition(float x, float y, float z)
-{
-#ifdef SUPPORT_GLSL
-    glUniform3f(g_Context->CurrentShader->loc_uniforms[BC_SHADER_UNIFORM_LIGHT_POSITION], x, y, z);
-#else
-    float lightPos[] = { x, y, z, 1 };
-    glLightfv(GL_LIGHT0, GL_POSITION, lightPos);
-#endif
-}
-
-void bcSetProjectionMatrix(float *m)
-{
-    g_Context->ProjectionMatrix = mat4_from_array(m);
 #ifdef SUPPORT_GLSL
-    glUniformMatrix4fv(g_Context->CurrentShader->loc_uniforms[BC_SHADER_UNIFORM_PROJECTIONMATRIX], 1, GL_FALSE, m);
-#else
-    glMatrixMode(GL_PROJECTION);
-    glLoadMatrixf(m);
-    glMatrixMode(GL_MODELVIEW);
+    bindShaderVariant();
 #endif
+    uploadDirtyState();
+    g_Context->Stats.draw_calls++;
+    if (mesh->num_indices)
+    {
+        // buffer uploads may have rebound the element buffer
+        if (mesh->vao == 0)
+            bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo_indices);
+        const char *elem_start = (mesh->vbo_indices ? (const char *) (intptr_t) mesh->ibo_offset : (const char *) mesh->indices) + start * mesh->index_size;
+        glDrawElements(mesh->draw_mode, count, getIndexType(mesh), elem_start);
+    }
+    else
+    {
+        glDrawArrays(mesh->draw_mode, mesh->base_vertex + start, count);
+    }
 }
 
-void bcSetModelViewMatrix(float *m)
+static void drawInstancesSeparately(BCMesh *mesh, const float *matrices, const BCColor *colors, int count)
 {
-    g_Context->ModelViewMatrix = mat4_from_array(m);
-#ifdef SUPPORT_GLSL
-    glUniformMatrix4fv(g_Context->CurrentShader->loc_uniforms[BC_SHADER_UNIFORM_MODELVIEWMATRIX], 1, GL_FALSE, m);
-#else
-    glLoadMatrixf(m);
-#endif
+    mat4_t view = g_Context->ModelViewMatrix;
+    BCColor primary = g_Context->ColorArray[BC_COLOR_TYPE_PRIMARY];
+    for (int i = 0; i < count; i++)
+    {
+        bcSetModelViewMatrix(mat4_multiply(view, mat4_from_array((float *) (matrices + i * 16))).v);
+        if (colors)
+        {
+            BCColor c = colors[i];
+            bcSetColor(SET_COLOR(primary.r * c.r, primary.g * c.g, primary.b * c.b, primary.a * c.a), BC_COLOR_TYPE_PRIMARY);
+        }
+        bcDrawMeshRange(mesh, 0, mesh->draw_count);
+    }
+    bcSetModelViewMatrix(view.v);
+    bcSetColor(primary, BC_COLOR_TYPE_PRIMARY);
 }
 
-void bcSetTextureMatrix(float *m)
+static void transformInstance(BCMesh *mesh, BCMesh *batch, int first_vertex, const float *m, const BCColor *color)
 {
-    g_Context->TextureMatrix = mat3_from_array(m);
-#ifdef SUPPORT_GLSL
-    glUniformMatrix3fv(g_Context->CurrentShader->loc_uniforms[BC_SHADER_UNIFORM_TEXTUREMATRIX], 1, GL_FALSE, m);
-#else
-    // TODO: not implemented for OpenGL legacy mode!
-#endif
+    const int *comps = mesh->comps;
+    BCColor primary = g_Context->ColorArray[BC_COLOR_TYPE_PRIMARY];
+    int num_vertices = mesh->num_indices ? mesh->num_vertices : mesh->draw_count;
+    for (int v = 0; v < num_vertices; v++)
+    {
+        const float *src = mesh->vertices + v * mesh->total_comps;
+        float *dst = batch->vertices + (first_vertex + v) * batch->total_comps;
+        // positions
+        float x = src[0];
+        float y = src[1];
+        float z = (comps[BC_VERTEX_ATTR_POSITIONS] > 2) ? src[2] : 0;
+        float w = (comps[BC_VERTEX_ATTR_POSITIONS] > 3) ? src[3] : 1;
+        for (int i = 0; i < comps[BC_VERTEX_ATTR_POSITIONS]; i++)
+            dst[i] = m[i] * x + m[4 + i] * y + m[8 + i] * z + m[12 + i] * w;
+        src += comps[BC_VERTEX_ATTR_POSITIONS];
+        dst += comps[BC_VERTEX_ATTR_POSITIONS];
+        // normals
+        if (comps[BC_VERTEX_ATTR_NORMALS])
+        {
+            for (int i = 0; i < 3; i++)
+                dst[i] = m[i] * src[0] + m[4 + i] * src[1] + m[8 + i] * src[2];
+            src += 3;
+            dst += 3;
+        }
+        // texcoords
+        memcpy(dst, src, comps[BC_VERTEX_ATTR_TEXCOORDS] * sizeof(float));
+        src += comps[BC_VERTEX_ATTR_TEXCOORDS];
+        dst += comps[BC_VERTEX_ATTR_TEXCOORDS];
+        // colors, instance color modulates the vertex or primary color
+        if (color)
+        {
+            float c[4] = { 0, 0, 0, 1 };
+            if (comps[BC_VERTEX_ATTR_COLORS])
+                memcpy(c, src, comps[BC_VERTEX_ATTR_COLORS] * sizeof(float));
+            else
+                memcpy(c, &primary, sizeof(c));
+            dst[0] = c[0] * color->r;
+            dst[1] = c[1] * color->g;
+            dst[2] = c[2] * color->b;
+            dst[3] = c[3] * color->a;
+        }
+        else
+        {
+            memcpy(dst, src, comps[BC_VERTEX_ATTR_COLORS] * sizeof(float));
+        }
+    }
 }
 
-float * bcGetProjectionMatrix()
+static void drawInstancesBatched(BCMesh *mesh, const float *matrices, const BCColor *colors, int count)
 {
-    return g_Context->ProjectionMatrix.v;
+    int format = mesh->format;
+    if (colors)
+        format = (format & ~(BC_MESH_COL1 | BC_MESH_COL3)) | BC_MESH_COL4;
+    int num_vertices = mesh->num_indices ? mesh->num_vertices : mesh->draw_count;
+    int num_indices = mesh->num_indices ? mesh->draw_count : 0;
+    int chunk = STREAM_MAX_VERTICES / num_vertices;
+    if (chunk > count)
+        chunk = count;
+    BCMesh *batch = g_Context->InstanceMesh;
+    if (batch == NULL || batch->format != format || batch->num_vertices < chunk * num_vertices || batch->num_indices < chunk * num_indices)
+    {
+        if (batch)
+            bcDestroyMesh(batch);
+        batch = bcCreateMesh(format, NULL, chunk * num_vertices, NULL, chunk * num_indices, BC_MESH_STREAM);
+        g_Context->InstanceMesh = batch;
+    }
+    batch->draw_mode = mesh->draw_mode;
+    for (int first = 0; first < count; first += chunk)
+    {
+        int n = (count - first < chunk) ? count - first : chunk;
+        for (int i = 0; i < n; i++)
+        {
+            transformInstance(mesh, batch, i * num_vertices, matrices + (first + i) * 16, colors ? &colors[first + i] : NULL);
+            for (int j = 0; j < num_indices; j++)
+                bcSetMeshIndex(batch, i * num_indices + j, bcGetMeshIndex(mesh, j) + i * num_vertices);
+        }
+        streamMesh(batch, n * num_vertices, n * num_indices);
+        bcDrawMeshRange(batch, 0, num_indices ? n * num_indices : n * num_vertices);
+    }
 }
 
-float * bcGetModelViewMatrix()
+#ifdef SUPPORT_GLSL
+static void drawInstancesHardware(BCMesh *mesh, const float *matrices, const BCColor *colors, int count)
 {
-    return g_Context->ModelViewMatrix.v;
+    // pack affine rows and colors into the stream buffer
+    if (g_Context->InstanceCapacity < count)
+    {
+        g_Context->InstanceData = EXTEND_ARRAY(g_Context->InstanceData, count * INSTANCE_COMPS, float);
+        g_Context->InstanceCapacity = count;
+    }
+    float *data = g_Context->InstanceData;
+    for (int i = 0; i < count; i++)
+    {
+        const float *m = matrices + i * 16;
+        float *dst = data + i * INSTANCE_COMPS;
+        for (int row = 0; row < 3; row++)
+        {
+            dst[row * 4 + 0] = m[row];
+            dst[row * 4 + 1] = m[4 + row];
+            dst[row * 4 + 2] = m[8 + row];
+            dst[row * 4 + 3] = m[12 + row];
+        }
+        BCColor c = colors ? colors[i] : BC_COLOR_WHITE;
+        memcpy(dst + 12, &c, sizeof(BCColor));
+    }
+    int offset = streamData(&(g_Context->StreamVertices), GL_ARRAY_BUFFER, data, count * INSTANCE_COMPS * sizeof(float));
+    if (g_Context->RenderQueueActive)
+    {
+        bindQueuedState();
+    }
+    // draw with the instanced default shader, each program keeps its own pending uniforms
+    BCShader *shader = g_Context->CurrentShader;
+    BCShader *program = g_Context->ProgramShader;
+    int dirty = g_Context->DirtyFlags;
+    g_Context->CurrentShader = g_Context->InstancedShader;
+    g_Context->ProgramShader = g_Context->InstancedProgram ? g_Context->InstancedProgram : g_Context->InstancedShader;
+    g_Context->DirtyFlags = g_Context->InstancedDirty;
+    g_Context->InstancedDirty = 0;
+    useProgram(g_Context->ProgramShader->programId);
+    if (g_Context->CurrentMesh != mesh)
+    {
+        bcBindMesh(mesh);
+    }
+    if (mesh->num_indices && mesh->vao == 0)
+    {
+        bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo_indices);
+    }
+    bindBuffer(GL_ARRAY_BUFFER, g_Context->StreamVertices.id);
+    for (int i = 0; s_InstanceShaderAttributes[i].name; i++)
+    {
+        int index = BC_VERTEX_ATTR_MAX + i;
+        glEnableVertexAttribArray(index);
+        glVertexAttribPointer(index, 4, GL_FLOAT, GL_FALSE, INSTANCE_COMPS * sizeof(float), (void *) (intptr_t) (offset + i * 4 * sizeof(float)));
+        g_Context->Ext.VertexAttribDivisor(index, 1);
+    }
+    bindShaderVariant();
+    uploadDirtyState();
+    g_Context->InstancedProgram = g_Context->ProgramShader;
+    g_Context->Stats.draw_calls++;
+    if (mesh->num_indices)
+    {
+        const char *elem_start = (mesh->vbo_indices ? (const char *) (intptr_t) mesh->ibo_offset : (const char *) mesh->indices);
+        g_Context->Ext.DrawElementsInstanced(mesh->draw_mode, mesh->draw_count, getIndexType(mesh), elem_start, count);
+    }
+    else
+    {
+        g_Context->Ext.DrawArraysInstanced(mesh->draw_mode, mesh->base_vertex, mesh->draw_count, count);
+    }
+    // instance arrays must not leak into regular draws
+    for (int i = 0; s_InstanceShaderAttributes[i].name; i++)
+    {
+        int index = BC_VERTEX_ATTR_MAX + i;
+        g_Context->Ext.VertexAttribDivisor(index, 0);
+        glDisableVertexAttribArray(index);
+    }
+    // state changed by the mesh bind is still pending for the caller's program
+    g_Context->CurrentShader = shader;
+    g_Context->ProgramShader = program;
+    g_Context->DirtyFlags = dirty | g_Context->InstancedDirty;
+    g_Context->InstancedDirty = 0;
+    if (program)
+    {
+        useProgram(program->programId);
+    }
 }
+#endif
 
-float * bcGetTextureMatrix()
+void bcDrawMeshInstanced(BCMesh *mesh, const float *matrices, const BCColor *colors, int count)
 {
-    return g_Context->TextureMatrix.v;
+    if (mesh == NULL)
+    {
+        bcLogError("Invalid mesh!");
+        return;
+    }
+    if (count <= 0 || mesh->draw_count == 0)
+        return;
+    if (mesh->num_indices && !checkIndexSupport(mesh->index_size))
+        return;
+#ifdef SUPPORT_GLSL
+    // streamed meshes would share the ring with the instance data
+    if (g_Context->InstancedShader && g_Context->CurrentShader == g_Context->DefaultShader && mesh->type != BC_MESH_STREAM)
+    {
+        drawInstancesHardware(mesh, matrices, colors, count);
+        return;
+    }
+#endif
+    // pre-transform on the CPU, only lists can be concatenated
+    bool is_list = (mesh->draw_mode == GL_TRIANGLES || mesh->draw_mode == GL_LINES || mesh->draw_mode == GL_POINTS);
+    int num_vertices = mesh->num_indices ? mesh->num_vertices : mesh->draw_count;
+    if (mesh->vertices && is_list && (mesh->num_indices == 0 || mesh->indices) && num_vertices <= STREAM_MAX_VERTICES)
+        drawInstancesBatched(mesh, matrices, colors, count);
+    else
+        drawInstancesSeparately(mesh, matrices, colors, count);
 }
 
-void bcSetScissor(bool enabled)
+BCMeshPart bcPartFromMesh(BCMesh *mesh)
 {
-    if (enabled)
-        glEnable(GL_SCISSOR_TEST);
-    else
-        glDisable(GL_SCISSOR_TEST);
+    BCMeshPart part = { mesh, 0, mesh->draw_count };
+    return part;
 }
 
-void bcScissorRect(int x, int y, int w, int h)
+static void appendMeshPart(BCMesh *mesh, int first, int count)
 {
-    y = bcGetDisplayHeight() - y - h;
-    glScissor(x, y, w, h);
+    mesh->parts = EXTEND_ARRAY(mesh->parts, mesh->num_parts + 1, BCMeshRange);
+    mesh->parts[mesh->num_parts++] = (BCMeshRange) { first, count };
 }
 
-void bcSetColor(BCColor color, BCColorType type)
+BCMeshPart bcGetMeshPart(BCMesh *mesh, int index)
 {
-    g_Context->ColorArray[type] = color;
-    g_Context->ColorNeedUpdate = true;
+    if (index < 0 || index >= mesh->num_parts)
+    {
+        bcLogWarning("Invalid mesh part: %d", index);
+        return bcPartFromMesh(mesh);
+    }
+    BCMeshPart part = { mesh, mesh->parts[index].first, mesh->parts[index].count };
+    return part;
 }
 
-//
-// Mesh
-//
-
-BCMesh * bcCreateMesh(int format, const float *vert_data, int vert_num, const uint16_t *indx_data, int indx_num, BCMeshType type)
+BCMeshPart bcAttachMesh(BCMesh *mesh, BCMesh *src, bool destroy_src)
 {
-    if (type == BC_MESH_OPTIMIZED && !vert_data)
+    BCMeshPart part = bcPartFromMesh(mesh);
+    if (mesh == NULL)
     {
-        bcLogError("BC_MESH_OPTIMIZED must have data!");
-        return NULL;
+        bcLogWarning("Mesh not locked!");
+        return part;
     }
-    BCMesh *mesh = NEW_OBJECT(BCMesh);
-    mesh->RM_type = RM_TYPE_MESH;
-    mesh->num_vertices = vert_num;
-    mesh->num_indices = indx_num;
-    mesh->format = format;
-    mesh->type = type;
-    // calculate components
-    mesh->comps[BC_VERTEX_ATTR_POSITIONS] =
-        (format & BC_MESH_POS2) ? 2 :
-        (format & BC_MESH_POS3) ? 3 :
-        (format & BC_MESH_POS4) ? 4 :
-        0;
-    mesh->comps[BC_VERTEX_ATTR_TEXCOORDS] =
-        (format & BC_MESH_TEX2) ? 2 :
-        (format & BC_MESH_TEX3) ? 3 :
-        0;
-    mesh->comps[BC_VERTEX_ATTR_NORMALS] =
-        (format & BC_MESH_NORM) ? 3 :
-        0;
-    mesh->comps[BC_VERTEX_ATTR_COLORS] =
-        (format & BC_MESH_COL1) ? 1 :
-        (format & BC_MESH_COL3) ? 3 :
-        (format & BC_MESH_COL4) ? 4 :
-        0;
-    for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
+    if (src == NULL)
     {
-        mesh->total_comps += mesh->comps[i];
+        bcLogError("Invalid meshe!");
+        return part;
     }
-    if (mesh->type == BC_MESH_OPTIMIZED)
+    // compare formats
+    if (src->format != mesh->format)
     {
-        // init VBOs
-        if (mesh->num_vertices)
-        {
-            glGenBuffers(1, &(mesh->vbo_vertices));
-            glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo_vertices);
-            glBufferData(GL_ARRAY_BUFFER, mesh->num_vertices * mesh->total_comps * sizeof(float), vert_data, GL_STATIC_DRAW);
-        }
-        // init vbo_indices
-        if (mesh->num_indices)
-        {
-            glGenBuffers(1, &(mesh->vbo_indices));
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo_indices);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->num_indices * sizeof(uint16_t), indx_data, GL_STATIC_DRAW);
-        }
+        bcLogError("Meshes format does not match!");
+        return part;
     }
-    else
+    int src_indices = (src->num_lods > 0) ? src->lods[0].count : src->num_indices;
+    if (src_indices > 0 && mesh->index_size == 2 && mesh->num_vertices + src->num_vertices > INDEX16_MAX_VERTICES && !checkIndexSupport(4))
     {
-        // allocate vertex and index data holders
-        if (mesh->num_vertices)
+        return part;
+    }
+    if (mesh->num_lods > 0)
+    {
+        // simplified levels don't cover the attached part
+        mesh->num_indices = mesh->lods[0].count;
+        mesh->num_lods = 0;
+    }
+    // fill vertex data
+    mesh->vertices = EXTEND_ARRAY(mesh->vertices, (mesh->num_vertices + src->num_vertices) * mesh->total_comps, float);
+    float *vert_ptr = &(mesh->vertices[mesh->num_vertices * mesh->total_comps]);
+    memcpy(vert_ptr, src->vertices, src->num_vertices * src->total_comps * sizeof(float));
+    part.start = mesh->num_vertices;
+    // fill index data
+    if (src_indices > 0)
+    {
+        if (mesh->index_size == 2 && mesh->num_vertices + src->num_vertices > INDEX16_MAX_VERTICES)
         {
-            mesh->vertices = NEW_ARRAY(mesh->num_vertices * mesh->total_comps, float);
-            if (vert_data)
-                memcpy(mesh->vertices, vert_data, mesh->num_vertices * mesh->total_comps * sizeof(float));
+            // outgrew 16-bit indices, GPU buffers have the old width
+            uint32_t *indices32 = NEW_ARRAY(mesh->num_indices + src_indices, uint32_t);
+            copyIndices(indices32, 4, mesh->indices, 2, mesh->num_indices);
+            free(mesh->indices);
+            mesh->indices = indices32;
+            mesh->index_size = 4;
+            bcReleaseMesh(mesh);
+            if (g_Context->CurrentMesh == mesh)
+                g_Context->CurrentMesh = NULL;
         }
-        if (mesh->num_indices)
+        else
         {
-            mesh->indices = NEW_ARRAY(mesh->num_indices, uint16_t);
-            if (indx_data)
-                memcpy(mesh->indices, indx_data, mesh->num_indices * sizeof(uint16_t));
+            resizeMeshIndices(mesh, mesh->num_indices + src_indices);
         }
-        // update VBOs
-        if (g_Context->Started && (vert_data || indx_data))
+        for (int i = 0; i < src_indices; i++)
         {
-            bcUpdateMesh(mesh);
+            bcSetMeshIndex(mesh, mesh->num_indices + i, bcGetMeshIndex(src, i) + mesh->num_vertices);
         }
+        part.start = mesh->num_indices;
+        mesh->num_indices += src_indices;
     }
-    // draw params
-    mesh->draw_mode = GL_TRIANGLES;
-    mesh->draw_count = (mesh->num_indices > 0) ? mesh->num_indices : mesh->num_vertices;
-    clist_add_node(g_Context->RM_list, mesh);
-    return mesh;
+    // remember submeshes, the first one is what the mesh had before
+    if (mesh->num_parts == 0 && mesh->draw_count > 0)
+        appendMeshPart(mesh, 0, mesh->draw_count);
+    mesh->num_vertices += src->num_vertices;
+    mesh->draw_count += src->draw_count;
+    part.count = src->draw_count;
+    appendMeshPart(mesh, part.start, part.count);
+    if (mesh->type != BC_MESH_STREAM)
+    {
+        updateMeshBounds(mesh, mesh->vertices, mesh->num_vertices);
+    }
+    if (destroy_src)
+    {
+        bcDestroyMesh(src);
+    }
+    return part;
 }
 
-BCMesh * bcCopyMesh(BCMesh *src)
+static uint32_t hashData(const void *data, size_t size)
 {
-    if (src == NULL)
+    // FNV-1a over 64-bit words in four lanes, so the multiplies overlap
+    const uint8_t *bytes = (const uint8_t *) data;
+    uint64_t lanes[4] = { 14695981039346656037ull, 14695981039346656037ull ^ 1, 14695981039346656037ull ^ 2, 14695981039346656037ull ^ 3 };
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        uint64_t words[4];
+        memcpy(words, bytes + i, sizeof(words));
+        for (int k = 0; k < 4; k++)
+            lanes[k] = (lanes[k] ^ words[k]) * 1099511628211ull;
+    }
+    for (; i < size; i++)
+    {
+        lanes[0] = (lanes[0] ^ bytes[i]) * 1099511628211ull;
+    }
+    uint64_t hash = lanes[0];
+    for (int k = 1; k < 4; k++)
+        hash = (hash ^ lanes[k]) * 1099511628211ull;
+    return (uint32_t) (hash ^ (hash >> 32));
+}
+
+static bool checkIndexData(const void *indices, int index_size, int count, int num_vertices)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t index = (index_size == 4) ? ((const uint32_t *) indices)[i] : ((const uint16_t *) indices)[i];
+        if (index >= (uint32_t) num_vertices)
+            return false;
+    }
+    return true;
+}
+
+static bool checkFileRanges(const BCMeshRange *ranges, int count, int limit)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (ranges[i].first < 0 || ranges[i].count < 0 || ranges[i].first > limit || ranges[i].count > limit - ranges[i].first)
+            return false;
+    }
+    return true;
+}
+
+static void setMeshFileBounds(BCMesh *mesh, const float *bounds_min, const float *bounds_max, const float *bounds_center, float bounds_radius)
+{
+    // stored bounds are authoritative
+    memcpy(mesh->bounds_min, bounds_min, 3 * sizeof(float));
+    memcpy(mesh->bounds_max, bounds_max, 3 * sizeof(float));
+    memcpy(mesh->bounds_center, bounds_center, 3 * sizeof(float));
+    mesh->bounds_radius = bounds_radius;
+    mesh->has_bounds = true;
+}
+
+static BCMesh * loadMeshFileV1(const uint8_t *data, size_t size)
+{
+    BCMeshFileHeaderV1 header;
+    memset(&header, 0, sizeof(header));
+    memcpy(&header, data, MESH_FILE_HEADER_BASE_SIZE);
+    if ((header.size != MESH_FILE_HEADER_BASE_SIZE && header.size != MESH_FILE_HEADER_BOUNDS_SIZE && header.size != sizeof(header)) ||
+        header.size > size)
+    {
+        return NULL;
+    }
+    memcpy(&header, data, header.size);
+    if (header.size < sizeof(header) || header.num_lods > BC_MESH_MAX_LODS)
+    {
+        header.num_lods = 0;
+    }
+    int index_size = (header.index_size == 4) ? 4 : 2;
+    uint64_t vertex_size = (uint64_t) header.num_vertices * header.total_comps * sizeof(float);
+    uint64_t index_bytes = (uint64_t) header.num_indices * index_size;
+    if (header.size + vertex_size + index_bytes > size)
+        return NULL;
+    int comps[BC_VERTEX_ATTR_MAX];
+    if (getFormatComps(header.format, comps) != (int) header.total_comps)
     {
-        bcLogError("Invalid mesh!");
+        bcLogError("Vertex size doesn't match the format!");
         return NULL;
     }
-    BCMesh *mesh = bcCreateMesh(src->format, src->vertices, src->num_vertices, src->indices, src->num_indices, src->type);
-    if (src->num_vertices)
+    const uint8_t *vert_data = data + header.size;
+    const uint8_t *indx_data = vert_data + vertex_size;
+    BCMeshRange lods[BC_MESH_MAX_LODS];
+    for (uint32_t i = 0; i < header.num_lods; i++)
+        lods[i] = (BCMeshRange) { (int) header.lods[i][0], (int) header.lods[i][1] };
+    int draw_limit = header.num_indices ? (int) header.num_indices : (int) header.num_vertices;
+    if (!checkIndexData(indx_data, index_size, header.num_indices, header.num_vertices) ||
+        !checkFileRanges(lods, header.num_lods, draw_limit))
     {
-        memcpy(mesh->vertices, src->vertices, src->num_vertices * src->total_comps * sizeof(float));
+        return NULL;
     }
-    if (src->num_indices)
+    BCMesh *mesh = createMesh(header.format, (const float *) vert_data, header.num_vertices, indx_data, index_size, header.num_indices, (BCMeshType) header.type);
+    if (mesh && header.num_lods > 0)
+    {
+        memcpy(mesh->lods, lods, header.num_lods * sizeof(BCMeshRange));
+        mesh->num_lods = header.num_lods;
+        mesh->draw_count = mesh->lods[0].count;
+    }
+    if (mesh && header.size >= MESH_FILE_HEADER_BOUNDS_SIZE)
     {
-        memcpy(mesh->indices, src->indices, src->num_indices * sizeof(uint16_t));
+        setMeshFileBounds(mesh, header.bounds_min, header.bounds_max, header.bounds_center, header.bounds_radius);
     }
     return mesh;
 }
 
-void bcUpdateMesh(BCMesh *mesh)
+static bool checkFileSection(size_t file_size, uint32_t offset, uint64_t size)
 {
-    if (mesh == NULL)
+    return (offset % MESH_FILE_ALIGN) == 0 && offset + size <= file_size;
+}
+
+static BCMesh * loadMeshFileV2(const uint8_t *data, size_t size)
+{
+    BCMeshFileHeader header;
+    if (size < sizeof(header))
+        return NULL;
+    memcpy(&header, data, sizeof(header));
+    int index_size = (header.index_size == 4) ? 4 : 2;
+    uint64_t vertex_size = (uint64_t) header.num_vertices * header.vertex_stride;
+    uint64_t index_bytes = (uint64_t) header.num_indices * index_size;
+    int num_ranges = header.num_lods + header.num_parts;
+    bool compressed = (header.flags & MESH_FILE_COMPRESSED) != 0;
+    if (compressed)
+    {
+        // section sizes come from their own tables
+        BCMeshFileCoded coded[2];
+        if (!checkFileSection(size, header.vertices_offset, sizeof(coded[0])) ||
+            !checkFileSection(size, header.indices_offset, sizeof(coded[1])) ||
+            header.vertex_stride % sizeof(float) != 0)
+        {
+            return NULL;
+        }
+        memcpy(&(coded[0]), data + header.vertices_offset, sizeof(coded[0]));
+        memcpy(&(coded[1]), data + header.indices_offset, sizeof(coded[1]));
+        vertex_size = coded[0].size;
+        index_bytes = coded[1].size;
+    }
+    if (header.header_size != sizeof(header) || header.file_size != size || (header.flags & ~MESH_FILE_KNOWN_FLAGS) ||
+        header.num_streams > BC_VERTEX_ATTR_MAX || header.num_lods > BC_MESH_MAX_LODS ||
+        !checkFileSection(size, header.streams_offset, header.num_streams * sizeof(BCMeshFileStream)) ||
+        !checkFileSection(size, header.ranges_offset, (uint64_t) num_ranges * sizeof(BCMeshRange)) ||
+        !checkFileSection(size, header.vertices_offset, vertex_size) ||
+        !checkFileSection(size, header.indices_offset, index_bytes))
     {
-        bcLogError("Invalid mesh!");
-        return;
+        return NULL;
     }
-    if (mesh->type == BC_MESH_OPTIMIZED)
+    // counts are ints from here on, and vertex data is addressed as floats
+    if (header.num_vertices > INT_MAX || header.num_indices > INT_MAX ||
+        (uint64_t) header.num_vertices * header.vertex_stride / sizeof(float) > INT_MAX)
     {
-        bcLogWarning("Can't update BC_MESH_OPTIMIZED");
-        return;
+        return NULL;
     }
-    if (mesh->type == BC_MESH_NO_VBO)
+    if (hashData(data + sizeof(header), size - sizeof(header)) != header.checksum)
     {
-        bcLogWarning("Can't update BC_MESH_NO_VBO");
-        return;
+        bcLogError("Mesh file checksum mismatch!");
+        return NULL;
     }
-    if (mesh->type == BC_MESH_STATIC)
+    // streams must cover the float layout of the format, in any order and stride
+    int comps[BC_VERTEX_ATTR_MAX] = { 0 };
+    int offsets[BC_VERTEX_ATTR_MAX] = { 0 };
+    const BCMeshFileStream *streams = (const BCMeshFileStream *) (data + header.streams_offset);
+    for (uint32_t i = 0; i < header.num_streams; i++)
     {
-        if (mesh->vbo_vertices)
+        const BCMeshFileStream *stream = &(streams[i]);
+        if (stream->attribute >= BC_VERTEX_ATTR_MAX || stream->type != GL_FLOAT || stream->comps > 4 ||
+            stream->offset + stream->comps * sizeof(float) > header.vertex_stride || stream->offset % sizeof(float))
         {
-            glDeleteBuffers(1, &(mesh->vbo_vertices));
-            mesh->vbo_vertices = 0;
+            bcLogError("Unsupported vertex stream!");
+            return NULL;
         }
-        if (mesh->vbo_indices)
+        if (stream->compact_flags != (header.format & s_CompactAttribFlags[stream->attribute]))
         {
-            glDeleteBuffers(1, &(mesh->vbo_indices));
-            mesh->vbo_indices = 0;
+            bcLogError("Vertex streams don't match the format!");
+            return NULL;
         }
+        comps[stream->attribute] = stream->comps;
+        offsets[stream->attribute] = stream->offset;
     }
-    if (mesh->num_vertices)
+    const uint8_t *vert_bytes = data + header.vertices_offset;
+    const uint8_t *indx_data = data + header.indices_offset;
+    uint8_t *decoded = NULL;
+    if (compressed)
     {
-        if (mesh->vbo_vertices)
-        {
-            glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo_vertices);
-            glBufferSubData(GL_ARRAY_BUFFER, 0, mesh->num_vertices * mesh->total_comps * sizeof(float), mesh->vertices);
-        }
-        else
+        decoded = decodeMeshSections(vert_bytes, header.num_vertices, header.vertex_stride / sizeof(float), indx_data, header.num_indices, index_size);
+        if (decoded == NULL)
         {
-            glGenBuffers(1, &(mesh->vbo_vertices));
-            glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo_vertices);
-            glBufferData(GL_ARRAY_BUFFER, mesh->num_vertices * mesh->total_comps * sizeof(float),
-                mesh->vertices,
-                (mesh->type == BC_MESH_STATIC) ? GL_STATIC_DRAW : GL_DYNAMIC_DRAW);
+            bcLogError("Can't decode mesh file!");
+            return NULL;
         }
+        vert_bytes = decoded;
+        indx_data = decoded + (size_t) header.num_vertices * header.vertex_stride;
     }
-    if (mesh->num_indices)
+    const BCMeshRange *ranges = (const BCMeshRange *) (data + header.ranges_offset);
+    int draw_limit = header.num_indices ? (int) header.num_indices : (int) header.num_vertices;
+    if (!checkIndexData(indx_data, index_size, header.num_indices, header.num_vertices) ||
+        !checkFileRanges(ranges, num_ranges, draw_limit))
     {
-        if (mesh->vbo_indices)
-        {
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo_indices);
-            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, mesh->num_indices * sizeof(uint16_t), mesh->indices);
-        }
-        else
+        free(decoded);
+        return NULL;
+    }
+    int format_comps[BC_VERTEX_ATTR_MAX];
+    getFormatComps(header.format, format_comps);
+    if (memcmp(format_comps, comps, sizeof(comps)) != 0)
+    {
+        bcLogError("Vertex streams don't match the format!");
+        free(decoded);
+        return NULL;
+    }
+    // interleaved floats in mesh order are used in place, anything else is gathered once
+    int total_comps = 0;
+    bool in_place = true;
+    for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
+    {
+        in_place = in_place && (comps[i] == 0 || offsets[i] == total_comps * (int) sizeof(float));
+        total_comps += comps[i];
+    }
+    in_place = in_place && header.vertex_stride == total_comps * sizeof(float);
+    const float *vert_data = (const float *) vert_bytes;
+    float *gathered = NULL;
+    if (!in_place)
+    {
+        gathered = NEW_ARRAY(header.num_vertices * total_comps, float);
+        for (uint32_t v = 0; v < header.num_vertices; v++)
         {
-            glGenBuffers(1, &(mesh->vbo_indices));
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo_indices);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->num_indices * sizeof(uint16_t),
-                mesh->indices,
-                (mesh->type == BC_MESH_STATIC) ? GL_STATIC_DRAW : GL_DYNAMIC_DRAW);
+            float *dst = gathered + v * total_comps;
+            const uint8_t *src = vert_bytes + v * header.vertex_stride;
+            for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
+            {
+                memcpy(dst, src + offsets[i], comps[i] * sizeof(float));
+                dst += comps[i];
+            }
         }
+        vert_data = gathered;
     }
-    // reset state machine
-    if (g_Context->CurrentMesh)
+    BCMesh *mesh = createMesh(header.format, vert_data, header.num_vertices, indx_data, index_size, header.num_indices, (BCMeshType) header.type);
+    free(gathered);
+    free(decoded);
+    if (mesh == NULL)
+        return NULL;
+    if (header.num_lods > 0)
     {
-        bcBindMesh(NULL);
+        memcpy(mesh->lods, ranges, header.num_lods * sizeof(BCMeshRange));
+        mesh->num_lods = header.num_lods;
+        mesh->draw_count = mesh->lods[0].count;
+    }
+    if (header.num_parts > 0)
+    {
+        mesh->parts = NEW_ARRAY(header.num_parts, BCMeshRange);
+        memcpy(mesh->parts, ranges + header.num_lods, header.num_parts * sizeof(BCMeshRange));
+        mesh->num_parts = header.num_parts;
+    }
+    if (header.flags & MESH_FILE_HAS_BOUNDS)
+    {
+        setMeshFileBounds(mesh, header.bounds_min, header.bounds_max, header.bounds_center, header.bounds_radius);
     }
+    return mesh;
 }
 
-void bcReleaseMesh(BCMesh *mesh)
+BCMesh * bcCreateMeshFromFile(const char *filename)
 {
-    if (mesh == NULL)
+    BCFile *file = bcOpenFile(filename, BC_FILE_READ_DATA);
+    if (!file)
     {
-        bcLogError("Invalid mesh!");
-        return;
+        bcLogError("Can't open file: %s", filename);
+        return NULL;
     }
-    if (mesh->vbo_vertices)
+    // vertex and index data go to the mesh straight from the mapping
+    const uint8_t *data = (const uint8_t *) bcMapFile(file);
+    uint8_t *buffer = NULL;
+    size_t size = file->length;
+    if (data == NULL && size > 0)
     {
-        glDeleteBuffers(1, &(mesh->vbo_vertices));
-        mesh->vbo_vertices = 0;
+        buffer = (uint8_t *) malloc(size);
+        size = bcReadFile(file, buffer, size);
+        data = buffer;
     }
-    if (mesh->vbo_indices)
+    BCMesh *mesh = NULL;
+    uint32_t version = 0;
+    if (data && size >= MESH_FILE_HEADER_BASE_SIZE && memcmp(data, s_MeshFileSignature, 4) == 0)
     {
-        glDeleteBuffers(1, &(mesh->vbo_indices));
-        mesh->vbo_indices = 0;
+        memcpy(&version, data + 4, sizeof(version));
+        if (version == 1)
+            mesh = loadMeshFileV1(data, size);
+        else if (version == s_MeshFileVersion)
+            mesh = loadMeshFileV2(data, size);
     }
-}
-
-void bcDestroyMesh(BCMesh *mesh)
-{
+    free(buffer);
+    bcCloseFile(file);
     if (mesh == NULL)
     {
-        bcLogError("Invalid mesh!");
-        return;
+        bcLogError("Invalid mesh file: %s", filename);
     }
-    bcReleaseMesh(mesh);
-    free(mesh->vertices);
-    free(mesh->indices);
-    free(mesh);
-    clist_delete_node(g_Context->RM_list, mesh);
+    return mesh;
 }
 
-void bcDrawMesh(BCMesh *mesh)
+static bool saveMeshFile(BCMesh *mesh, const char *filename, bool compress, int bits)
 {
-    if (mesh == NULL)
+    if (mesh == NULL || (mesh->num_vertices && mesh->vertices == NULL))
     {
         bcLogError("Invalid mesh!");
-        return;
+        return false;
     }
-    bcDrawMeshRange(mesh, 0, mesh->draw_count);
-}
-
-void bcBindMesh(BCMesh *mesh)
-{
-    if (g_Context->CurrentMesh == mesh)
+    BCFile *file = bcOpenFile(filename, BC_FILE_WRITE_DATA);
+    if (!file)
     {
-        bcLogWarning("Mesh already assigned!");
-        return;
+        bcLogError("Can't write to file: %s", filename);
+        return false;
     }
-    if (mesh == NULL)
+    BCMeshFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.signature, s_MeshFileSignature, 4);
+    header.version = s_MeshFileVersion;
+    header.header_size = sizeof(header);
+    header.format = mesh->format;
+    header.type = mesh->type;
+    header.total_comps = mesh->total_comps;
+    header.num_vertices = mesh->num_vertices;
+    header.num_indices = mesh->num_indices;
+    header.index_size = mesh->index_size;
+    header.vertex_stride = mesh->total_comps * sizeof(float);
+    header.num_lods = mesh->num_lods;
+    header.num_parts = mesh->num_parts;
+    if (mesh->has_bounds)
+    {
+        header.flags |= MESH_FILE_HAS_BOUNDS;
+        memcpy(header.bounds_min, mesh->bounds_min, sizeof(header.bounds_min));
+        memcpy(header.bounds_max, mesh->bounds_max, sizeof(header.bounds_max));
+        memcpy(header.bounds_center, mesh->bounds_center, sizeof(header.bounds_center));
+        header.bounds_radius = mesh->bounds_radius;
+    }
+    // sections start 16 byte aligned so a mapped file can be used in place
+    BCMeshFileStream streams[BC_VERTEX_ATTR_MAX];
+    int offset = 0;
+    for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
     {
-        // unbind mesh
-#ifdef SUPPORT_GLSL
-        for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
-        {
-            glDisableVertexAttribArray(i);
-        }
-#else
-        glDisableClientState(GL_VERTEX_ARRAY);
-        glDisableClientState(GL_NORMAL_ARRAY);
-        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-        glDisableClientState(GL_COLOR_ARRAY);
-#endif
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    }
-    else
+        if (mesh->comps[i] == 0)
+            continue;
+        BCMeshFileStream *stream = &(streams[header.num_streams++]);
+        stream->attribute = i;
+        stream->comps = mesh->comps[i];
+        stream->type = GL_FLOAT;
+        stream->compact_flags = mesh->format & s_CompactAttribFlags[i];
+        stream->offset = offset;
+        offset += mesh->comps[i] * sizeof(float);
+    }
+    int ranges_size = (header.num_lods + header.num_parts) * sizeof(BCMeshRange);
+    int vertex_size = header.num_vertices * header.vertex_stride;
+    int index_bytes = header.num_indices * header.index_size;
+    const void *vertex_data = mesh->vertices;
+    const void *index_data = mesh->indices;
+    uint8_t *coded_vertices = NULL;
+    uint8_t *coded_indices = NULL;
+    if (compress)
+    {
+        header.flags |= MESH_FILE_COMPRESSED;
+        coded_vertices = encodeVertexSection(mesh->vertices, mesh->num_vertices, mesh->total_comps, bits, &vertex_size);
+        coded_indices = encodeIndexSection(mesh->indices, mesh->index_size, mesh->num_indices, &index_bytes);
+        vertex_data = coded_vertices;
+        index_data = coded_indices;
+    }
+    header.streams_offset = MESH_FILE_ALIGNED(sizeof(header));
+    header.ranges_offset = MESH_FILE_ALIGNED(header.streams_offset + header.num_streams * sizeof(BCMeshFileStream));
+    header.vertices_offset = MESH_FILE_ALIGNED(header.ranges_offset + ranges_size);
+    header.indices_offset = MESH_FILE_ALIGNED(header.vertices_offset + vertex_size);
+    header.file_size = header.indices_offset + index_bytes;
+    uint8_t *data = NEW_ARRAY(header.file_size, uint8_t);
+    memcpy(data + header.streams_offset, streams, header.num_streams * sizeof(BCMeshFileStream));
+    memcpy(data + header.ranges_offset, mesh->lods, header.num_lods * sizeof(BCMeshRange));
+    if (header.num_parts > 0)
+        memcpy(data + header.ranges_offset + header.num_lods * sizeof(BCMeshRange), mesh->parts, header.num_parts * sizeof(BCMeshRange));
+    if (vertex_size > 0)
+        memcpy(data + header.vertices_offset, vertex_data, vertex_size);
+    if (index_bytes > 0)
+        memcpy(data + header.indices_offset, index_data, index_bytes);
+    header.checksum = hashData(data + sizeof(header), header.file_size - sizeof(header));
+    memcpy(data, &header, sizeof(header));
+    bool written = (bcWriteFile(file, data, header.file_size) == header.file_size);
+    free(coded_vertices);
+    free(coded_indices);
+    free(data);
+    bcCloseFile(file);
+    if (!written)
     {
-        // bind mesh
-        glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo_vertices);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->vbo_indices);
-        float *vert_ptr = (mesh->vbo_vertices ? (float *) 0 : mesh->vertices);
-#ifdef SUPPORT_GLSL
-        for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
-        {
-            if (mesh->comps[i] > 0)
-            {
-                glEnableVertexAttribArray(i);
-                glVertexAttribPointer(i, mesh->comps[i], GL_FLOAT, GL_FALSE, mesh->total_comps * sizeof(float), vert_ptr);
-                vert_ptr += mesh->comps[i];
-            }
-            else
-            {
-                glDisableVertexAttribArray(i);
-            }
-        }
-        glUniform1i(g_Context->CurrentShader->loc_uniforms[BC_SHADER_UNIFORM_VERTEX_COLOR_ENABLED], mesh->comps[BC_VERTEX_ATTR_COLORS]);
-#else
-        for (int i = 0; i < BC_VERTEX_ATTR_MAX; i++)
-        {
-            if (mesh->comps[i] > 0)
-            {
-                glEnableClientState(s_ClientStateType[i].type);
-                switch (i)
-                {
-                case BC_VERTEX_ATTR_POSITIONS:
-                    glVertexPointer(mesh->comps[i], GL_FLOAT, mesh->total_comps * sizeof(float), vert_ptr);
-                    break;
-                case BC_VERTEX_ATTR_NORMALS:
-                    glNormalPointer(GL_FLOAT, mesh->total_comps * sizeof(float), vert_ptr);
-                    break;
-                case BC_VERTEX_ATTR_TEXCOORDS:
-                    glTexCoordPointer(mesh->comps[i], GL_FLOAT, mesh->total_comps * sizeof(float), vert_ptr);
-                    break;
-                case BC_VERTEX_ATTR_COLORS:
-                    glColorPointer(mesh->comps[i], GL_FLOAT, mesh->total_comps * sizeof(float), vert_ptr);
-                    break;
-                }
-                vert_ptr += mesh->comps[i];
-            }
-            else
-            {
-                glDisableClientState(s_ClientStateType[i].type);
-            }
-        }
-#endif
+        bcLogError("Can't write to file: %s", filename);
     }
-    g_Context->CurrentMesh = mesh;
+    return written;
 }
 
-void bcDrawMeshPart(BCMeshPart part)
+bool bcSaveMeshToFile(BCMesh *mesh, const char *filename)
 {
-    bcDrawMeshRange(part.mesh, part.start, part.count);
+    return saveMeshFile(mesh, filename, false, 0);
 }
 
-void bcDrawMeshRange(BCMesh *mesh, int start, int count)
+bool bcSaveMeshToFileCompressed(BCMesh *mesh, const char *filename, int bits)
 {
-    if (mesh == NULL)
-    {
-        bcLogError("Invalid mesh!");
-        return;
-    }
-    if (g_Context->CurrentMesh != mesh)
-    {
-        bcBindMesh(mesh);
-    }
-    if (g_Context->ColorNeedUpdate)
-    {
-#ifdef SUPPORT_GLSL
-        glUniform4fv(g_Context->CurrentShader->loc_uniforms[BC_SHADER_UNIFORM_COLOR_ARRAY], BC_COLOR_TYPE_MAX, (float *) g_Context->ColorArray);
-#else
-        glColor4fv((float *) &(g_Context->ColorArray[BC_COLOR_TYPE_PRIMARY]));
-        glMaterialfv(GL_FRONT, GL_DIFFUSE, (float *) &(g_Context->ColorArray[BC_COLOR_TYPE_DIFFUSE]));
-        glMaterialfv(GL_FRONT, GL_AMBIENT, (float *) &(g_Context->ColorArray[BC_COLOR_TYPE_AMBIENT]));
-        glMaterialfv(GL_FRONT, GL_SPECULAR, (float *) &(g_Context->ColorArray[BC_COLOR_TYPE_SPECULAR]));
-        glMaterialfv(GL_FRONT, GL_EMISSION, (float *) &(g_Context->ColorArray[BC_COLOR_TYPE_EMISSION]));
-#endif
-        g_Context->ColorNeedUpdate = false;
-    }
-    if (mesh->num_indices)
-    {
-        uint16_t *elem_start = (mesh->vbo_indices ? (uint16_t *) 0 : mesh->indices) + start;
-        glDrawElements(mesh->draw_mode, count, GL_UNSIGNED_SHORT, elem_start);
-    }
-    else
+    if (bits < 0 || bits > 16)
     {
-        glDrawArrays(mesh->draw_mode, start, count);
+        bcLogError("Invalid quantization bits: %d", bits);
+        return false;
     }
+    return saveMeshFile(mesh, filename, true, bits);
 }
 
-BCMeshPart bcPartFromMesh(BCMesh *mesh)
+//
+// Sprite Batch
+//
+
+static int compareSprites(const void *a, const void *b)
 {
-    BCMeshPart part = { mesh, 0, mesh->draw_count };
-    return part;
+    const BCSprite *sa = (const BCSprite *) a;
+    const BCSprite *sb = (const BCSprite *) b;
+    if (sa->texture != sb->texture)
+        return ((uintptr_t) sa->texture < (uintptr_t) sb->texture) ? -1 : 1;
+    return sa->order - sb->order;
 }
 
-BCMeshPart bcAttachMesh(BCMesh *mesh, BCMesh *src, bool destroy_src)
+static BCMesh * getSpriteBatchMesh()
 {
-    BCMeshPart part = bcPartFromMesh(mesh);
-    if (mesh == NULL)
+    if (g_Context->SpriteBatchMesh == NULL)
     {
-        bcLogWarning("Mesh not locked!");
-        return part;
+        // index pattern never changes, only vertices are filled per flush
+        uint16_t *indices = NEW_ARRAY(SPRITE_BATCH_SIZE * 6, uint16_t);
+        for (int i = 0; i < SPRITE_BATCH_SIZE; i++)
+        {
+            indices[i * 6 + 0] = i * 4 + 0;
+            indices[i * 6 + 1] = i * 4 + 1;
+            indices[i * 6 + 2] = i * 4 + 2;
+            indices[i * 6 + 3] = i * 4 + 2;
+            indices[i * 6 + 4] = i * 4 + 3;
+            indices[i * 6 + 5] = i * 4 + 0;
+        }
+        g_Context->SpriteBatchMesh = bcCreateMesh(BC_MESH_POS3 | BC_MESH_TEX2 | BC_MESH_COL4,
+            NULL, SPRITE_BATCH_SIZE * 4, indices, SPRITE_BATCH_SIZE * 6, BC_MESH_STREAM);
+        free(indices);
     }
-    if (src == NULL)
+    return g_Context->SpriteBatchMesh;
+}
+
+static void drawSpriteChunk(BCSprite *sprites, int count)
+{
+    BCMesh *mesh = getSpriteBatchMesh();
+    float *vert_ptr = mesh->vertices;
+    for (int i = 0; i < count; i++)
     {
-        bcLogError("Invalid meshe!");
-        return part;
+        BCSprite *sprite = &sprites[i];
+        for (int j = 0; j < 4; j++)
+        {
+            *vert_ptr++ = sprite->pos[j][0];
+            *vert_ptr++ = sprite->pos[j][1];
+            *vert_ptr++ = sprite->pos[j][2];
+            *vert_ptr++ = (j == 1 || j == 2) ? sprite->uv[0] + sprite->uv[2] : sprite->uv[0];
+            *vert_ptr++ = (j == 2 || j == 3) ? sprite->uv[1] + sprite->uv[3] : sprite->uv[1];
+            *vert_ptr++ = sprite->color.r;
+            *vert_ptr++ = sprite->color.g;
+            *vert_ptr++ = sprite->color.b;
+            *vert_ptr++ = sprite->color.a;
+        }
     }
-    // compare formats
-    if (src->format != mesh->format)
+    // upload only what was written, the index pattern lives in a static buffer
+    if (g_Context->SpriteIndexBuffer == 0)
     {
-        bcLogError("Meshes format does not match!");
-        return part;
+        glGenBuffers(1, &(g_Context->SpriteIndexBuffer));
+        bindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_Context->SpriteIndexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, SPRITE_BATCH_SIZE * 6 * sizeof(uint16_t), mesh->indices, GL_STATIC_DRAW);
     }
-    // fill vertex data
-    mesh->vertices = EXTEND_ARRAY(mesh->vertices, (mesh->num_vertices + src->num_vertices) * mesh->total_comps, float);
-    float *vert_ptr = &(mesh->vertices[mesh->num_vertices * mesh->total_comps]);
-    memcpy(vert_ptr, src->vertices, src->num_vertices * src->total_comps * sizeof(float));
-    part.start = mesh->num_vertices;
-    // fill index data
-    if (src->num_indices > 0)
+    streamMesh(mesh, count * 4, 0);
+    mesh->vbo_indices = g_Context->SpriteIndexBuffer;
+    mesh->ibo_offset = 0;
+    // one draw per texture run
+    int start = 0;
+    for (int i = 1; i <= count; i++)
     {
-        mesh->indices = EXTEND_ARRAY(mesh->indices, mesh->num_indices + src->num_indices, uint16_t);
-        uint16_t *indx_ptr = &(mesh->indices[mesh->num_indices]);
-        for (int i = 0; i < src->num_indices; i++)
+        if (i == count || sprites[i].texture != sprites[start].texture)
         {
-            indx_ptr[i] = src->indices[i] + mesh->num_vertices;
+            bcBindTexture(sprites[start].texture);
+            bcDrawMeshRange(mesh, start * 6, (i - start) * 6);
+            start = i;
         }
-        part.start = mesh->num_indices;
-        mesh->num_indices += src->num_indices;
     }
-    mesh->num_vertices += src->num_vertices;
-    mesh->draw_count += src->draw_count;
-    part.count = src->draw_count;
-    if (destroy_src)
+}
+
+static void flushSpriteBatch()
+{
+    if (g_Context->SpriteBatchCount == 0)
+        return;
+    if (g_Context->SpriteBatchSort)
     {
-        bcDestroyMesh(src);
+        qsort(g_Context->SpriteBatch, g_Context->SpriteBatchCount, sizeof(BCSprite), compareSprites);
     }
-    return part;
+    // positions are already in eye space
+    mat4_t mv = g_Context->ModelViewMatrix;
+    bcSetModelViewMatrix(mat4_identity().v);
+    for (int i = 0; i < g_Context->SpriteBatchCount; i += SPRITE_BATCH_SIZE)
+    {
+        int n = g_Context->SpriteBatchCount - i;
+        drawSpriteChunk(&(g_Context->SpriteBatch[i]), n < SPRITE_BATCH_SIZE ? n : SPRITE_BATCH_SIZE);
+    }
+    bcSetModelViewMatrix(mv.v);
+    bcBindTexture(NULL);
+    g_Context->SpriteBatchCount = 0;
 }
 
-BCMesh * bcCreateMeshFromFile(const char *filename)
+void bcBeginSpriteBatch(bool sort)
 {
-    BCFile *file = bcOpenFile(filename, BC_FILE_READ_DATA);
-    if (!file)
+    if (g_Context->SpriteBatchActive)
     {
-        bcLogError("Can't open file: %s", filename);
-        return NULL;
+        bcLogWarning("Sprite batch already started!");
+        return;
     }
-    BCMeshFileHeader header;
-    bcReadFile(file, &header, sizeof(header));
-    if (header.signature[0] != s_MeshFileSignature[0] ||
-        header.signature[1] != s_MeshFileSignature[1] ||
-        header.signature[2] != s_MeshFileSignature[2] ||
-        header.signature[3] != s_MeshFileSignature[3] ||
-        header.version != s_MeshFileVersion ||
-        header.size != sizeof(header))
-    {
-        bcLogError("Invalid mesh file!");
-        bcCloseFile(file);
-        return NULL;
+    g_Context->SpriteBatchActive = true;
+    g_Context->SpriteBatchSort = sort;
+    g_Context->SpriteBatchCount = 0;
+}
+
+void bcDrawSprite(BCTexture *texture, float x, float y, float w, float h, float sx, float sy, float sw, float sh)
+{
+    if (!g_Context->SpriteBatchActive)
+    {
+        bcLogWarning("Sprite batch not started!");
+        return;
     }
-    float *vert_data = NEW_ARRAY(header.num_vertices * header.total_comps, float);
-    bcReadFile(file, vert_data, header.num_vertices * header.total_comps * sizeof(float));
-    uint16_t *indx_data = NEW_ARRAY(header.num_indices, uint16_t);
-    bcReadFile(file, indx_data, header.num_indices * sizeof(uint16_t));
-    bcCloseFile(file);
-    BCMesh *mesh = bcCreateMesh(header.format, vert_data, header.num_vertices, indx_data, header.num_indices, (BCMeshType) header.type);
-    free(vert_data);
-    free(indx_data);
-    return mesh;
+    if (g_Context->SpriteBatchCount == g_Context->SpriteBatchCapacity)
+    {
+        g_Context->SpriteBatchCapacity = g_Context->SpriteBatchCapacity ? g_Context->SpriteBatchCapacity * 2 : 1024;
+        g_Context->SpriteBatch = EXTEND_ARRAY(g_Context->SpriteBatch, g_Context->SpriteBatchCapacity, BCSprite);
+    }
+    BCSprite *sprite = &(g_Context->SpriteBatch[g_Context->SpriteBatchCount]);
+    sprite->texture = texture;
+    sprite->order = g_Context->SpriteBatchCount;
+    sprite->uv[0] = sx;
+    sprite->uv[1] = sy;
+    sprite->uv[2] = sw;
+    sprite->uv[3] = sh;
+    sprite->color = g_Context->ColorArray[BC_COLOR_TYPE_PRIMARY];
+    // bake current modelview so matrix changes between sprites don't break the batch
+    const float corners[4][2] = { { x, y }, { x + w, y }, { x + w, y + h }, { x, y + h } };
+    mat4_t *m = &(g_Context->ModelViewMatrix);
+    for (int i = 0; i < 4; i++)
+    {
+        float cx = corners[i][0];
+        float cy = corners[i][1];
+        sprite->pos[i][0] = m->m00 * cx + m->m01 * cy + m->m03;
+        sprite->pos[i][1] = m->m10 * cx + m->m11 * cy + m->m13;
+        sprite->pos[i][2] = m->m20 * cx + m->m21 * cy + m->m23;
+    }
+    g_Context->SpriteBatchCount++;
 }
 
-bool bcSaveMeshToFile(BCMesh *mesh, const char *filename)
+void bcEndSpriteBatch()
 {
-    BCFile *file = bcOpenFile(filename, BC_FILE_WRITE_DATA);
-    if (!file)
+    if (!g_Context->SpriteBatchActive)
     {
-        bcLogError("Can't write to file: %s", filename);
-        return false;
+        bcLogWarning("Sprite batch not started!");
+        return;
     }
-    BCMeshFileHeader header;
-    header.signature[0] = s_MeshFileSignature[0];
-    header.signature[1] = s_MeshFileSignature[1];
-    header.signature[2] = s_MeshFileSignature[2];
-    header.signature[3] = s_MeshFileSignature[3];
-    header.version = s_MeshFileVersion;
-    header.size = sizeof(header);
-    header.reserved = 0;
-    header.format = mesh->format;
-    header.type = mesh->type;
-    header.total_comps = mesh->total_comps;
-    header.num_vertices = mesh->num_vertices;
-    header.num_indices = mesh->num_indices;
-    bcWriteFile(file, &header, sizeof(header));
-    bcWriteFile(file, mesh->vertices, mesh->num_vertices * mesh->total_comps * sizeof(float));
-    bcWriteFile(file, mesh->indices, mesh->num_indices * sizeof(uint16_t));
-    bcCloseFile(file);
-    return true;
+    flushSpriteBatch();
+    g_Context->SpriteBatchActive = false;
 }
 
 //
@@ -1432,9 +6570,14 @@ static struct
 
 bool bcBegin(BCDrawMode mode)
 {
+    if (g_Context->SpriteBatchActive)
+    {
+        // keep the draw order of non-batched geometry
+        flushSpriteBatch();
+    }
     if (g_Context->ReusableSolidMesh == NULL)
     {
-        g_Context->ReusableSolidMesh = bcCreateMesh(BC_MESH_POS3 | BC_MESH_NORM | BC_MESH_TEX2 | BC_MESH_COL4, NULL, 1024, NULL, 1024, BC_MESH_DYNAMIC);
+        g_Context->ReusableSolidMesh = bcCreateMesh(BC_MESH_POS3 | BC_MESH_NORM | BC_MESH_TEX2 | BC_MESH_COL4, NULL, 1024, NULL, 1024, BC_MESH_STREAM);
     }
     int ret = bcBeginMesh(g_Context->ReusableSolidMesh, mode);
     if (ret)
@@ -1508,10 +6651,45 @@ void bcEndMesh(BCMesh *mesh)
     g_Context->TempMesh->draw_count = (g_Context->TempMesh->num_indices > 0) ? g_Context->IndexCounter : g_Context->VertexCounter;
     g_Context->TempMesh = NULL;
     // finish mesh
-    if (mesh->type != BC_MESH_NO_VBO)
+    if (mesh->type == BC_MESH_STREAM)
     {
-        bcUpdateMesh(mesh);
+        streamMesh(mesh, g_Context->VertexCounter, g_Context->IndexCounter);
+    }
+    else
+    {
+        // once, over the written vertices only
+        updateMeshBounds(mesh, mesh->vertices, g_Context->VertexCounter);
+        if (mesh->type != BC_MESH_NO_VBO)
+        {
+            // only the written part changed
+            bcMarkMeshDirty(mesh, 0, g_Context->VertexCounter);
+            bcMarkMeshIndicesDirty(mesh, 0, g_Context->IndexCounter);
+            updateMesh(mesh, false);
+        }
+    }
+}
+
+static bool growTempMesh(bool indices)
+{
+    // only streamed meshes can grow, others have fixed size
+    BCMesh *mesh = g_Context->TempMesh;
+    if (mesh->type != BC_MESH_STREAM)
+        return false;
+    if (indices)
+    {
+        mesh->num_indices = mesh->num_indices ? mesh->num_indices * 2 : 1024;
+        resizeMeshIndices(mesh, mesh->num_indices);
+    }
+    else
+    {
+        if (mesh->num_vertices >= STREAM_MAX_VERTICES)
+            return false;
+        mesh->num_vertices = mesh->num_vertices ? mesh->num_vertices * 2 : 1024;
+        if (mesh->num_vertices > STREAM_MAX_VERTICES)
+            mesh->num_vertices = STREAM_MAX_VERTICES;
+        mesh->vertices = EXTEND_ARRAY(mesh->vertices, mesh->num_vertices * mesh->total_comps, float);
     }
+    return true;
 }
 
 static void pushTempVertex()
@@ -1535,7 +6713,8 @@ int bcVertex3f(float x, float y, float z)
         bcLogWarning("Mesh not locked!");
         return -1;
     }
-    if (g_Context->VertexCounter == g_Context->TempMesh->num_vertices)
+    if (g_Context->VertexCounter == g_Context->TempMesh->num_vertices &&
+        !growTempMesh(false))
     {
         bcLogWarning("Mesh limit reached!");
         return -1;
@@ -1557,12 +6736,13 @@ void bcIndexi(int i)
         bcLogWarning("Mesh not locked!");
         return;
     }
-    if (g_Context->IndexCounter == g_Context->TempMesh->num_indices)
+    if (g_Context->IndexCounter == g_Context->TempMesh->num_indices &&
+        !growTempMesh(true))
     {
         bcLogWarning("Mesh limit reached!");
         return;
     }
-    g_Context->TempMesh->indices[g_Context->IndexCounter++] = i;
+    bcSetMeshIndex(g_Context->TempMesh, g_Context->IndexCounter++, i);
 }
 
 void bcTexCoord2f(float u, float v)
@@ -1750,6 +6930,11 @@ void bcPrepareSceneGUI()
 
 void bcDrawTexture2D(BCTexture *texture, float x, float y, float w, float h, float sx, float sy, float sw, float sh)
 {
+    if (g_Context->SpriteBatchActive)
+    {
+        bcDrawSprite(texture, x, y, w, h, sx, sy, sw, sh);
+        return;
+    }
     bcBindTexture(texture);
     bcBegin(BC_TRIANGLES);
     bcTexCoord2f(sx, sy);
@@ -1769,6 +6954,14 @@ void bcDrawTexture2D(BCTexture *texture, float x, float y, float w, float h, flo
 
 void bcDrawRect2D(float x, float y, float w, float h, bool fill)
 {
+    if (g_Context->SpriteBatchActive)
+    {
+        if (fill)
+        {
+            bcDrawSprite(g_Context->CurrentTexture, x, y, w, h, 0, 0, 1, 1);
+            return;
+        }
+    }
     bcBegin(fill ? BC_QUADS : BC_LINE_LOOP);
     bcTexCoord2f(0, 0);
     bcVertex2f(x, y);
@@ -2411,21 +7604,22 @@ void bcDumpMesh(BCMesh *mesh, FILE *stream)
             fprintf(stream, "\n");
         }
     }
-    // faces
-    if (mesh->num_indices > 0)
+    // faces, simplified levels are skipped
+    int num_indices = (mesh->num_lods > 0) ? mesh->lods[0].count : mesh->num_indices;
+    if (num_indices > 0)
     {
-        if (mesh->num_indices % 3)
+        if (num_indices % 3)
         {
             bcLogWarning("Invalid number of indicies!");
         }
         else
         {
-            for (int i = 0; i < mesh->num_indices; i += 3)
+            for (int i = 0; i < num_indices; i += 3)
             {
                 fprintf(stream, "f");
                 for (int j = 0; j < 3; j++)
                 {
-                    int ind = mesh->indices[i + j] + 1;
+                    int ind = bcGetMeshIndex(mesh, i + j) + 1;
                     fprintf(stream, " %d", ind);
                     if (vt_size > 0)
                     {
@@ -2448,25 +7642,789 @@ void bcDumpMesh(BCMesh *mesh, FILE *stream)
 
 bool bcGetMeshAABB(BCMesh *mesh, float *minv, float *maxv)
 {
-    if (!mesh || !mesh->vertices)
+    if (!mesh || !mesh->has_bounds)
+    {
+        bcLogWarning("Invalid mesh!");
+        return false;
+    }
+    memcpy(minv, mesh->bounds_min, 3 * sizeof(float));
+    memcpy(maxv, mesh->bounds_max, 3 * sizeof(float));
+    return true;
+}
+
+//
+// Mesh Optimizer
+//
+
+static uint32_t * readMeshIndices(BCMesh *mesh, int count)
+{
+    uint32_t *indices = NEW_ARRAY(count, uint32_t);
+    for (int i = 0; i < count; i++)
+    {
+        indices[i] = mesh->num_indices ? bcGetMeshIndex(mesh, i) : (uint32_t) i;
+    }
+    return indices;
+}
+
+static float getCacheMissRatio(const uint32_t *indices, int num_indices, int num_vertices)
+{
+    if (num_indices < 3)
+        return 0;
+    // FIFO cache, a vertex is resident while fewer than cache size misses happened since
+    int *timestamps = NEW_ARRAY(num_vertices, int);
+    int time = OPTIMIZE_FIFO_SIZE + 1;
+    int misses = 0;
+    for (int i = 0; i < num_indices; i++)
+    {
+        uint32_t v = indices[i];
+        if (time - timestamps[v] > OPTIMIZE_FIFO_SIZE)
+        {
+            timestamps[v] = time++;
+            misses++;
+        }
+    }
+    free(timestamps);
+    return (float) misses / (num_indices / 3);
+}
+
+static uint32_t hashVertex(const float *vertex, int comps)
+{
+    const uint8_t *bytes = (const uint8_t *) vertex;
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < comps * (int) sizeof(float); i++)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static int weldVertices(const float *vertices, int num_vertices, int comps, uint32_t *remap)
+{
+    // open addressing on the raw vertex bits, slots store vertex + 1
+    int table_size = 1;
+    while (table_size < num_vertices * 2)
+        table_size *= 2;
+    int *table = NEW_ARRAY(table_size, int);
+    int unique = 0;
+    for (int i = 0; i < num_vertices; i++)
+    {
+        const float *v = vertices + i * comps;
+        uint32_t slot = hashVertex(v, comps) & (table_size - 1);
+        while (table[slot] && memcmp(vertices + (table[slot] - 1) * comps, v, comps * sizeof(float)) != 0)
+        {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (table[slot])
+        {
+            remap[i] = remap[table[slot] - 1];
+        }
+        else
+        {
+            table[slot] = i + 1;
+            remap[i] = unique++;
+        }
+    }
+    free(table);
+    return unique;
+}
+
+static float * remapVertices(const float *vertices, int num_vertices, int comps, const uint32_t *remap, int new_count)
+{
+    // unused vertices are mapped to UINT32_MAX and dropped
+    float *result = NEW_ARRAY(new_count * comps, float);
+    for (int i = 0; i < num_vertices; i++)
+    {
+        if (remap[i] != UINT32_MAX)
+            memcpy(result + remap[i] * comps, vertices + i * comps, comps * sizeof(float));
+    }
+    return result;
+}
+
+static float getVertexScore(const float *cache_scores, const float *valence_scores, int cache_pos, int live_tris)
+{
+    if (live_tris == 0)
+        return -1;
+    float score = (cache_pos >= 0) ? cache_scores[cache_pos] : 0;
+    return score + valence_scores[(live_tris < OPTIMIZE_MAX_VALENCE) ? live_tris : OPTIMIZE_MAX_VALENCE];
+}
+
+static void optimizeVertexCache(uint32_t *indices, int num_indices, int num_vertices)
+{
+    // Forsyth's linear-speed ordering for an LRU post-transform cache
+    float cache_scores[OPTIMIZE_LRU_SIZE];
+    float valence_scores[OPTIMIZE_MAX_VALENCE + 1];
+    for (int i = 0; i < OPTIMIZE_LRU_SIZE; i++)
+    {
+        // the last triangle is in the cache regardless of order
+        cache_scores[i] = (i < 3) ? 0.75f : powf(1 - (float) (i - 3) / (OPTIMIZE_LRU_SIZE - 3), 1.5f);
+    }
+    valence_scores[0] = 0;
+    for (int i = 1; i <= OPTIMIZE_MAX_VALENCE; i++)
+    {
+        // vertices with few triangles left are finished first
+        valence_scores[i] = 2.0f / sqrtf((float) i);
+    }
+    int num_tris = num_indices / 3;
+    int *live = NEW_ARRAY(num_vertices, int);
+    int *offsets = NEW_ARRAY(num_vertices + 1, int);
+    int *adjacency = NEW_ARRAY(num_indices, int);
+    int *cache_pos = NEW_ARRAY(num_vertices, int);
+    float *vertex_scores = NEW_ARRAY(num_vertices, float);
+    float *tri_scores = NEW_ARRAY(num_tris, float);
+    bool *emitted = NEW_ARRAY(num_tris, bool);
+    uint32_t *output = NEW_ARRAY(num_indices, uint32_t);
+    // triangles of each vertex
+    for (int i = 0; i < num_indices; i++)
+        live[indices[i]]++;
+    for (int v = 0; v < num_vertices; v++)
+        offsets[v + 1] = offsets[v] + live[v];
+    for (int i = 0; i < num_indices; i++)
+    {
+        uint32_t v = indices[i];
+        adjacency[offsets[v] + cache_pos[v]++] = i / 3;
+    }
+    for (int v = 0; v < num_vertices; v++)
+    {
+        cache_pos[v] = -1;
+        vertex_scores[v] = getVertexScore(cache_scores, valence_scores, -1, live[v]);
+    }
+    int best = 0;
+    for (int t = 0; t < num_tris; t++)
+    {
+        tri_scores[t] = vertex_scores[indices[t * 3 + 0]] + vertex_scores[indices[t * 3 + 1]] + vertex_scores[indices[t * 3 + 2]];
+        if (tri_scores[t] > tri_scores[best])
+            best = t;
+    }
+    int cache[OPTIMIZE_LRU_SIZE + 3];
+    int cache_count = 0;
+    int next_input = 0;
+    for (int out = 0; out < num_tris; out++)
+    {
+        if (best < 0)
+        {
+            // dead end, continue with the input order
+            while (emitted[next_input])
+                next_input++;
+            best = next_input;
+        }
+        emitted[best] = true;
+        int new_cache[OPTIMIZE_LRU_SIZE + 3];
+        int new_count = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = indices[best * 3 + k];
+            output[out * 3 + k] = v;
+            // drop the triangle from the vertex
+            int *tris = adjacency + offsets[v];
+            for (int j = 0; j < live[v]; j++)
+            {
+                if (tris[j] == best)
+                {
+                    tris[j] = tris[live[v] - 1];
+                    live[v]--;
+                    break;
+                }
+            }
+            bool cached = false;
+            for (int j = 0; j < new_count; j++)
+                cached = cached || (new_cache[j] == (int) v);
+            if (!cached)
+                new_cache[new_count++] = v;
+        }
+        for (int i = 0; i < cache_count; i++)
+        {
+            int v = cache[i];
+            if (v != new_cache[0] && (new_count < 2 || v != new_cache[1]) && (new_count < 3 || v != new_cache[2]))
+                new_cache[new_count++] = v;
+        }
+        // rescore the touched vertices, evicted ones lose the cache bonus
+        for (int i = 0; i < new_count; i++)
+        {
+            int v = new_cache[i];
+            cache_pos[v] = (i < OPTIMIZE_LRU_SIZE) ? i : -1;
+            float score = getVertexScore(cache_scores, valence_scores, cache_pos[v], live[v]);
+            float delta = score - vertex_scores[v];
+            vertex_scores[v] = score;
+            for (int j = 0; j < live[v]; j++)
+                tri_scores[adjacency[offsets[v] + j]] += delta;
+        }
+        cache_count = (new_count < OPTIMIZE_LRU_SIZE) ? new_count : OPTIMIZE_LRU_SIZE;
+        memcpy(cache, new_cache, cache_count * sizeof(int));
+        // next triangle comes from the cache
+        best = -1;
+        for (int i = 0; i < cache_count; i++)
+        {
+            int v = cache[i];
+            for (int j = 0; j < live[v]; j++)
+            {
+                int t = adjacency[offsets[v] + j];
+                if (best < 0 || tri_scores[t] > tri_scores[best])
+                    best = t;
+            }
+        }
+    }
+    memcpy(indices, output, num_indices * sizeof(uint32_t));
+    free(live);
+    free(offsets);
+    free(adjacency);
+    free(cache_pos);
+    free(vertex_scores);
+    free(tri_scores);
+    free(emitted);
+    free(output);
+}
+
+static int compareClusters(const void *a, const void *b)
+{
+    const BCMeshCluster *ca = (const BCMeshCluster *) a;
+    const BCMeshCluster *cb = (const BCMeshCluster *) b;
+    if (ca->sort_key != cb->sort_key)
+        return (ca->sort_key > cb->sort_key) ? -1 : 1;
+    return ca->first - cb->first;
+}
+
+static void getTrianglePosition(const float *vertices, int comps, int pos_comps, uint32_t index, float *out)
+{
+    const float *v = vertices + index * comps;
+    for (int j = 0; j < 3; j++)
+        out[j] = (j < pos_comps) ? v[j] : 0;
+}
+
+static void optimizeOverdraw(uint32_t *indices, int num_indices, const float *vertices, int num_vertices, int comps, int pos_comps)
+{
+    // Sander et al.: split the cache friendly order into clusters, draw outer facing clusters first
+    int num_tris = num_indices / 3;
+    float acmr_limit = getCacheMissRatio(indices, num_indices, num_vertices) * OPTIMIZE_OVERDRAW_THRESHOLD;
+    BCMeshCluster *clusters = NEW_ARRAY(num_tris, BCMeshCluster);
+    int num_clusters = 0;
+    int *timestamps = NEW_ARRAY(num_vertices, int);
+    int time = OPTIMIZE_FIFO_SIZE + 1;
+    int cluster_start = 0;
+    int cluster_misses = 0;
+    for (int t = 0; t < num_tris; t++)
+    {
+        int misses = 0;
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = indices[t * 3 + k];
+            if (time - timestamps[v] > OPTIMIZE_FIFO_SIZE)
+            {
+                timestamps[v] = time++;
+                misses++;
+            }
+        }
+        // a triangle missing all vertices starts a new strip anyway
+        if (misses == 3 && t > cluster_start)
+        {
+            clusters[num_clusters++] = (BCMeshCluster) { cluster_start, t - cluster_start, 0 };
+            cluster_start = t;
+            cluster_misses = 0;
+        }
+        cluster_misses += misses;
+        if ((float) cluster_misses / (t + 1 - cluster_start) <= acmr_limit)
+        {
+            // cut here, the next cluster starts with a cold cache
+            clusters[num_clusters++] = (BCMeshCluster) { cluster_start, t + 1 - cluster_start, 0 };
+            cluster_start = t + 1;
+            cluster_misses = 0;
+            time += OPTIMIZE_FIFO_SIZE + 1;
+        }
+    }
+    if (cluster_start < num_tris)
+    {
+        clusters[num_clusters++] = (BCMeshCluster) { cluster_start, num_tris - cluster_start, 0 };
+    }
+    free(timestamps);
+    // area weighted centroids and normals
+    float mesh_centroid[3] = { 0, 0, 0 };
+    float mesh_area = 0;
+    float *centroids = NEW_ARRAY(num_clusters * 3, float);
+    float *normals = NEW_ARRAY(num_clusters * 3, float);
+    for (int c = 0; c < num_clusters; c++)
+    {
+        float area = 0;
+        for (int t = clusters[c].first; t < clusters[c].first + clusters[c].count; t++)
+        {
+            float p0[3], p1[3], p2[3];
+            getTrianglePosition(vertices, comps, pos_comps, indices[t * 3 + 0], p0);
+            getTrianglePosition(vertices, comps, pos_comps, indices[t * 3 + 1], p1);
+            getTrianglePosition(vertices, comps, pos_comps, indices[t * 3 + 2], p2);
+            float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+            float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+            float n[3] = {
+                e1[1] * e2[2] - e1[2] * e2[1],
+                e1[2] * e2[0] - e1[0] * e2[2],
+                e1[0] * e2[1] - e1[1] * e2[0],
+            };
+            float w = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int j = 0; j < 3; j++)
+            {
+                centroids[c * 3 + j] += (p0[j] + p1[j] + p2[j]) * w / 3;
+                normals[c * 3 + j] += n[j];
+            }
+            area += w;
+        }
+        for (int j = 0; j < 3; j++)
+            mesh_centroid[j] += centroids[c * 3 + j];
+        mesh_area += area;
+        if (area > 0)
+        {
+            for (int j = 0; j < 3; j++)
+                centroids[c * 3 + j] /= area;
+        }
+    }
+    if (mesh_area > 0)
+    {
+        for (int j = 0; j < 3; j++)
+            mesh_centroid[j] /= mesh_area;
+    }
+    for (int c = 0; c < num_clusters; c++)
+    {
+        float *n = normals + c * 3;
+        float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        float key = 0;
+        for (int j = 0; j < 3 && len > 0; j++)
+            key += (centroids[c * 3 + j] - mesh_centroid[j]) * n[j] / len;
+        clusters[c].sort_key = key;
+    }
+    qsort(clusters, num_clusters, sizeof(BCMeshCluster), compareClusters);
+    uint32_t *output = NEW_ARRAY(num_indices, uint32_t);
+    int out = 0;
+    for (int c = 0; c < num_clusters; c++)
+    {
+        memcpy(output + out, indices + clusters[c].first * 3, clusters[c].count * 3 * sizeof(uint32_t));
+        out += clusters[c].count * 3;
+    }
+    memcpy(indices, output, num_indices * sizeof(uint32_t));
+    free(output);
+    free(centroids);
+    free(normals);
+    free(clusters);
+}
+
+static int optimizeVertexFetch(uint32_t *indices, int num_indices, int num_vertices, uint32_t *remap)
+{
+    // vertices in order of first use
+    memset(remap, 0xff, num_vertices * sizeof(uint32_t));
+    int next = 0;
+    for (int i = 0; i < num_indices; i++)
+    {
+        uint32_t v = indices[i];
+        if (remap[v] == UINT32_MAX)
+            remap[v] = next++;
+        indices[i] = remap[v];
+    }
+    return next;
+}
+
+float bcGetMeshACMR(BCMesh *mesh)
+{
+    if (mesh == NULL || mesh->draw_mode != GL_TRIANGLES)
     {
         bcLogWarning("Invalid mesh!");
+        return 0;
+    }
+    if (mesh->num_indices && mesh->indices == NULL)
+    {
+        bcLogWarning("Mesh has no index data!");
+        return 0;
+    }
+    uint32_t *indices = readMeshIndices(mesh, mesh->draw_count);
+    float acmr = getCacheMissRatio(indices, mesh->draw_count, mesh->num_vertices);
+    free(indices);
+    return acmr;
+}
+
+bool bcOptimizeMesh(BCMesh *mesh, int flags)
+{
+    if (mesh == NULL || mesh->vertices == NULL || (mesh->num_indices && mesh->indices == NULL))
+    {
+        bcLogError("Invalid mesh!");
+        return false;
+    }
+    int num_indices = (mesh->num_lods > 0) ? mesh->lods[0].count : mesh->num_indices ? mesh->num_indices : mesh->num_vertices;
+    if (mesh->draw_mode != GL_TRIANGLES || mesh->draw_count != num_indices || num_indices % 3)
+    {
+        bcLogWarning("Only complete triangle lists can be optimized!");
         return false;
     }
-    minv[0] = mesh->vertices[0];
-    minv[1] = mesh->vertices[1];
-    minv[2] = mesh->vertices[2];
-    maxv[0] = mesh->vertices[0];
-    maxv[1] = mesh->vertices[1];
-    maxv[2] = mesh->vertices[2];
-    for (int i = 1; i < mesh->num_vertices; i++)
-    {
-        minv[0] = fminf(minv[0], mesh->vertices[i * mesh->total_comps + 0]);
-        minv[1] = fminf(minv[1], mesh->vertices[i * mesh->total_comps + 1]);
-        minv[2] = fminf(minv[2], mesh->vertices[i * mesh->total_comps + 2]);
-        maxv[0] = fmaxf(maxv[0], mesh->vertices[i * mesh->total_comps + 0]);
-        maxv[1] = fmaxf(maxv[1], mesh->vertices[i * mesh->total_comps + 1]);
-        maxv[2] = fmaxf(maxv[2], mesh->vertices[i * mesh->total_comps + 2]);
+    // the result is indexed, vertex welding may not bring it under 16 bits
+    if (!checkIndexSupport((mesh->num_vertices > INDEX16_MAX_VERTICES) ? 4 : 2))
+    {
+        return false;
+    }
+    int num_vertices = mesh->num_vertices;
+    int comps = mesh->total_comps;
+    uint32_t *indices = readMeshIndices(mesh, num_indices);
+    uint32_t *remap = NEW_ARRAY(num_vertices, uint32_t);
+    float *vertices = mesh->vertices;
+    float acmr_before = getCacheMissRatio(indices, num_indices, num_vertices);
+    if (flags & BC_OPTIMIZE_WELD)
+    {
+        int unique = weldVertices(vertices, num_vertices, comps, remap);
+        // drop triangles that collapsed
+        int count = 0;
+        for (int i = 0; i < num_indices; i += 3)
+        {
+            uint32_t a = remap[indices[i + 0]];
+            uint32_t b = remap[indices[i + 1]];
+            uint32_t c = remap[indices[i + 2]];
+            if (a != b && b != c && a != c)
+            {
+                indices[count++] = a;
+                indices[count++] = b;
+                indices[count++] = c;
+            }
+        }
+        num_indices = count;
+        vertices = remapVertices(vertices, num_vertices, comps, remap, unique);
+        num_vertices = unique;
+    }
+    if (flags & BC_OPTIMIZE_VERTEX_CACHE)
+    {
+        optimizeVertexCache(indices, num_indices, num_vertices);
+    }
+    if ((flags & BC_OPTIMIZE_OVERDRAW) && mesh->comps[BC_VERTEX_ATTR_POSITIONS] >= 2)
+    {
+        optimizeOverdraw(indices, num_indices, vertices, num_vertices, comps, mesh->comps[BC_VERTEX_ATTR_POSITIONS]);
+    }
+    if (flags & BC_OPTIMIZE_VERTEX_FETCH)
+    {
+        int used = optimizeVertexFetch(indices, num_indices, num_vertices, remap);
+        float *fetched = remapVertices(vertices, num_vertices, comps, remap, used);
+        if (vertices != mesh->vertices)
+            free(vertices);
+        vertices = fetched;
+        num_vertices = used;
+    }
+    float acmr_after = getCacheMissRatio(indices, num_indices, num_vertices);
+    bcLog("Mesh optimized: vertices %d -> %d, ACMR %.3f -> %.3f",
+        mesh->num_vertices, num_vertices, acmr_before, acmr_after);
+    // replace mesh data, the result is always indexed
+    if (vertices != mesh->vertices)
+    {
+        free(mesh->vertices);
+        mesh->vertices = vertices;
+    }
+    free(mesh->indices);
+    mesh->index_size = (num_vertices > INDEX16_MAX_VERTICES) ? 4 : 2;
+    mesh->indices = malloc(num_indices * mesh->index_size);
+    copyIndices(mesh->indices, mesh->index_size, indices, 4, num_indices);
+    mesh->num_vertices = num_vertices;
+    mesh->num_indices = num_indices;
+    mesh->draw_count = num_indices;
+    mesh->num_lods = 0; // levels and parts use the old triangle order
+    mesh->num_parts = 0;
+    mesh->num_dirty_vertices = 0;
+    mesh->num_dirty_indices = 0;
+    free(indices);
+    free(remap);
+    if (mesh->type != BC_MESH_STREAM)
+    {
+        updateMeshBounds(mesh, mesh->vertices, mesh->num_vertices);
+    }
+    // GPU copies have the old layout
+    if (mesh->vbo_vertices || mesh->vbo_indices || mesh->arena >= 0)
+    {
+        bcReleaseMesh(mesh);
+        if (g_Context->CurrentMesh == mesh)
+            g_Context->CurrentMesh = NULL;
+        bcUpdateMesh(mesh);
     }
     return true;
 }
+
+//
+// Mesh LOD
+//
+
+static void addTriangleQuadric(double *q, const float *p0, const float *p1, const float *p2)
+{
+    // area weighted plane quadric, symmetric 4x4 stored as 10 values
+    double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+    double n[3] = {
+        e1[1] * e2[2] - e1[2] * e2[1],
+        e1[2] * e2[0] - e1[0] * e2[2],
+        e1[0] * e2[1] - e1[1] * e2[0],
+    };
+    double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (len == 0)
+        return;
+    double a = n[0] / len, b = n[1] / len, c = n[2] / len;
+    double d = -(a * p0[0] + b * p0[1] + c * p0[2]);
+    double w = len * 0.5;
+    q[0] += w * a * a; q[1] += w * a * b; q[2] += w * a * c; q[3] += w * a * d;
+    q[4] += w * b * b; q[5] += w * b * c; q[6] += w * b * d;
+    q[7] += w * c * c; q[8] += w * c * d;
+    q[9] += w * d * d;
+}
+
+static float evalQuadric(const double *q, const float *p)
+{
+    double x = p[0], y = p[1], z = p[2];
+    return (float) (q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x +
+        q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y +
+        q[7] * z * z + 2 * q[8] * z +
+        q[9]);
+}
+
+static int compareCollapses(const void *a, const void *b)
+{
+    float ea = ((const BCMeshCollapse *) a)->error;
+    float eb = ((const BCMeshCollapse *) b)->error;
+    return (ea < eb) ? -1 : (ea > eb) ? 1 : 0;
+}
+
+static void getTriangleNormal(const float *positions, uint32_t i0, uint32_t i1, uint32_t i2, float *n)
+{
+    const float *p0 = positions + i0 * 3;
+    const float *p1 = positions + i1 * 3;
+    const float *p2 = positions + i2 * 3;
+    float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static bool collapseFlipsTriangle(const float *positions, const uint32_t *indices, const int *tris, int count, uint32_t from, uint32_t to)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const uint32_t *tri = indices + tris[i] * 3;
+        if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2])
+            continue;
+        if (tri[0] == to || tri[1] == to || tri[2] == to)
+            continue; // removed by the collapse
+        uint32_t moved[3];
+        for (int k = 0; k < 3; k++)
+            moved[k] = (tri[k] == from) ? to : tri[k];
+        float n0[3], n1[3];
+        getTriangleNormal(positions, tri[0], tri[1], tri[2], n0);
+        getTriangleNormal(positions, moved[0], moved[1], moved[2], n1);
+        if (n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0)
+            return true;
+    }
+    return false;
+}
+
+static void lockBorderVertices(const uint32_t *indices, int num_indices, const int *offsets, const int *adjacency, bool *locked)
+{
+    // an edge without its opposite half-edge is a border or an attribute seam
+    for (int i = 0; i < num_indices; i++)
+    {
+        int t = i / 3;
+        uint32_t a = indices[i];
+        uint32_t b = indices[t * 3 + (i + 1) % 3];
+        bool opposite = false;
+        for (int j = offsets[b]; j < offsets[b + 1] && !opposite; j++)
+        {
+            const uint32_t *tri = indices + adjacency[j] * 3;
+            for (int k = 0; k < 3; k++)
+                opposite = opposite || (tri[k] == b && tri[(k + 1) % 3] == a);
+        }
+        if (!opposite)
+        {
+            locked[a] = true;
+            locked[b] = true;
+        }
+    }
+}
+
+static void buildTriangleAdjacency(const uint32_t *indices, int num_indices, int num_vertices, int *offsets, int *adjacency)
+{
+    memset(offsets, 0, (num_vertices + 1) * sizeof(int));
+    for (int i = 0; i < num_indices; i++)
+        offsets[indices[i] + 1]++;
+    for (int v = 0; v < num_vertices; v++)
+        offsets[v + 1] += offsets[v];
+    for (int i = 0; i < num_indices; i++)
+        adjacency[offsets[indices[i]]++] = i / 3;
+    // filling moved every offset to the next vertex
+    for (int v = num_vertices; v > 0; v--)
+        offsets[v] = offsets[v - 1];
+    offsets[0] = 0;
+}
+
+static int simplifyTriangles(uint32_t *indices, int num_indices, int target_indices, const float *positions, int num_vertices, double *quadrics, const bool *locked)
+{
+    // greedy half-edge collapses in passes, vertices are never moved so all levels share them
+    int *offsets = NEW_ARRAY(num_vertices + 1, int);
+    int *adjacency = NEW_ARRAY(num_indices, int);
+    bool *touched = NEW_ARRAY(num_vertices, bool);
+    BCMeshCollapse *collapses = NEW_ARRAY(num_indices * 2, BCMeshCollapse);
+    while (num_indices > target_indices)
+    {
+        buildTriangleAdjacency(indices, num_indices, num_vertices, offsets, adjacency);
+        int num_collapses = 0;
+        for (int i = 0; i < num_indices; i++)
+        {
+            uint32_t a = indices[i];
+            uint32_t b = indices[(i / 3) * 3 + (i + 1) % 3];
+            for (int k = 0; k < 2; k++)
+            {
+                uint32_t from = k ? b : a;
+                uint32_t to = k ? a : b;
+                if (locked[from])
+                    continue;
+                float error = evalQuadric(quadrics + from * 10, positions + to * 3) + evalQuadric(quadrics + to * 10, positions + to * 3);
+                collapses[num_collapses++] = (BCMeshCollapse) { from, to, error };
+            }
+        }
+        if (num_collapses == 0)
+            break;
+        qsort(collapses, num_collapses, sizeof(BCMeshCollapse), compareCollapses);
+        memset(touched, 0, num_vertices * sizeof(bool));
+        int removed = 0;
+        int applied = 0;
+        for (int i = 0; i < num_collapses && num_indices - removed > target_indices; i++)
+        {
+            uint32_t from = collapses[i].from;
+            uint32_t to = collapses[i].to;
+            if (touched[from] || touched[to])
+                continue;
+            const int *tris = adjacency + offsets[from];
+            int count = offsets[from + 1] - offsets[from];
+            if (collapseFlipsTriangle(positions, indices, tris, count, from, to))
+                continue;
+            for (int j = 0; j < count; j++)
+            {
+                uint32_t *tri = indices + tris[j] * 3;
+                bool degenerate = (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]);
+                for (int k = 0; k < 3; k++)
+                {
+                    if (tri[k] == from)
+                        tri[k] = to;
+                }
+                if (!degenerate && (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]))
+                    removed += 3;
+            }
+            for (int j = 0; j < 10; j++)
+                quadrics[to * 10 + j] += quadrics[from * 10 + j];
+            touched[from] = true;
+            touched[to] = true;
+            applied++;
+        }
+        // drop collapsed triangles
+        int count = 0;
+        for (int i = 0; i < num_indices; i += 3)
+        {
+            uint32_t *tri = indices + i;
+            if (tri[0] != tri[1] && tri[1] != tri[2] && tri[0] != tri[2])
+            {
+                memmove(indices + count, tri, 3 * sizeof(uint32_t));
+                count += 3;
+            }
+        }
+        num_indices = count;
+        if (applied == 0)
+            break;
+    }
+    free(offsets);
+    free(adjacency);
+    free(touched);
+    free(collapses);
+    return num_indices;
+}
+
+int bcGenerateMeshLODs(BCMesh *mesh, int num_lods, float ratio)
+{
+    if (mesh == NULL || mesh->vertices == NULL || mesh->comps[BC_VERTEX_ATTR_POSITIONS] < 2)
+    {
+        bcLogError("Invalid mesh!");
+        return 0;
+    }
+    int base_indices = (mesh->num_lods > 0) ? mesh->lods[0].count : mesh->num_indices;
+    if (mesh->draw_mode != GL_TRIANGLES || base_indices == 0 || mesh->draw_count != base_indices || base_indices % 3)
+    {
+        bcLogWarning("Only complete indexed triangle lists can be simplified!");
+        return 0;
+    }
+    if (num_lods < 1)
+        num_lods = 1;
+    if (num_lods > BC_MESH_MAX_LODS)
+        num_lods = BC_MESH_MAX_LODS;
+    if (ratio <= 0 || ratio >= 1)
+        ratio = 0.5f;
+    int num_vertices = mesh->num_vertices;
+    int pos_comps = mesh->comps[BC_VERTEX_ATTR_POSITIONS];
+    float *positions = NEW_ARRAY(num_vertices * 3, float);
+    for (int v = 0; v < num_vertices; v++)
+        getTrianglePosition(mesh->vertices, mesh->total_comps, pos_comps, v, positions + v * 3);
+    uint32_t *indices = readMeshIndices(mesh, base_indices);
+    // all levels are kept in one index array after the full mesh
+    uint32_t *chain = NEW_ARRAY(base_indices * num_lods, uint32_t);
+    memcpy(chain, indices, base_indices * sizeof(uint32_t));
+    int chain_count = base_indices;
+    mesh->lods[0] = (BCMeshRange) { 0, base_indices };
+    int *offsets = NEW_ARRAY(num_vertices + 1, int);
+    int *adjacency = NEW_ARRAY(base_indices, int);
+    bool *locked = NEW_ARRAY(num_vertices, bool);
+    double *quadrics = NEW_ARRAY(num_vertices * 10, double);
+    buildTriangleAdjacency(indices, base_indices, num_vertices, offsets, adjacency);
+    lockBorderVertices(indices, base_indices, offsets, adjacency, locked);
+    for (int i = 0; i < base_indices; i += 3)
+    {
+        const float *p0 = positions + indices[i + 0] * 3;
+        const float *p1 = positions + indices[i + 1] * 3;
+        const float *p2 = positions + indices[i + 2] * 3;
+        for (int k = 0; k < 3; k++)
+            addTriangleQuadric(quadrics + indices[i + k] * 10, p0, p1, p2);
+    }
+    free(offsets);
+    free(adjacency);
+    int lods = 1;
+    int num_indices = base_indices;
+    float target = (float) base_indices;
+    while (lods < num_lods)
+    {
+        // later levels continue from the previous one with accumulated error
+        target *= ratio;
+        int previous = num_indices;
+        num_indices = simplifyTriangles(indices, num_indices, ((int) target / 3) * 3, positions, num_vertices, quadrics, locked);
+        if (num_indices == 0 || num_indices > previous * LOD_MIN_REDUCTION)
+            break;
+        memcpy(chain + chain_count, indices, num_indices * sizeof(uint32_t));
+        optimizeVertexCache(chain + chain_count, num_indices, num_vertices);
+        mesh->lods[lods++] = (BCMeshRange) { chain_count, num_indices };
+        chain_count += num_indices;
+    }
+    bcLog("Mesh LODs: %d levels, %d -> %d triangles", lods, base_indices / 3, mesh->lods[lods - 1].count / 3);
+    resizeMeshIndices(mesh, chain_count);
+    copyIndices(mesh->indices, mesh->index_size, chain, 4, chain_count);
+    mesh->num_indices = chain_count;
+    mesh->num_lods = lods;
+    mesh->lod_frame = -1;
+    mesh->num_dirty_indices = 0;
+    free(positions);
+    free(indices);
+    free(chain);
+    free(locked);
+    free(quadrics);
+    // GPU copies are missing the new levels
+    if (mesh->vbo_vertices || mesh->vbo_indices || mesh->arena >= 0)
+    {
+        bcReleaseMesh(mesh);
+        if (g_Context->CurrentMesh == mesh)
+            g_Context->CurrentMesh = NULL;
+        bcUpdateMesh(mesh);
+    }
+    return lods;
+}
+
+BCMeshPart bcGetMeshLOD(BCMesh *mesh, int lod)
+{
+    if (mesh == NULL || lod < 0)
+    {
+        bcLogWarning("Invalid mesh LOD: %d", lod);
+        BCMeshPart part = { mesh, 0, mesh ? mesh->draw_count : 0 };
+        return part;
+    }
+    if (mesh->num_lods == 0)
+        return bcPartFromMesh(mesh);
+    if (lod >= mesh->num_lods)
+        lod = mesh->num_lods - 1;
+    BCMeshPart part = { mesh, mesh->lods[lod].first, mesh->lods[lod].count };
+    return part;
+}
@@ -34,6 +34,7 @@ bool bcIsWindowOpened(BCWindow *window);
 void bcPullWindowEvents(BCWindow *window);
 BCWindow * bcGetWindow();
 void bcSetWindow(BCWindow *window);
+void * bcGetProcAddress(const char *name);
 
 // Events
 BCEvent * bcDequeueEvent();
@@ -59,6 +60,8 @@ void bcCreateGfx();
 void bcDestroyGfx();
 void bcStartGfx();
 void bcStopGfx();
+void bcBeginGfxFrame();
+void bcEndGfxFrame();
 
 //
 // bcutils
@@ -392,6 +392,11 @@ void bcPullWindowEvents(BCWindow *window)
     glfwPollEvents();
 }
 
+void * bcGetProcAddress(const char *name)
+{
+    return (void *) glfwGetProcAddress(name);
+}
+
 int main(int argc, char **argv)
 {
     setvbuf(stdout, NULL, _IONBF, 0);
@@ -1,5 +1,9 @@
 #include <bcgl.h>
 #include <bcmath.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 static struct
 {
@@ -13,6 +17,110 @@ static struct
 
 BCColor cubeColor = BC_COLOR_BLUE;
 
+// simplified levels picked from screen size, with hysteresis per call site
+static BCMesh *lodSphere;
+static int lodSphereState = -1;
+
+// sprite throughput scene, toggled with B
+#define BENCH_SPRITES   10000
+#define BENCH_TEXTURES  4
+
+static struct
+{
+    bool enabled;
+    bool batched;
+    BCTexture *textures[BENCH_TEXTURES];
+    float last_time;
+    float time;
+    int frames;
+} bench;
+
+static void drawSpriteBench()
+{
+    // frame to frame time, so GPU work is included
+    float now = bcGetTime();
+    if (bench.last_time > 0)
+    {
+        bench.time += now - bench.last_time;
+        bench.frames++;
+    }
+    bench.last_time = now;
+    if (bench.time >= 1)
+    {
+        float frame_time = bench.time / bench.frames;
+        bcLog("Sprites (%s): %.2f ms/frame, %.0f sprites/s", bench.batched ? "batched" : "immediate",
+            frame_time * 1000, BENCH_SPRITES / frame_time);
+        bench.time = 0;
+        bench.frames = 0;
+    }
+
+    bcClear(BC_COLOR_GRAY);
+    bcPrepareScene2D(480, false);
+    bcSetColor(BC_COLOR_WHITE, BC_COLOR_TYPE_PRIMARY);
+    float width = bcGetDisplayAspectRatio() * 480;
+    if (bench.batched)
+        bcBeginSpriteBatch(true);
+    for (int i = 0; i < BENCH_SPRITES; i++)
+    {
+        float x = fmodf(i * 7.31f, width - 8);
+        float y = fmodf(i * 3.17f, 480 - 8);
+        bcDrawTexture2D(bench.textures[i % BENCH_TEXTURES], x, y, 8, 8, 0, 0, 1, 1);
+    }
+    if (bench.batched)
+        bcEndSpriteBatch();
+}
+
+// mesh file load times, raw against compressed, run with M
+#define LOAD_BENCH_RUNS 10
+
+static void dropFileCache(const char *filename)
+{
+#ifdef __linux__
+    // evict the file from the page cache so the first load reads the disk
+    char path[1024];
+    bcConvertPath(filename, path);
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0)
+    {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#endif
+}
+
+static float timeMeshLoad(const char *filename)
+{
+    float start = bcGetTime();
+    BCMesh *mesh = bcCreateMeshFromFile(filename);
+    float time = bcGetTime() - start;
+    if (mesh)
+        bcDestroyMesh(mesh);
+    return time;
+}
+
+static void runLoadBench()
+{
+    const char *files[2] = { "local://bench_raw.bcmd", "local://bench_compressed.bcmd" };
+    BCMesh *mesh = bcCreateMeshSphere(1, 128, 128);
+    bcSaveMeshToFile(mesh, files[0]);
+    bcSaveMeshToFileCompressed(mesh, files[1], 16);
+    bcDestroyMesh(mesh);
+    for (int i = 0; i < 2; i++)
+    {
+        dropFileCache(files[i]);
+        float cold = timeMeshLoad(files[i]);
+        float warm = 0;
+        for (int run = 0; run < LOAD_BENCH_RUNS; run++)
+        {
+            float time = timeMeshLoad(files[i]);
+            warm = (run == 0 || time < warm) ? time : warm;
+        }
+        bcLog("Mesh load (%s): cold %.2f ms, warm %.2f ms", i ? "compressed" : "raw", cold * 1000, warm * 1000);
+        bcRemoveFile(files[i]);
+    }
+}
+
 //
 // BCGL interface
 //
@@ -31,10 +139,31 @@ extern "C" void BC_onConfig(BCConfig *config)
 
 extern "C" void BC_onCreate()
 {
+    const BCColor colors[BENCH_TEXTURES] = { BC_COLOR_RED, BC_COLOR_GREEN, BC_COLOR_BLUE, BC_COLOR_YELLOW };
+    for (int i = 0; i < BENCH_TEXTURES; i++)
+    {
+        BCImage *image = bcCreateImage(8, 8, 4);
+        for (int p = 0; p < 8 * 8; p++)
+        {
+            image->data[p * 4 + 0] = (unsigned char) (colors[i].r * 255);
+            image->data[p * 4 + 1] = (unsigned char) (colors[i].g * 255);
+            image->data[p * 4 + 2] = (unsigned char) (colors[i].b * 255);
+            image->data[p * 4 + 3] = 255;
+        }
+        bench.textures[i] = bcCreateTextureFromImage(image, 0);
+    }
+    bench.batched = true;
+    lodSphere = bcCreateMeshSphere(1, 64, 64);
+    bcGenerateMeshLODs(lodSphere, 5, 0.5f);
 }
 
 extern "C" void BC_onDestroy()
 {
+    bcDestroyMesh(lodSphere);
+    for (int i = 0; i < BENCH_TEXTURES; i++)
+    {
+        bcDestroyTexture(bench.textures[i]);
+    }
 }
 
 extern "C" void BC_onStart()
@@ -62,9 +191,16 @@ extern "C" void BC_onUpdate(float dt)
 
 extern "C" void BC_onDraw()
 {
+    if (bench.enabled)
+    {
+        drawSpriteBench();
+        return;
+    }
+
     // scene 3D
     bcClear(BC_COLOR_GRAY);
     bcPrepareScene3D(60);
+    bcSetCulling(true);
     bcSetColor(BC_COLOR_WHITE, BC_COLOR_TYPE_PRIMARY);
 
     // camera
@@ -83,6 +219,11 @@ extern "C" void BC_onDraw()
     // scene
     bcSetColor(cubeColor, BC_COLOR_TYPE_PRIMARY);
     bcDrawCube(-1, -1, 0, 2, 2, 2, true);
+    bcPushMatrix();
+    bcTranslatef(3, 3, 1);
+    bcSetColor(BC_COLOR_WHITE, BC_COLOR_TYPE_PRIMARY);
+    bcDrawMeshLOD(lodSphere, &lodSphereState);
+    bcPopMatrix();
 }
 
 extern "C" void BC_onEvent(BCEvent event)
@@ -96,6 +237,18 @@ extern "C" void BC_onEvent(BCEvent event)
         case BC_KEY_ESCAPE:
             bcQuit(0);
             break;
+        case BC_KEY_B:
+            bench.enabled = !bench.enabled;
+            bench.last_time = 0;
+            bench.time = 0;
+            bench.frames = 0;
+            break;
+        case BC_KEY_S:
+            bench.batched = !bench.batched;
+            break;
+        case BC_KEY_M:
+            runLoadBench();
+            break;
         case BC_KEY_W:
             wireframe = !wireframe;
             bcSetWireframe(wireframe);